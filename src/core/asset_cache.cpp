@@ -0,0 +1,148 @@
+#include "core/asset_cache.hpp"
+
+#include "utils/hash.hpp"
+#include <utility>
+
+auto AssetKey::operator==(const AssetKey &other) const -> bool {
+  return content_hash == other.content_hash && variant == other.variant &&
+         path == other.path;
+}
+
+auto AssetKeyHash::operator()(const AssetKey &key) const -> size_t {
+  // The content hash already spreads well, the path only tells apart copies
+  return static_cast<size_t>(hash_bytes(key.path, key.content_hash) ^
+                             key.variant);
+}
+
+AssetRef::AssetRef(AssetCache *cache, asset_enum kind, uint32_t handle)
+    : cache_(cache), kind_(kind), handle_(handle) {}
+
+AssetRef::~AssetRef() {
+  if (cache_ != nullptr) {
+    cache_->release(kind_, handle_);
+  }
+}
+
+AssetRef::AssetRef(AssetRef &&other) noexcept { swap(other); }
+auto AssetRef::operator=(AssetRef &&other) noexcept -> AssetRef & {
+  swap(other);
+  return *this;
+}
+
+void AssetRef::swap(AssetRef &other) {
+  std::swap(this->cache_, other.cache_);
+  std::swap(this->kind_, other.kind_);
+  std::swap(this->handle_, other.handle_);
+}
+
+auto AssetRef::get() const -> uint32_t { return handle_; }
+
+AssetRef::operator bool() const { return cache_ != nullptr; }
+
+AssetCache::AssetCache(gl::GeometryArena &arena, gl::TextureAtlas &atlas)
+    : arena_(&arena), atlas_(&atlas) {}
+
+auto AssetCache::lookup(asset_enum kind, const AssetKey &key) -> AssetRef {
+  std::lock_guard lock(mutex_);
+  auto &cached = assets(kind);
+  const auto it = cached.handles.find(key);
+  if (it == cached.handles.end()) {
+    ++cached.misses;
+    return {};
+  }
+  ++cached.hits;
+  auto &entry = cached.entries.at(it->second);
+  ++entry.references;
+  shared_bytes_ += entry.bytes;
+  return {this, kind, it->second};
+}
+
+auto AssetCache::insert(asset_enum kind, const AssetKey &key,
+                        uint32_t handle, MeshInfo info) -> AssetRef {
+  std::lock_guard lock(mutex_);
+  auto &cached = assets(kind);
+  const auto it = cached.handles.find(key);
+  if (it != cached.handles.end()) {
+    // The lookup of this load turned out to be a hit after all
+    --cached.misses;
+    ++cached.hits;
+    cached.released.push_back(handle);
+    auto &entry = cached.entries.at(it->second);
+    ++entry.references;
+    shared_bytes_ += entry.bytes;
+    return {this, kind, it->second};
+  }
+
+  Entry entry;
+  entry.key = key;
+  entry.references = 1;
+  // Nothing is uploaded yet, so this is the whole asset
+  entry.bytes = kind == asset_enum::ASSET_MESH
+                    ? arena_->pending_bytes(handle)
+                    : atlas_->pending_bytes(handle);
+  entry.info = std::move(info);
+  cached.handles.emplace(key, handle);
+  cached.entries.emplace(handle, std::move(entry));
+  return {this, kind, handle};
+}
+
+auto AssetCache::get_mesh_info(uint32_t handle) const -> MeshInfo {
+  std::lock_guard lock(mutex_);
+  return assets_[static_cast<size_t>(asset_enum::ASSET_MESH)]
+      .entries.at(handle)
+      .info;
+}
+
+void AssetCache::end_frame() {
+  std::vector<uint32_t> meshes;
+  std::vector<uint32_t> textures;
+  {
+    std::lock_guard lock(mutex_);
+    meshes.swap(assets(asset_enum::ASSET_MESH).released);
+    textures.swap(assets(asset_enum::ASSET_TEXTURE).released);
+  }
+  for (const auto handle : meshes) {
+    arena_->free(handle);
+  }
+  for (const auto handle : textures) {
+    atlas_->free(handle);
+  }
+}
+
+auto AssetCache::get_arena() -> gl::GeometryArena & { return *arena_; }
+
+auto AssetCache::get_atlas() -> gl::TextureAtlas & { return *atlas_; }
+
+auto AssetCache::get_stats() const -> AssetCacheStats {
+  std::lock_guard lock(mutex_);
+  const auto &meshes = assets_[static_cast<size_t>(asset_enum::ASSET_MESH)];
+  const auto &textures =
+      assets_[static_cast<size_t>(asset_enum::ASSET_TEXTURE)];
+  AssetCacheStats stats;
+  stats.mesh_hits = meshes.hits;
+  stats.mesh_misses = meshes.misses;
+  stats.texture_hits = textures.hits;
+  stats.texture_misses = textures.misses;
+  stats.meshes = meshes.entries.size();
+  stats.textures = textures.entries.size();
+  stats.shared_bytes = shared_bytes_;
+  return stats;
+}
+
+void AssetCache::release(asset_enum kind, uint32_t handle) {
+  std::lock_guard lock(mutex_);
+  auto &cached = assets(kind);
+  const auto it = cached.entries.find(handle);
+  if (--it->second.references != 0) {
+    shared_bytes_ -= it->second.bytes;
+    return;
+  }
+  // The handle may be reused as soon as it's freed, forget it right away
+  cached.handles.erase(it->second.key);
+  cached.entries.erase(it);
+  cached.released.push_back(handle);
+}
+
+auto AssetCache::assets(asset_enum kind) -> Assets & {
+  return assets_[static_cast<size_t>(kind)];
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "utils/geometry_arena.hpp"
+#include "utils/texture_atlas.hpp"
+#include "utils/vertex_format.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum struct asset_enum { ASSET_MESH, ASSET_TEXTURE };
+
+// Identifies the contents of an asset, not just where it was loaded from
+struct AssetKey {
+  // Canonical path of the source file
+  std::string path;
+  uint64_t content_hash = 0;
+  // Processing that changes what ends up on the GPU, e.g. the vertex format
+  uint32_t variant = 0;
+
+  auto operator==(const AssetKey &other) const -> bool;
+};
+
+struct AssetKeyHash {
+  auto operator()(const AssetKey &key) const -> size_t;
+};
+
+struct AssetCacheStats {
+  size_t mesh_hits = 0;
+  size_t mesh_misses = 0;
+  size_t texture_hits = 0;
+  size_t texture_misses = 0;
+  // Meshes and textures resident right now
+  size_t meshes = 0;
+  size_t textures = 0;
+  // GPU bytes every extra user would have uploaded again without sharing
+  size_t shared_bytes = 0;
+};
+
+// What a model needs from a shared mesh besides its geometry
+struct MeshInfo {
+  gl::MeshLayout layout;
+  std::string texture_path;
+};
+
+struct AssetCache;
+
+// Counted reference to a shared mesh or texture, released on destruction
+struct AssetRef {
+  AssetRef() = default;
+  AssetRef(AssetCache *cache, asset_enum kind, uint32_t handle);
+  ~AssetRef();
+
+  AssetRef(const AssetRef &) = delete;
+  AssetRef(AssetRef &&other) noexcept;
+  auto operator=(const AssetRef &) -> AssetRef & = delete;
+  auto operator=(AssetRef &&other) noexcept -> AssetRef &;
+
+  void swap(AssetRef &other);
+
+  // Handle in the geometry arena or the texture atlas
+  [[nodiscard]] auto get() const -> uint32_t;
+  explicit operator bool() const;
+
+private:
+  AssetCache *cache_ = nullptr;
+  asset_enum kind_ = asset_enum::ASSET_MESH;
+  uint32_t handle_ = 0;
+};
+
+// Shares meshes and textures between models whose files have the same
+// contents. Every asset is freed once its last reference is gone.
+//
+// `lookup` and releasing references are safe from any thread, so loaders
+// can skip parsing and decoding assets that are already resident. The
+// arena and the atlas are only touched on the render thread.
+struct AssetCache {
+  AssetCache(gl::GeometryArena &arena, gl::TextureAtlas &atlas);
+  ~AssetCache() = default;
+
+  AssetCache(const AssetCache &) = delete;
+  AssetCache(AssetCache &&other) noexcept = delete;
+  auto operator=(const AssetCache &) -> AssetCache & = delete;
+  auto operator=(AssetCache &&other) noexcept -> AssetCache & = delete;
+
+  // Returns a reference to the asset, or an empty one if it isn't resident.
+  // Counts a hit or a miss.
+  auto lookup(asset_enum kind, const AssetKey &key) -> AssetRef;
+  // Takes ownership of `handle`, freshly allocated from `key`. If another
+  // load inserted the same asset since its lookup missed, `handle` is freed
+  // and the existing asset is shared instead. Render thread only.
+  auto insert(asset_enum kind, const AssetKey &key, uint32_t handle,
+              MeshInfo info = {}) -> AssetRef;
+  [[nodiscard]] auto get_mesh_info(uint32_t handle) const -> MeshInfo;
+
+  // Frees the assets released since the last call. Render thread only.
+  void end_frame();
+
+  auto get_arena() -> gl::GeometryArena &;
+  auto get_atlas() -> gl::TextureAtlas &;
+  [[nodiscard]] auto get_stats() const -> AssetCacheStats;
+
+private:
+  friend struct AssetRef;
+
+  struct Entry {
+    AssetKey key;
+    size_t references = 0;
+    size_t bytes = 0;
+    // Meshes only
+    MeshInfo info;
+  };
+  struct Assets {
+    std::unordered_map<AssetKey, uint32_t, AssetKeyHash> handles;
+    std::unordered_map<uint32_t, Entry> entries;
+    std::vector<uint32_t> released;
+    size_t hits = 0;
+    size_t misses = 0;
+  };
+
+  void release(asset_enum kind, uint32_t handle);
+  auto assets(asset_enum kind) -> Assets &;
+
+  gl::GeometryArena *arena_;
+  gl::TextureAtlas *atlas_;
+  std::array<Assets, 2> assets_;
+  size_t shared_bytes_ = 0;
+  mutable std::mutex mutex_;
+};
@@ -1,39 +1,317 @@
 #include "core/model.hpp"
 
+#include "settings.hpp"
+#include "utils/mesh/mesh_cache.hpp"
+#include "utils/mesh/mesh_optimizer.hpp"
+#include "utils/mesh/mesh_simplifier.hpp"
+#include "utils/parsers/obj_lexer.hpp"
 #include "utils/parsers/parsers.hpp"
 #include "utils/primitives.hpp"
-#include <glm/gtx/transform.hpp>
+#include "utils/texture/texture_cache.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
 
-Model::Model(std::vector<gl::Element> &elements,
-             std::vector<gl::Vertex> &vertices, gl::Texture &texture)
-    : ebo_(GL_ELEMENT_ARRAY_BUFFER, std::move(elements)),
-      vbo_(GL_ARRAY_BUFFER, std::move(vertices)), texture_(std::move(texture)) {
+namespace {
+
+// Assimp picks an importer from this hint when reading from memory
+auto file_type(const std::string_view path) -> std::string {
+  auto extension = std::filesystem::path(path).extension().string();
+  if (!extension.empty()) {
+    extension.erase(0, 1);
+  }
+  return extension;
+}
+
+// Identifies the loader, processing steps and vertex format in the mesh cache
+// key
+auto pipeline(loader_enum loader, const LoadOptions &options) -> uint32_t {
+  constexpr uint32_t optimized = 1U << 8U;
+  constexpr uint32_t with_lods = 1U << 9U;
+  constexpr unsigned format_shift = 16;
+  auto id = static_cast<uint32_t>(loader) |
+            static_cast<uint32_t>(options.vertex_format) << format_shift;
+  if (options.optimize_mesh) {
+    id |= optimized;
+  }
+  if (options.generate_lods) {
+    id |= with_lods;
+  }
+  return id;
+}
+
+// Everything besides the loader that changes the mesh on the GPU
+auto mesh_variant(loader_enum loader, const LoadOptions &options)
+    -> uint32_t {
+  constexpr unsigned residency_shift = 20;
+  return pipeline(loader, options) |
+         static_cast<uint32_t>(options.residency) << residency_shift;
+}
+
+// The material file of an OBJ, whose color and texture path end up in the
+// baked mesh. Unmapped if there is none.
+auto map_material(loader_enum loader, const std::string_view obj)
+    -> FileView {
+  if (loader == loader_enum::LOADER_ASSIMP) {
+    return {};
+  }
+  const auto mtl_path = parser::obj::lexer::find_mtl_path(obj);
+  return mtl_path.empty() ? FileView() : map_file(mtl_path);
+}
+
+// Decodes the texture unless the asset cache already has it. Textures too
+// large for an atlas tile are compressed if `compress` is set, through the
+// on-disk cache when it's up to date.
+void load_texture(const std::string_view path, bool compress,
+                  AssetCache &assets, ModelData &data) {
+  auto file = map_file(path);
+  const auto cache_key = texture::make_cache_key(path, file.view());
+  data.texture_key = {cache_key.source_path, cache_key.content_hash,
+                      compress ? 1U : 0U};
+  data.shared_texture =
+      assets.lookup(asset_enum::ASSET_TEXTURE, data.texture_key);
+  if (data.shared_texture) {
+    return;
+  }
+
+  if (compress) {
+    auto cached =
+        texture::load_cached(settings::texture_cache_directory, cache_key);
+    if (cached) {
+      data.compressed_texture = std::move(*cached);
+      return;
+    }
+  }
+  auto surface = load_image(path);
+  if (!compress || (surface->w <= gl::atlas_max_tile_texture &&
+                    surface->h <= gl::atlas_max_tile_texture)) {
+    data.texture = std::move(surface);
+    return;
+  }
+  data.compressed_texture = texture::compress(*surface);
+  texture::store_cached(settings::texture_cache_directory, cache_key,
+                        data.compressed_texture);
+}
+
+// Processing of a freshly parsed mesh, before it's baked
+void process_mesh(mesh::MeshData &mesh_data, const LoadOptions &options) {
+  if (options.optimize_mesh) {
+    mesh::optimize(mesh_data);
+  }
+  if (options.generate_lods) {
+    mesh::build_lods(mesh_data);
+  }
+}
+
+// Only reads a flag GLEW set during initialization, no GL call
+auto compress_textures(const LoadOptions &options) -> bool {
+  return options.compress_texture && GLEW_EXT_texture_compression_s3tc;
+}
+
+} // namespace
+
+auto load_model_data(AssetCache &assets, loader_enum loader,
+                     const std::string_view path,
+                     const std::string_view texture_path,
+                     const LoadOptions &options) -> ModelData {
+  auto file = map_file(path);
+  const auto material = map_material(loader, file.view());
+  // OBJ files name their texture in the material file
+  const auto baked_texture_path = loader == loader_enum::LOADER_ASSIMP
+                                      ? texture_path
+                                      : std::string_view();
+
+  // Different loaders, options and materials bake different meshes
+  const auto cache_key =
+      mesh::make_cache_key(path, file.view(), pipeline(loader, options),
+                           {material.view(), baked_texture_path});
+
+  ModelData data;
+  data.residency = options.residency;
+  data.mesh_key = {cache_key.source_path, cache_key.content_hash,
+                   mesh_variant(loader, options)};
+  data.shared_mesh = assets.lookup(asset_enum::ASSET_MESH, data.mesh_key);
+
+  std::string mesh_texture_path;
+  if (data.shared_mesh) {
+    mesh_texture_path =
+        assets.get_mesh_info(data.shared_mesh.get()).texture_path;
+  } else {
+    auto cached =
+        mesh::load_cached(settings::mesh_cache_directory, cache_key);
+    if (cached) {
+      data.mesh = std::move(*cached);
+    } else {
+      mesh::MeshData mesh_data;
+      switch (loader) {
+      case loader_enum::LOADER_OBJ:
+        mesh_data = parser::parse_model(file.view());
+        break;
+      case loader_enum::LOADER_OBJ_X3:
+        mesh_data = parser::parse_model(
+            file.view(), parser::obj_parser_enum::OBJ_PARSER_X3);
+        break;
+      case loader_enum::LOADER_ASSIMP:
+        mesh_data = parser::parse_model_assimp(file.view(), file_type(path),
+                                               texture_path);
+        break;
+      default:
+        break;
+      }
+      process_mesh(mesh_data, options);
+      data.mesh = mesh::pack(mesh_data, options.vertex_format);
+      mesh::store_cached(settings::mesh_cache_directory, cache_key,
+                         data.mesh);
+    }
+    mesh_texture_path = data.mesh.texture_path;
+  }
+
+  // The albedo map isn't part of the model file, the caller picks it each time
+  if (loader == loader_enum::LOADER_ASSIMP) {
+    mesh_texture_path = std::string(texture_path);
+  }
+
+  load_texture(mesh_texture_path, compress_textures(options), assets, data);
+  return data;
+}
+
+auto load_scene_data(AssetCache &assets, const std::string_view path,
+                     const std::string_view texture_path,
+                     const LoadOptions &options) -> SceneModelData {
+  auto file = map_file(path);
+  constexpr auto loader = loader_enum::LOADER_ASSIMP;
+  const auto file_key = mesh::make_cache_key(
+      path, file.view(), pipeline(loader, options), {texture_path});
+  // The hierarchy is baked next to the meshes, so the file is only parsed
+  // again if one of them is missing from the cache
+  std::optional<mesh::SceneData> parsed;
+  auto parse = [&]() -> mesh::SceneData & {
+    if (!parsed) {
+      parsed = parser::parse_scene_assimp(file.view(), file_type(path),
+                                          texture_path);
+    }
+    return *parsed;
+  };
+  auto scene =
+      mesh::load_cached_scene(settings::mesh_cache_directory, file_key);
+  if (!scene) {
+    auto &parsed_scene = parse();
+    // Empty meshes draw nothing, the nodes forget them before baking
+    for (auto &node : parsed_scene.nodes) {
+      auto &meshes = node.meshes;
+      meshes.erase(std::remove_if(meshes.begin(), meshes.end(),
+                                  [&](uint32_t mesh) {
+                                    return parsed_scene.meshes.at(mesh)
+                                        .elements.empty();
+                                  }),
+                   meshes.end());
+    }
+    scene.emplace();
+    scene->mesh_names = parsed_scene.mesh_names;
+    scene->nodes = parsed_scene.nodes;
+    mesh::store_cached_scene(settings::mesh_cache_directory, file_key,
+                             *scene);
+  }
+
+  // Nodes referencing the same mesh draw the same part
+  std::vector<std::vector<uint32_t>> mesh_nodes(scene->mesh_names.size());
+  for (size_t i = 0; i != scene->nodes.size(); ++i) {
+    for (const auto mesh : scene->nodes[i].meshes) {
+      mesh_nodes.at(mesh).push_back(static_cast<uint32_t>(i));
+    }
+    scene->nodes[i].meshes.clear();
+  }
+
+  SceneModelData data;
+  for (size_t i = 0; i != mesh_nodes.size(); ++i) {
+    if (mesh_nodes[i].empty()) {
+      continue;
+    }
+    // Every mesh is shared and baked on its own, under its index in the file
+    auto cache_key = file_key;
+    cache_key.source_path += "#" + std::to_string(i);
+
+    ModelData part;
+    part.residency = options.residency;
+    part.mesh_key = {cache_key.source_path, cache_key.content_hash,
+                     mesh_variant(loader, options)};
+    part.shared_mesh = assets.lookup(asset_enum::ASSET_MESH, part.mesh_key);
+    if (!part.shared_mesh) {
+      auto cached =
+          mesh::load_cached(settings::mesh_cache_directory, cache_key);
+      if (cached) {
+        part.mesh = std::move(*cached);
+      } else {
+        auto &mesh_data = parse().meshes.at(i);
+        process_mesh(mesh_data, options);
+        part.mesh = mesh::pack(mesh_data, options.vertex_format);
+        mesh::store_cached(settings::mesh_cache_directory, cache_key,
+                           part.mesh);
+      }
+    }
+
+    // All parts use the albedo map, only the first one carries its pixels
+    if (data.parts.empty()) {
+      load_texture(texture_path, compress_textures(options), assets, part);
+    } else {
+      part.texture_key = data.parts.front().texture_key;
+    }
+    data.parts.push_back(std::move(part));
+    data.part_names.push_back(scene->mesh_names[i]);
+    data.part_nodes.push_back(std::move(mesh_nodes[i]));
+  }
+  if (data.parts.empty()) {
+    throw std::runtime_error("No node of the scene draws a mesh!");
+  }
+  data.nodes = std::move(scene->nodes);
+  return data;
+}
+
+Model::Model(AssetCache &assets, TransformStore &transforms,
+             loader_enum loader, const std::string_view path,
+             const std::string_view texture_path, const LoadOptions &options)
+    : Model(assets, transforms,
+            load_model_data(assets, loader, path, texture_path, options)) {
+  upload(std::numeric_limits<size_t>::max());
 }
 
-Model::Model(loader_enum loader, const std::string_view path,
-             const std::string_view texture_path) {
-  auto file = load_file(path);
+Model::Model(AssetCache &assets, TransformStore &transforms, ModelData &&data)
+    : assets_(&assets), transforms_(&transforms),
+      transform_(transforms.allocate()) {
+  geometry_ = std::move(data.shared_mesh);
+  if (!geometry_) {
+    MeshInfo info{data.mesh.layout, data.mesh.texture_path};
+    const auto handle =
+        assets.get_arena().allocate(std::move(data.mesh), data.residency);
+    geometry_ = assets.insert(asset_enum::ASSET_MESH, data.mesh_key, handle,
+                              std::move(info));
+  }
+  layout_ = assets.get_mesh_info(geometry_.get()).layout;
 
-  gl::Texture texture;
-  std::vector<gl::Element> elements;
-  std::vector<gl::Vertex> vertices;
+  texture_ = std::move(data.shared_texture);
+  // Parts of a scene only carry the key, the first part inserted the texture
+  if (!texture_) {
+    texture_ = assets.lookup(asset_enum::ASSET_TEXTURE, data.texture_key);
+  }
+  if (!texture_) {
+    auto &atlas = assets.get_atlas();
+    const auto handle =
+        data.compressed_texture.levels.empty()
+            ? atlas.allocate(std::move(data.texture))
+            : atlas.allocate(std::move(data.compressed_texture));
+    texture_ = assets.insert(asset_enum::ASSET_TEXTURE, data.texture_key,
+                             handle);
+  }
+}
 
-  switch (loader) {
-  case loader_enum::LOADER_OBJ:
-    std::tie(elements, vertices, texture) = parser::parse_model(file);
-    break;
-  case loader_enum::LOADER_ASSIMP:
-    std::tie(elements, vertices, texture) =
-        parser::parse_model_assimp(file, "fbx", texture_path);
-    break;
-  default:
-    elements = std::vector<gl::Element>();
-    vertices = std::vector<gl::Vertex>();
-    break;
+Model::~Model() {
+  if (transforms_ != nullptr) {
+    transforms_->free(transform_);
   }
-  ebo_ = gl::Buffer<gl::Element>(GL_ELEMENT_ARRAY_BUFFER, std::move(elements));
-  vbo_ = gl::Buffer<gl::Vertex>(GL_ARRAY_BUFFER, std::move(vertices));
-  texture_ = gl::Texture(std::move(texture));
 }
 
 Model::Model(Model &&other) noexcept { swap(other); };
@@ -43,82 +321,144 @@ auto Model::operator=(Model &&other) noexcept -> Model & {
 };
 
 void Model::swap(Model &other) {
-  this->ebo_.swap(other.ebo_);
-  this->vbo_.swap(other.vbo_);
-  std::swap(this->mvp_matrix_, other.mvp_matrix_);
-  std::swap(this->texture_, other.texture_);
-  std::swap(this->scale_, other.scale_);
-  std::swap(this->offset_, other.offset_);
+  std::swap(this->assets_, other.assets_);
+  this->geometry_.swap(other.geometry_);
+  std::swap(this->layout_, other.layout_);
+  std::swap(this->transforms_, other.transforms_);
+  std::swap(this->transform_, other.transform_);
+  std::swap(this->scene_index_, other.scene_index_);
+  std::swap(this->lod_, other.lod_);
+  this->texture_.swap(other.texture_);
+  this->instances_.swap(other.instances_);
+  std::swap(this->scene_root_, other.scene_root_);
+  std::swap(this->scene_nodes_, other.scene_nodes_);
+  std::swap(this->node_matrices_, other.node_matrices_);
+  std::swap(this->node_lods_, other.node_lods_);
+  std::swap(this->node_instances_, other.node_instances_);
+  std::swap(this->scene_generation_, other.scene_generation_);
   std::swap(this->settings, other.settings);
 }
 
-void Model::render(const GLuint &matrix_uniform) {
-  glUniformMatrix4fv(matrix_uniform, 1, GL_FALSE, &mvp_matrix_[0][0]);
-  bind_buffers();
-  set_layout();
-  glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(ebo_.get_data().size() * 3),
-                 GL_UNSIGNED_INT, nullptr);
+auto Model::upload(const size_t max_bytes) -> size_t {
+  size_t written = assets_->get_arena().upload(geometry_.get(), max_bytes);
+  // Textures go at least one row at a time, so only start with budget left
+  if (written < max_bytes) {
+    written +=
+        assets_->get_atlas().upload(texture_.get(), max_bytes - written);
+  }
+  return written;
 }
 
-void Model::set_mvp_matrix(const glm::mat4 &mvp_matrix) {
-  mvp_matrix_ = mvp_matrix;
+auto Model::pending_upload_bytes() const -> size_t {
+  return assets_->get_arena().pending_bytes(geometry_.get()) +
+         assets_->get_atlas().pending_bytes(texture_.get());
 }
 
-auto Model::get_mvp_matrix() -> const glm::mat4 & { return mvp_matrix_; }
-
-void Model::bind_buffers() {
-  ebo_.bind();
-  vbo_.bind();
-  texture_.bind();
+auto Model::get_geometry() const -> gl::GeometryArena::Handle {
+  return geometry_.get();
 }
 
-void Model::set_layout() {
-
-  // Set constants according to our data structure
-  constexpr int offset_vertex = 0;
-  constexpr int offset_color = 3;
-  constexpr int offset_uv = 6;
+auto Model::get_layout() const -> const gl::MeshLayout & { return layout_; }
 
-  constexpr int stride_vertex = 3;
-  constexpr int stride_color = 3;
-  constexpr int stride_uv = 2;
+auto Model::get_texture_region() const -> gl::AtlasRegion {
+  return assets_->get_atlas().get_region(texture_.get());
+}
 
-  constexpr int total_stride = stride_vertex + stride_color + stride_uv;
+auto Model::get_instances() -> gl::InstanceBuffer & { return instances_; }
 
-  glVertexAttribPointer(offset_vertex, stride_vertex, GL_FLOAT, GL_FALSE,
-                        total_stride * sizeof(float), nullptr);
-  glVertexAttribPointer(
-      offset_color, stride_color, GL_FLOAT, GL_FALSE,
-      total_stride * sizeof(float),
-      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
-      reinterpret_cast<void *>(offset_color * sizeof(float)));
-  glVertexAttribPointer(
-      offset_uv, stride_uv, GL_FLOAT, GL_FALSE, total_stride * sizeof(float),
-      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
-      reinterpret_cast<void *>(offset_uv * sizeof(float)));
+auto Model::get_model_matrix() const -> const glm::mat4 & {
+  return transforms_->get_matrix(transform_);
 }
 
 void Model::set_offset(const glm::dvec3 &offset) {
   // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
   settings.offset = {offset.x, offset.y, offset.z};
-  offset_ = offset;
+  transforms_->set_offset(transform_, glm::vec3(offset));
+}
+auto Model::get_offset() const -> glm::vec3 {
+  return transforms_->get_offset(transform_);
 }
-auto Model::get_offset() -> const glm::dvec3 & { return offset_; }
 void Model::set_scale(const glm::dvec3 &scale) {
   // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
   settings.scale = {scale.x, scale.y, scale.z};
-  scale_ = scale;
+  transforms_->set_scale(transform_, glm::vec3(scale));
+}
+auto Model::get_scale() const -> glm::vec3 {
+  return transforms_->get_scale(transform_);
+}
+
+void Model::set_rotation(const glm::vec3 &angles) {
+  transforms_->set_rotation(transform_, angles);
+}
+
+void Model::set_rotating(const bool rotating) {
+  settings.is_rotating = rotating;
+  transforms_->set_spinning(transform_, rotating);
+}
+
+auto Model::get_world_bounds() const -> Aabb {
+  const Aabb bounds{layout_.bounds_min, layout_.bounds_max};
+  if (scene_nodes_.empty()) {
+    return bounds.transformed(get_model_matrix());
+  }
+  Aabb world;
+  for (const auto &node_matrix : node_matrices_) {
+    world.grow(bounds.transformed(get_model_matrix() * node_matrix));
+  }
+  return world;
+}
+
+auto Model::take_transform_changed() -> bool {
+  return transforms_->take_changed(transform_);
+}
+
+void Model::set_scene_index(const size_t index) { scene_index_ = index; }
+
+auto Model::get_scene_index() const -> size_t { return scene_index_; }
+
+void Model::set_lod(const size_t lod) { lod_ = lod; }
+
+auto Model::get_lod() const -> size_t { return lod_; }
+
+void Model::attach_to_scene(const SceneGraph::Node root,
+                            std::vector<SceneGraph::Node> nodes) {
+  scene_root_ = root;
+  scene_nodes_ = std::move(nodes);
+  scene_generation_ = 0;
+  node_matrices_.assign(scene_nodes_.size(), glm::mat4(1.0F));
+  node_lods_.assign(scene_nodes_.size(), 0);
+}
+
+auto Model::sync_scene(const SceneGraph &scene) -> bool {
+  if (scene_nodes_.empty() || scene.get_generation() == scene_generation_) {
+    return false;
+  }
+  bool moved = false;
+  for (size_t i = 0; i != scene_nodes_.size(); ++i) {
+    const auto node = scene_nodes_[i];
+    if (scene.get_generation(node) > scene_generation_) {
+      node_matrices_[i] = scene.get_world(node);
+      moved = true;
+    }
+  }
+  scene_generation_ = scene.get_generation();
+  return moved;
+}
+
+auto Model::get_scene_root() const -> SceneGraph::Node { return scene_root_; }
+
+auto Model::get_node_matrices() const -> const std::vector<glm::mat4> & {
+  return node_matrices_;
+}
+
+void Model::set_node_lod(const size_t node, const size_t lod) {
+  node_lods_[node] = static_cast<uint8_t>(lod);
 }
-auto Model::get_scale() -> const glm::dvec3 & { return scale_; }
 
-void Model::calculate_mvp_matrix(const glm::dmat4 &projection_matrix,
-                                 const glm::dmat4 &view_matrix) {
-  constexpr auto identity_matrix = glm::dmat4(1.0);
-  auto model_matrix = glm::scale(identity_matrix, scale_);
-  mvp_matrix_ =
-      projection_matrix * glm::translate(view_matrix, offset_) * model_matrix;
+auto Model::get_node_lod(const size_t node) const -> size_t {
+  return node_lods_[node];
 }
 
-void Model::rotate(double angle, const glm::dvec3 &axis) {
-  mvp_matrix_ = glm::rotate(glm::dmat4(mvp_matrix_), angle, axis);
-};
\ No newline at end of file
+auto Model::get_node_instances(const size_t lod) -> gl::InstanceBuffer & {
+  return node_instances_.at(lod);
+}
\ No newline at end of file
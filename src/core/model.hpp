@@ -1,22 +1,100 @@
 #pragma once
 
+#include "core/asset_cache.hpp"
 #include "utils/GL.hpp"
+#include "utils/bvh.hpp"
+#include "utils/geometry_arena.hpp"
+#include "utils/instance_buffer.hpp"
+#include "utils/mesh/mesh_data.hpp"
+#include "utils/mesh/packed_mesh.hpp"
+#include "utils/mesh/scene_data.hpp"
 #include "utils/primitives.hpp"
+#include "utils/scene_graph.hpp"
+#include "utils/texture/texture_compressor.hpp"
+#include "utils/texture_atlas.hpp"
+#include "utils/transform_store.hpp"
 #include <GL/glew.h>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <string>
 #include <string_view>
+#include <vector>
 
-enum struct loader_enum { LOADER_OBJ, LOADER_ASSIMP };
+enum struct loader_enum { LOADER_OBJ, LOADER_OBJ_X3, LOADER_ASSIMP };
 
+// Optional processing of a loaded mesh. Baked meshes are cached per option
+// set, so changing an option doesn't reuse a stale mesh.
+struct LoadOptions {
+  // Reorder triangles and vertices for the post-transform cache
+  bool optimize_mesh = true;
+  // Simplified versions of the mesh, drawn when it covers few pixels
+  bool generate_lods = true;
+  // Every format is baked on its own
+  mesh::vertex_format_enum vertex_format =
+      mesh::vertex_format_enum::VERTEX_COMPACT;
+  // Keep the packed vertices and indices in memory after the upload, for
+  // code that reads them through `GeometryArena::get_vertices` and
+  // `get_indices`. By default they are released once on the GPU.
+  gl::residency_enum residency = gl::residency_enum::RESIDENCY_GPU_ONLY;
+  // Store textures too large for an atlas tile as S3TC if the driver can
+  // sample it. Compressed textures are cached.
+  bool compress_texture = true;
+};
+
+// Everything a model needs that can be prepared without an OpenGL context
+struct ModelData {
+  mesh::PackedMesh mesh;
+  // Either the decoded texture or its compressed mip chain
+  sdl2::unique_ptr<SDL_Surface> texture;
+  texture::CompressedImage compressed_texture;
+  gl::residency_enum residency = gl::residency_enum::RESIDENCY_GPU_ONLY;
+  AssetKey mesh_key;
+  AssetKey texture_key;
+  // Set instead of the data above when the asset cache already had it
+  AssetRef shared_mesh;
+  AssetRef shared_texture;
+};
+
+// Reads, parses and decodes a model, skipping the mesh and texture if
+// `assets` already has them. Safe to call from any thread.
+auto load_model_data(AssetCache &assets, loader_enum loader,
+                     std::string_view path,
+                     std::string_view texture_path = {},
+                     const LoadOptions &options = {}) -> ModelData;
+
+// A model file with its node hierarchy. Every mesh some node draws becomes
+// one part, drawn once per node that references it.
+struct SceneModelData {
+  std::vector<ModelData> parts;
+  std::vector<std::string> part_names;
+  // Indices in `nodes` drawing each part
+  std::vector<std::vector<uint32_t>> part_nodes;
+  // Without their meshes, parents before children
+  std::vector<mesh::SceneNode> nodes;
+};
+
+// Like `load_model_data`, but keeps the hierarchy instead of merging all
+// meshes into one. Only Assimp files have one.
+auto load_scene_data(AssetCache &assets, std::string_view path,
+                     std::string_view texture_path = {},
+                     const LoadOptions &options = {}) -> SceneModelData;
+
+// Handles to the shared mesh and texture and the settings of the UI. The
+// transform is kept in a `TransformStore` with those of all other models.
 struct Model {
   Model() = default;
 
-  Model(std::vector<gl::Element> &elements, std::vector<gl::Vertex> &vertices,
-        gl::Texture &texture);
+  Model(AssetCache &assets, TransformStore &transforms, loader_enum loader,
+        std::string_view path, std::string_view texture_path = {},
+        const LoadOptions &options = {});
 
-  Model(loader_enum loader, std::string_view path,
-        std::string_view texture_path = nullptr);
+  // Shares the mesh and texture through `assets` or allocates them in its
+  // arena and atlas, so it has to run on the render thread. New data isn't
+  // uploaded yet, see `upload`.
+  Model(AssetCache &assets, TransformStore &transforms, ModelData &&data);
 
-  ~Model() = default;
+  ~Model();
 
   Model(const Model &) = delete;
   Model(Model &&other) noexcept;
@@ -24,18 +102,58 @@ struct Model {
   auto operator=(Model &&other) noexcept -> Model &;
 
   void swap(Model &other);
-  void render(const GLuint &matrix_uniform);
-  void set_mvp_matrix(const glm::mat4 &mvp_matrix);
-  auto get_mvp_matrix() -> const glm::mat4 &;
+
+  // Streams at most `max_bytes` of buffer and texture data to the GPU and
+  // returns the number of bytes written. Draw only once nothing is pending.
+  auto upload(size_t max_bytes) -> size_t;
+  [[nodiscard]] auto pending_upload_bytes() const -> size_t;
+  [[nodiscard]] auto get_geometry() const -> gl::GeometryArena::Handle;
+  [[nodiscard]] auto get_layout() const -> const gl::MeshLayout &;
+  [[nodiscard]] auto get_texture_region() const -> gl::AtlasRegion;
+  // Without instances the model is drawn once, otherwise once per instance
+  auto get_instances() -> gl::InstanceBuffer &;
+  // As of the last `TransformStore::update`. The camera is applied on the
+  // GPU, see `ResourceManager::set_camera`.
+  [[nodiscard]] auto get_model_matrix() const -> const glm::mat4 &;
   void set_offset(const glm::dvec3 &offset);
-  auto get_offset() -> const glm::dvec3 &;
+  [[nodiscard]] auto get_offset() const -> glm::vec3;
   void set_scale(const glm::dvec3 &scale);
-  auto get_scale() -> const glm::dvec3 &;
+  [[nodiscard]] auto get_scale() const -> glm::vec3;
+  // Euler angles in radians, applied in x, y, z order
+  void set_rotation(const glm::vec3 &angles);
+  // Rotating models follow `TransformStore::set_spin`
+  void set_rotating(bool rotating);
 
-  void calculate_mvp_matrix(const glm::dmat4 &projection_matrix,
-                            const glm::dmat4 &view_matrix);
+  // Box around the mesh under the model matrix, ignoring instances. Scene
+  // parts are bounded at all their nodes.
+  [[nodiscard]] auto get_world_bounds() const -> Aabb;
+  // Whether the model matrix changed since the last call
+  auto take_transform_changed() -> bool;
+  // Where the scene last saw this model in its list, to notice models that
+  // were added, removed or reordered since
+  void set_scene_index(size_t index);
+  [[nodiscard]] auto get_scene_index() const -> size_t;
+  // Level of detail drawn last frame, kept to avoid flickering between two
+  void set_lod(size_t lod);
+  [[nodiscard]] auto get_lod() const -> size_t;
 
-  void rotate(double angle, const glm::dvec3 &axis);
+  // Draws the model once at every node in `nodes`, below `root`. The
+  // copies follow the nodes from the next `sync_scene` on.
+  void attach_to_scene(SceneGraph::Node root,
+                       std::vector<SceneGraph::Node> nodes);
+  // Copies the world matrices of the nodes that moved since the last call
+  // and returns whether there were any
+  auto sync_scene(const SceneGraph &scene) -> bool;
+  // Root of the assembly the model is part of, `SceneGraph::no_node` if none
+  [[nodiscard]] auto get_scene_root() const -> SceneGraph::Node;
+  // One per node the model is drawn at, applied before the model matrix
+  [[nodiscard]] auto get_node_matrices() const
+      -> const std::vector<glm::mat4> &;
+  // Level of detail the node was drawn at last frame, like `get_lod`
+  void set_node_lod(size_t node, size_t lod);
+  [[nodiscard]] auto get_node_lod(size_t node) const -> size_t;
+  // The visible nodes drawn at level of detail `lod`, refilled every frame
+  auto get_node_instances(size_t lod) -> gl::InstanceBuffer &;
 
   struct ModelSettings {
     std::array<double, 3> scale = {1.0, 1.0, 1.0};
@@ -43,18 +161,28 @@ struct Model {
     std::string name;
     bool is_open = true;
     bool is_rotating = false;
+    int instance_count = 0;
     bool delete_me = false;
   };
   ModelSettings settings;
 
 private:
-  void bind_buffers();
-  void static set_layout();
-
-  gl::Buffer<gl::Element> ebo_;
-  gl::Buffer<gl::Vertex> vbo_;
-  glm::dvec3 scale_ = glm::dvec3(1.0, 1.0, 1.0);
-  glm::dvec3 offset_ = glm::dvec3(0.0, 0.0, 0.0);
-  glm::mat4 mvp_matrix_ = glm::mat4(1.0);
-  gl::Texture texture_;
+  AssetCache *assets_ = nullptr;
+  // Handles in the arena and the atlas of `assets_`
+  AssetRef geometry_;
+  gl::MeshLayout layout_;
+  TransformStore *transforms_ = nullptr;
+  TransformStore::Handle transform_ = TransformStore::no_handle;
+  size_t scene_index_ = std::numeric_limits<size_t>::max();
+  size_t lod_ = 0;
+  AssetRef texture_;
+  gl::InstanceBuffer instances_;
+  SceneGraph::Node scene_root_ = SceneGraph::no_node;
+  std::vector<SceneGraph::Node> scene_nodes_;
+  // By index in `scene_nodes_`
+  std::vector<glm::mat4> node_matrices_;
+  std::vector<uint8_t> node_lods_;
+  std::array<gl::InstanceBuffer, gl::max_lod_levels> node_instances_;
+  // Scene generation of the last `sync_scene`
+  uint64_t scene_generation_ = 0;
 };
\ No newline at end of file
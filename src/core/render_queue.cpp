@@ -0,0 +1,201 @@
+#include "core/render_queue.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+// Sort key, from the most to the least significant bits. Ids are truncated,
+// so two states can share a key. That costs binds, never correctness, as
+// batches are split by comparing the actual state.
+constexpr unsigned program_shift = 60;
+constexpr unsigned texture_shift = 40;
+constexpr unsigned page_shift = 30;
+constexpr unsigned index_type_shift = 29;
+// Set for draws that can't join a multi-draw
+constexpr unsigned single_draw_shift = 28;
+constexpr uint64_t program_mask = 0xFU;
+constexpr uint64_t texture_mask = 0xFFFFFU;
+constexpr uint64_t page_mask = 0x3FFU;
+// Positive floats order like their bit patterns, the lowest mantissa bits
+// are dropped to fit
+constexpr unsigned depth_drop_bits = 3;
+
+constexpr unsigned digit_bits = 8;
+constexpr size_t digit_count = 1U << digit_bits;
+constexpr size_t key_digits = 64 / digit_bits;
+
+auto make_key(const DrawItem &item, float depth) -> uint64_t {
+  uint32_t depth_bits = 0;
+  depth = std::max(depth, 0.0F);
+  std::memcpy(&depth_bits, &depth, sizeof(depth_bits));
+
+  uint64_t key = (item.program->get() & program_mask) << program_shift;
+  key |= (item.texture_array & texture_mask) << texture_shift;
+  key |= (item.range.page & page_mask) << page_shift;
+  if (item.range.index_type == GL_UNSIGNED_INT) {
+    key |= uint64_t{1} << index_type_shift;
+  }
+  if (item.instances != nullptr || item.draw_slot >= 0) {
+    key |= uint64_t{1} << single_draw_shift;
+  }
+  return key | (depth_bits >> depth_drop_bits);
+}
+
+// Whether two draws can go into one multi-draw
+auto same_batch(const DrawItem &lhs, const DrawItem &rhs) -> bool {
+  return lhs.instances == nullptr && rhs.instances == nullptr &&
+         lhs.draw_slot < 0 && rhs.draw_slot < 0 &&
+         lhs.program == rhs.program && lhs.texture_array == rhs.texture_array &&
+         lhs.range.page == rhs.range.page &&
+         lhs.range.index_type == rhs.range.index_type;
+}
+
+} // namespace
+
+void RenderQueue::push(const DrawItem &item, const float depth) {
+  entries_.push_back(
+      {make_key(item, depth), static_cast<uint32_t>(items_.size())});
+  items_.push_back(item);
+}
+
+void RenderQueue::clear() {
+  items_.clear();
+  entries_.clear();
+}
+
+void RenderQueue::submit(const gl::GeometryArena &arena,
+                         const gl::TextureAtlas &atlas) {
+  sort();
+  stats_ = {};
+  stats_.draws = items_.size();
+
+  // Nothing is assumed to be bound at the start of a frame
+  const gl::Program *program = nullptr;
+  size_t page = 0;
+  bool page_bound = false;
+  size_t texture_array = 0;
+  bool texture_bound = false;
+  // Value of the draw slot uniform in `program`, unknown after a switch
+  GLint draw_slot = -1;
+  bool draw_slot_set = false;
+  auto bind = [&](const DrawItem &item) {
+    if (item.program == program) {
+      ++stats_.binds_skipped;
+    } else {
+      item.program->use();
+      program = item.program;
+      draw_slot_set = false;
+      ++stats_.state_changes;
+    }
+    if (!draw_slot_set || item.draw_slot != draw_slot) {
+      glUniform1i(static_cast<GLint>(program->get_draw_slot_uniform()),
+                  item.draw_slot);
+      draw_slot = item.draw_slot;
+      draw_slot_set = true;
+    }
+    if (page_bound && item.range.page == page) {
+      ++stats_.binds_skipped;
+    } else {
+      arena.bind_page(item.range.page);
+      page = item.range.page;
+      page_bound = true;
+      ++stats_.state_changes;
+    }
+    if (texture_bound && item.texture_array == texture_array) {
+      ++stats_.binds_skipped;
+    } else {
+      atlas.bind(item.texture_array);
+      texture_array = item.texture_array;
+      texture_bound = true;
+      ++stats_.state_changes;
+    }
+  };
+
+  for (size_t first = 0; first != entries_.size();) {
+    const auto &item = items_[entries_[first].item];
+    bind(item);
+
+    if (item.instances != nullptr) {
+      const auto &range = item.range;
+      item.instances->bind_attributes();
+      glDrawElementsInstancedBaseVertex(
+          GL_TRIANGLES, range.index_count, range.index_type,
+          range.index_offset, static_cast<GLsizei>(item.instances->size()),
+          range.base_vertex);
+      // The page is shared with models that aren't instanced
+      gl::InstanceBuffer::reset_attributes();
+      ++stats_.draw_calls;
+      stats_.instances += item.instances->size();
+      ++first;
+      continue;
+    }
+    if (item.draw_slot >= 0) {
+      const auto &range = item.range;
+      glDrawElementsBaseVertex(GL_TRIANGLES, range.index_count,
+                               range.index_type, range.index_offset,
+                               range.base_vertex);
+      ++stats_.draw_calls;
+      ++first;
+      continue;
+    }
+
+    batch_counts_.clear();
+    batch_offsets_.clear();
+    batch_base_vertices_.clear();
+    size_t last = first;
+    for (; last != entries_.size() &&
+           same_batch(item, items_[entries_[last].item]);
+         ++last) {
+      const auto &range = items_[entries_[last].item].range;
+      batch_counts_.push_back(range.index_count);
+      batch_offsets_.push_back(range.index_offset);
+      batch_base_vertices_.push_back(range.base_vertex);
+    }
+    glMultiDrawElementsBaseVertex(
+        GL_TRIANGLES, batch_counts_.data(), item.range.index_type,
+        batch_offsets_.data(), static_cast<GLsizei>(batch_counts_.size()),
+        batch_base_vertices_.data());
+    ++stats_.draw_calls;
+    first = last;
+  }
+}
+
+auto RenderQueue::get_stats() const -> const RenderStats & { return stats_; }
+
+void RenderQueue::sort() {
+  if (entries_.empty()) {
+    return;
+  }
+
+  // LSD radix sort, with the histograms of all digits built in one pass
+  std::array<std::array<size_t, digit_count>, key_digits> histograms{};
+  for (const auto &entry : entries_) {
+    for (size_t digit = 0; digit != key_digits; ++digit) {
+      ++histograms[digit][(entry.key >> (digit * digit_bits)) &
+                          (digit_count - 1)];
+    }
+  }
+
+  scratch_.resize(entries_.size());
+  for (size_t digit = 0; digit != key_digits; ++digit) {
+    auto &histogram = histograms[digit];
+    const size_t shift = digit * digit_bits;
+    // Every key has the same digit, e.g. the program bits in most frames
+    if (histogram[(entries_.front().key >> shift) & (digit_count - 1)] ==
+        entries_.size()) {
+      continue;
+    }
+
+    size_t offset = 0;
+    for (auto &count : histogram) {
+      offset += std::exchange(count, offset);
+    }
+    for (const auto &entry : entries_) {
+      scratch_[histogram[(entry.key >> shift) & (digit_count - 1)]++] = entry;
+    }
+    entries_.swap(scratch_);
+  }
+}
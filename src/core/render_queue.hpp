@@ -0,0 +1,74 @@
+#pragma once
+
+#include "utils/GL.hpp"
+#include "utils/geometry_arena.hpp"
+#include "utils/instance_buffer.hpp"
+#include "utils/texture_atlas.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// What the last frame submitted
+struct RenderStats {
+  size_t models = 0;
+  // Models left after frustum culling, and the ones it skipped
+  size_t visible_models = 0;
+  size_t culled_models = 0;
+  // Triangles drawn, and how many the visible models have at full detail
+  size_t triangles = 0;
+  size_t full_detail_triangles = 0;
+  // Items pushed to the render queue
+  size_t draws = 0;
+  // GL draw calls they took, multi-draws count once
+  size_t draw_calls = 0;
+  // Copies drawn by instanced models
+  size_t instances = 0;
+  // Program, vertex array and texture binds that happened
+  size_t state_changes = 0;
+  // Binds left out because the state was already current
+  size_t binds_skipped = 0;
+};
+
+// Everything needed to submit one model
+struct DrawItem {
+  const gl::Program *program;
+  gl::GeometryArena::DrawRange range;
+  // Texture array of the atlas, the layer and region are per-model data
+  size_t texture_array;
+  // Null unless the model is instanced, already updated
+  const gl::InstanceBuffer *instances;
+  // Entry of the draw data to use instead of the slot stored in the
+  // vertices, -1 if there is none. Such draws can't share a multi-draw.
+  GLint draw_slot;
+};
+
+// Collects a frame's draws and submits them ordered by state, so every
+// program, page and texture array is bound as rarely as possible.
+// Consecutive draws that share all of them become one multi-draw.
+struct RenderQueue {
+  // `depth` is the view space distance, nearer draws go first within a state
+  void push(const DrawItem &item, float depth);
+  void clear();
+
+  // Sorts and submits everything pushed since `clear`
+  void submit(const gl::GeometryArena &arena, const gl::TextureAtlas &atlas);
+
+  [[nodiscard]] auto get_stats() const -> const RenderStats &;
+
+private:
+  struct SortEntry {
+    uint64_t key;
+    uint32_t item;
+  };
+
+  void sort();
+
+  std::vector<DrawItem> items_;
+  std::vector<SortEntry> entries_;
+  // Kept to reuse their memory
+  std::vector<SortEntry> scratch_;
+  std::vector<GLsizei> batch_counts_;
+  std::vector<const void *> batch_offsets_;
+  std::vector<GLint> batch_base_vertices_;
+  RenderStats stats_;
+};
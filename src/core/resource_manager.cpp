@@ -1,13 +1,594 @@
 #include "core/resource_manager.hpp"
 
+#include "settings.hpp"
+#include "utils/thread_pool.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <utility>
+
+namespace {
+
+// Texture unit of the per-model data read by shader.vert
+constexpr GLint draw_data_unit = 1;
+// Texels per model in the draw data, see shader.vert
+constexpr size_t draw_data_texels = 7;
+using DrawData = std::array<glm::vec4, draw_data_texels>;
+// Models per task of the per-frame work on the thread pool, so scheduling a
+// task costs little next to running it
+constexpr size_t model_batch_size = 256;
+
+auto make_draw_data(Model &model) -> DrawData {
+  const auto &model_matrix = model.get_model_matrix();
+  const auto &layout = model.get_layout();
+  const auto region = model.get_texture_region();
+  DrawData data;
+  // Rows of the affine part, the last row is always (0, 0, 0, 1)
+  for (int row = 0; row != 3; ++row) {
+    data.at(row) = glm::vec4(model_matrix[0][row], model_matrix[1][row],
+                             model_matrix[2][row], model_matrix[3][row]);
+  }
+  data[3] = glm::vec4(layout.position_scale, 0.0F);
+  data[4] = glm::vec4(layout.position_offset, 0.0F);
+  data[5] = glm::vec4(layout.material_color, static_cast<float>(region.layer));
+  data[6] = glm::vec4(region.uv_offset, region.uv_scale);
+  return data;
+}
+
+// Longest axis of the model matrix, how much it grows distances at most
+auto max_scale(const glm::mat4 &model_matrix) -> float {
+  return std::max({glm::length(glm::vec3(model_matrix[0])),
+                   glm::length(glm::vec3(model_matrix[1])),
+                   glm::length(glm::vec3(model_matrix[2]))});
+}
+
+// World space bounding sphere of the mesh under `matrix`. Scaling grows the
+// radius by the longest axis, so the sphere stays conservative.
+auto world_sphere(const gl::MeshLayout &layout, const glm::mat4 &matrix)
+    -> std::pair<glm::vec3, float> {
+  const auto center = matrix * glm::vec4(layout.sphere_center, 1.0F);
+  return {glm::vec3(center), layout.sphere_radius * max_scale(matrix)};
+}
+
+// Coarsest level of detail whose error covers at most `max_pixels` on
+// screen, when one model unit covers `units_to_pixels` pixels
+auto coarsest_lod(const gl::MeshLayout &layout, float units_to_pixels,
+                  float max_pixels) -> size_t {
+  size_t lod = 0;
+  while (lod + 1 < layout.lod_count &&
+         layout.lods.at(lod + 1).error * units_to_pixels <= max_pixels) {
+    ++lod;
+  }
+  return lod;
+}
+
+// Distance of the mesh's center under `matrix` along the view direction
+auto view_depth(const gl::MeshLayout &layout, const glm::mat4 &matrix,
+                const Camera &camera) -> float {
+  const auto center = (layout.bounds_min + layout.bounds_max) * 0.5F;
+  return (camera.view_projection * (matrix * glm::vec4(center, 1.0F))).w;
+}
+
+auto is_scene_part(const Model &model) -> bool {
+  return model.get_scene_root() != SceneGraph::no_node;
+}
+
+} // namespace
+
+void ResourceManager::set_camera(const glm::dmat4 &view,
+                                 const glm::dmat4 &projection,
+                                 const int viewport_height) {
+  camera_.view = view;
+  camera_.projection = projection;
+  camera_.view_projection = projection * view;
+  // Half the viewport spans the vertical field of view at unit distance
+  lod_scale_ = static_cast<float>(projection[1][1]) *
+               static_cast<float>(viewport_height) * 0.5F;
+}
+
+void ResourceManager::set_lod_enabled(const bool enabled) {
+  use_lods_ = enabled;
+}
+
+auto ResourceManager::select_lod(Model &model) const -> size_t {
+  // Copies can be anywhere, so they keep the full mesh
+  if (model.get_instances().size() != 0) {
+    return 0;
+  }
+  return select_lod(model.get_layout(), model.get_model_matrix(),
+                    model.get_lod());
+}
+
+auto ResourceManager::select_lod(const gl::MeshLayout &layout,
+                                 const glm::mat4 &matrix,
+                                 const size_t previous) const -> size_t {
+  if (!use_lods_ || layout.lod_count == 1) {
+    return 0;
+  }
+  // Measured at the point of the bounding sphere closest to the camera
+  const auto [center, radius] = world_sphere(layout, matrix);
+  const float distance =
+      (camera_.view_projection * glm::vec4(center, 1.0F)).w - radius;
+  if (!(distance > 0.0F)) {
+    return 0;
+  }
+  const float units_to_pixels = lod_scale_ * max_scale(matrix) / distance;
+  const auto current = std::min(previous, layout.lod_count - 1);
+  const auto fine =
+      coarsest_lod(layout, units_to_pixels, settings::lod_pixel_error);
+  if (fine < current) {
+    return fine;
+  }
+  return std::max(current,
+                  coarsest_lod(layout, units_to_pixels,
+                               settings::lod_pixel_error *
+                                   settings::lod_hysteresis));
+}
+
 void ResourceManager::render_all() {
-  for (auto &model : models_) {
-    model.render(program_.get_matrix_uniform());
+  camera_buffer_.update(&camera_, sizeof(camera_));
+  update_scene();
+
+  // Culled up front, so hidden models cost no GL work at all. The tree drops
+  // whole groups of models outside the frustum, the ones whose box crosses
+  // a plane get the tighter sphere test.
+  auto &pool = ThreadPool::instance();
+  const auto planes = extract_planes(camera_.view_projection);
+  bvh_.query_frustum(planes, drawn_, intersecting_);
+  // The box of a scene part covers all its nodes, every node gets the
+  // sphere test on its own
+  scene_parts_.clear();
+  auto take_scene_parts = [this](std::vector<uint32_t> &items) {
+    const auto parts = std::stable_partition(
+        items.begin(), items.end(),
+        [this](uint32_t index) { return !is_scene_part(models_[index]); });
+    scene_parts_.insert(scene_parts_.end(), parts, items.end());
+    items.erase(parts, items.end());
+  };
+  take_scene_parts(drawn_);
+  take_scene_parts(intersecting_);
+  // The spheres of the nodes follow those of the models, each part's from
+  // `scene_spheres_[i]` on
+  size_t sphere_count = intersecting_.size();
+  scene_spheres_.resize(scene_parts_.size());
+  for (size_t i = 0; i != scene_parts_.size(); ++i) {
+    scene_spheres_[i] = sphere_count;
+    sphere_count += models_[scene_parts_[i]].get_node_matrices().size();
+  }
+  bounds_.resize(sphere_count);
+  pool.parallel_for_batches(
+      intersecting_.size(), model_batch_size, [this](size_t begin, size_t end) {
+        for (size_t i = begin; i != end; ++i) {
+          const auto &model = models_[intersecting_[i]];
+          const auto [center, radius] =
+              world_sphere(model.get_layout(), model.get_model_matrix());
+          bounds_.set(i, center, radius);
+        }
+      });
+  pool.parallel_for_batches(
+      scene_parts_.size(), model_batch_size, [this](size_t begin, size_t end) {
+        for (size_t i = begin; i != end; ++i) {
+          const auto &model = models_[scene_parts_[i]];
+          const auto &node_matrices = model.get_node_matrices();
+          for (size_t node = 0; node != node_matrices.size(); ++node) {
+            const auto [center, radius] =
+                world_sphere(model.get_layout(),
+                             model.get_model_matrix() * node_matrices[node]);
+            bounds_.set(scene_spheres_[i] + node, center, radius);
+          }
+        }
+      });
+  cull_spheres(bounds_, planes, visible_);
+  // Copies can be anywhere, only the model itself is bounded
+  auto is_instanced = [this](uint32_t index) {
+    return models_[index].get_instances().size() != 0;
+  };
+  drawn_.erase(std::remove_if(drawn_.begin(), drawn_.end(), is_instanced),
+               drawn_.end());
+  for (size_t i = 0; i != intersecting_.size(); ++i) {
+    if (visible_[i] != 0 && !is_instanced(intersecting_[i])) {
+      drawn_.push_back(intersecting_[i]);
+    }
+  }
+  drawn_.insert(drawn_.end(), instanced_.begin(), instanced_.end());
+
+  // Every visible node of a scene part picks its own level of detail, the
+  // part is then drawn once per level with the nodes that picked it
+  scene_depths_.resize(scene_parts_.size());
+  pool.parallel_for_batches(
+      scene_parts_.size(), model_batch_size, [this](size_t begin, size_t end) {
+        for (size_t i = begin; i != end; ++i) {
+          auto &model = models_[scene_parts_[i]];
+          const auto &layout = model.get_layout();
+          const auto &node_matrices = model.get_node_matrices();
+          auto &depths = scene_depths_[i];
+          depths.fill(std::numeric_limits<float>::max());
+          for (size_t lod = 0; lod != layout.lod_count; ++lod) {
+            model.get_node_instances(lod).clear();
+          }
+          for (size_t node = 0; node != node_matrices.size(); ++node) {
+            if (visible_[scene_spheres_[i] + node] == 0) {
+              continue;
+            }
+            const auto matrix = model.get_model_matrix() * node_matrices[node];
+            const auto lod =
+                select_lod(layout, matrix, model.get_node_lod(node));
+            model.set_node_lod(node, lod);
+            model.get_node_instances(lod).add(node_matrices[node]);
+            depths.at(lod) =
+                std::min(depths.at(lod), view_depth(layout, matrix, camera_));
+          }
+        }
+      });
+
+  draw_list_.clear();
+  for (const auto index : drawn_) {
+    auto &entry = draw_list_.emplace_back();
+    entry.model = index;
+    auto &instances = models_[index].get_instances();
+    entry.instances = instances.size() != 0 ? &instances : nullptr;
+  }
+  size_t visible_scene_parts = 0;
+  for (size_t i = 0; i != scene_parts_.size(); ++i) {
+    auto &model = models_[scene_parts_[i]];
+    const auto drawn_before = draw_list_.size();
+    for (size_t lod = 0; lod != model.get_layout().lod_count; ++lod) {
+      auto &instances = model.get_node_instances(lod);
+      if (instances.size() == 0) {
+        continue;
+      }
+      auto &entry = draw_list_.emplace_back();
+      entry.model = scene_parts_[i];
+      entry.instances = &instances;
+      entry.item.range = arena_.get_range(model.get_geometry(), lod);
+      entry.depth = scene_depths_[i].at(lod);
+    }
+    visible_scene_parts += draw_list_.size() != drawn_before ? 1 : 0;
+  }
+
+  // Indexed by the geometry handle every vertex carries as its draw slot.
+  // Models sharing a mesh share that slot too, so all but the first get one
+  // past the handles. Written straight into this frame's region of the ring.
+  const size_t handle_count = arena_.handle_count();
+  auto *draw_data = static_cast<DrawData *>(draw_data_buffer_.map(
+      (handle_count + draw_list_.size()) * sizeof(DrawData)));
+  slot_taken_.assign(handle_count, false);
+  size_t next_slot = handle_count;
+  for (auto &entry : draw_list_) {
+    const auto geometry = models_[entry.model].get_geometry();
+    entry.slot = geometry;
+    entry.item.draw_slot = -1;
+    if (slot_taken_[geometry]) {
+      entry.slot = next_slot++;
+      entry.item.draw_slot = static_cast<GLint>(entry.slot);
+    }
+    slot_taken_[geometry] = true;
+  }
+
+  // Every task fills its own entries of the list and of the draw data, the
+  // render thread only submits them afterwards
+  pool.parallel_for_batches(
+      draw_list_.size(), model_batch_size,
+      [this, draw_data](size_t begin, size_t end) {
+        for (size_t i = begin; i != end; ++i) {
+          auto &entry = draw_list_[i];
+          auto &model = models_[entry.model];
+          // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+          draw_data[entry.slot] = make_draw_data(model);
+          entry.item.program = &program_;
+          entry.item.texture_array = model.get_texture_region().array;
+          // Scene parts picked their level of detail per node above
+          if (is_scene_part(model)) {
+            continue;
+          }
+          const auto lod = select_lod(model);
+          model.set_lod(lod);
+          entry.item.range = arena_.get_range(model.get_geometry(), lod);
+          entry.depth =
+              view_depth(model.get_layout(), model.get_model_matrix(), camera_);
+        }
+      });
+
+  size_t triangles = 0;
+  size_t full_detail_triangles = 0;
+  queue_.clear();
+  for (auto &entry : draw_list_) {
+    auto &model = models_[entry.model];
+    size_t copies = 1;
+    if (entry.instances != nullptr) {
+      entry.instances->update();
+      copies = entry.instances->size();
+    }
+    entry.item.instances = entry.instances;
+    triangles += static_cast<size_t>(entry.item.range.index_count) / 3 * copies;
+    full_detail_triangles +=
+        model.get_layout().lods[0].index_count / 3 * copies;
+    queue_.push(entry.item, entry.depth);
+  }
+  const GLint draw_data_base = draw_data_buffer_.unmap(sizeof(glm::vec4));
+  draw_data_buffer_.bind(GL_TEXTURE0 + draw_data_unit);
+  program_.use();
+  glUniform1i(static_cast<GLint>(program_.get_draw_data_base_uniform()),
+              draw_data_base);
+
+  queue_.submit(arena_, atlas_);
+  draw_data_buffer_.fence();
+  stats_ = queue_.get_stats();
+  stats_.models = models_.size();
+  stats_.visible_models = drawn_.size() + visible_scene_parts;
+  stats_.culled_models = models_.size() - stats_.visible_models;
+  stats_.triangles = triangles;
+  stats_.full_detail_triangles = full_detail_triangles;
+
+  assets_.end_frame();
+  arena_.end_frame();
+}
+
+void ResourceManager::update_scene() {
+  transforms_.update();
+  scene_.update();
+  // Each model only touches its own instances and transform slot
+  transform_changed_.resize(models_.size());
+  ThreadPool::instance().parallel_for_batches(
+      models_.size(), model_batch_size, [this](size_t begin, size_t end) {
+        for (size_t i = begin; i != end; ++i) {
+          // Scene parts are bounded at their nodes, so moving those counts
+          const bool moved = models_[i].sync_scene(scene_);
+          transform_changed_[i] = static_cast<uint8_t>(
+              models_[i].take_transform_changed() || moved);
+        }
+      });
+
+  // Models only change places in the list when some were added or removed,
+  // which rebuilds the tree. Moving models just refits it.
+  bool rebuild = bvh_.size() != models_.size();
+  instanced_.clear();
+  for (size_t i = 0; i != models_.size(); ++i) {
+    auto &model = models_[i];
+    if (model.get_instances().size() != 0) {
+      instanced_.push_back(static_cast<uint32_t>(i));
+    }
+    const bool changed = transform_changed_[i] != 0;
+    if (model.get_scene_index() != i) {
+      model.set_scene_index(i);
+      rebuild = true;
+    } else if (changed && !rebuild) {
+      bvh_.update(static_cast<uint32_t>(i), model.get_world_bounds());
+    }
+  }
+  if (!rebuild) {
+    bvh_.refit();
+    return;
+  }
+  remove_unused_scenes();
+  std::vector<Aabb> bounds(models_.size());
+  for (size_t i = 0; i != models_.size(); ++i) {
+    bounds[i] = models_[i].get_world_bounds();
+  }
+  bvh_.build(std::move(bounds));
+}
+
+void ResourceManager::remove_unused_scenes() {
+  auto is_unused = [this](SceneGraph::Node root) {
+    auto is_drawn_at = [root](const Model &model) {
+      return model.get_scene_root() == root;
+    };
+    if (std::any_of(models_.begin(), models_.end(), is_drawn_at) ||
+        std::any_of(uploading_.begin(), uploading_.end(),
+                    [&](const UploadingModel &uploading) {
+                      return is_drawn_at(uploading.model);
+                    })) {
+      return false;
+    }
+    scene_.remove_subtree(root);
+    return true;
+  };
+  scene_roots_.erase(
+      std::remove_if(scene_roots_.begin(), scene_roots_.end(), is_unused),
+      scene_roots_.end());
+}
+
+auto ResourceManager::pick_model(const glm::vec2 &ndc)
+    -> std::optional<size_t> {
+  update_scene();
+  const auto inverse = glm::inverse(camera_.view_projection);
+  auto unproject = [&](float depth) {
+    const auto point = inverse * glm::vec4(ndc.x, ndc.y, depth, 1.0F);
+    return glm::vec3(point) / point.w;
+  };
+  const auto near = unproject(-1.0F);
+  const auto hit = bvh_.query_ray(near, unproject(1.0F) - near);
+  if (!hit) {
+    return std::nullopt;
+  }
+  return hit->item;
+}
+
+auto ResourceManager::query_models(const Aabb &box) -> std::vector<size_t> {
+  update_scene();
+  std::vector<uint32_t> items;
+  bvh_.query_box(box, items);
+  return {items.begin(), items.end()};
+}
+
+ResourceManager::~ResourceManager() {
+  // Loads still running on the pool look up assets in `assets_`
+  for (auto &pending : pending_) {
+    pending.data.wait();
+  }
+  for (auto &pending : pending_scenes_) {
+    pending.data.wait();
   }
 }
 
 auto ResourceManager::get_models() -> std::vector<Model> & { return models_; }
 
+auto ResourceManager::get_transforms() -> TransformStore & {
+  return transforms_;
+}
+
+auto ResourceManager::get_scene() -> SceneGraph & { return scene_; }
+
+auto ResourceManager::get_pending_loads() const
+    -> std::vector<std::shared_ptr<const ModelLoad>> {
+  std::vector<std::shared_ptr<const ModelLoad>> loads;
+  loads.reserve(uploading_.size() + pending_.size() + pending_scenes_.size());
+  for (const auto &uploading : uploading_) {
+    // The parts of a scene are uploaded one after the other
+    if (loads.empty() || loads.back() != uploading.load) {
+      loads.emplace_back(uploading.load);
+    }
+  }
+  for (const auto &pending : pending_) {
+    loads.emplace_back(pending.load);
+  }
+  for (const auto &pending : pending_scenes_) {
+    loads.emplace_back(pending.load);
+  }
+  return loads;
+}
+
+auto ResourceManager::get_upload_backlog() const -> size_t {
+  size_t backlog = 0;
+  for (const auto &uploading : uploading_) {
+    backlog += uploading.model.pending_upload_bytes();
+  }
+  return backlog;
+}
+
+auto ResourceManager::get_render_stats() const -> const RenderStats & {
+  return stats_;
+}
+
+auto ResourceManager::get_asset_stats() const -> AssetCacheStats {
+  return assets_.get_stats();
+}
+
+auto ResourceManager::load_model_async(const std::string_view name,
+                                       loader_enum loader,
+                                       const std::string_view path,
+                                       const std::string_view texture_path,
+                                       const LoadOptions &options)
+    -> std::shared_ptr<const ModelLoad> {
+  auto load = std::make_shared<ModelLoad>();
+  load->name = std::string(name);
+  load->path = std::string(path);
+
+  // The views may point into UI buffers that change before the task runs
+  auto task = [load, assets = &assets_, loader, path = std::string(path),
+               texture_path = std::string(texture_path), options]() {
+    load->stage = load_stage_enum::LOAD_READING;
+    auto data = load_model_data(*assets, loader, path, texture_path, options);
+    load->stage = load_stage_enum::LOAD_UPLOADING;
+    return data;
+  };
+  pending_.push_back({load, ThreadPool::instance().submit(std::move(task))});
+  return load;
+}
+
+auto ResourceManager::load_scene_async(const std::string_view name,
+                                       const std::string_view path,
+                                       const std::string_view texture_path,
+                                       const LoadOptions &options)
+    -> std::shared_ptr<const ModelLoad> {
+  auto load = std::make_shared<ModelLoad>();
+  load->name = std::string(name);
+  load->path = std::string(path);
+
+  auto task = [load, assets = &assets_, path = std::string(path),
+               texture_path = std::string(texture_path), options]() {
+    load->stage = load_stage_enum::LOAD_READING;
+    auto data = load_scene_data(*assets, path, texture_path, options);
+    load->stage = load_stage_enum::LOAD_UPLOADING;
+    return data;
+  };
+  pending_scenes_.push_back(
+      {load, ThreadPool::instance().submit(std::move(task))});
+  return load;
+}
+
+void ResourceManager::add_scene(const std::shared_ptr<ModelLoad> &load,
+                                SceneModelData &&data) {
+  const auto root = scene_.add_node(SceneGraph::no_node, glm::mat4(1.0F));
+  scene_roots_.push_back(root);
+  // Parents come first, so their handles are known when children are added
+  std::vector<SceneGraph::Node> nodes(data.nodes.size());
+  for (size_t i = 0; i != data.nodes.size(); ++i) {
+    const auto &node = data.nodes[i];
+    const auto parent =
+        node.parent == mesh::no_parent ? root : nodes.at(node.parent);
+    nodes[i] = scene_.add_node(parent, node.transform);
+  }
+
+  for (size_t i = 0; i != data.parts.size(); ++i) {
+    Model model(assets_, transforms_, std::move(data.parts[i]));
+    std::vector<SceneGraph::Node> part_nodes;
+    part_nodes.reserve(data.part_nodes[i].size());
+    for (const auto node : data.part_nodes[i]) {
+      part_nodes.push_back(nodes.at(node));
+    }
+    model.attach_to_scene(root, std::move(part_nodes));
+    const auto &part_name = data.part_names[i];
+    model.settings.name =
+        load->name + ": " +
+        (part_name.empty() ? "Part " + std::to_string(i) : part_name);
+    load->upload_total_bytes += model.pending_upload_bytes();
+    uploading_.push_back(UploadingModel{load, std::move(model)});
+  }
+}
+
+void ResourceManager::finish_loads(size_t upload_budget) {
+  for (auto it = pending_.begin(); it != pending_.end();) {
+    if (it->data.wait_for(std::chrono::seconds(0)) !=
+        std::future_status::ready) {
+      ++it;
+      continue;
+    }
+    try {
+      auto &uploading = uploading_.emplace_back(UploadingModel{
+          it->load, Model(assets_, transforms_, it->data.get())});
+      uploading.model.settings.name = it->load->name;
+      uploading.load->upload_total_bytes =
+          uploading.model.pending_upload_bytes();
+    } catch (const std::exception &e) {
+      std::cerr << "Can't load model " << it->load->path << ": " << e.what()
+                << '\n';
+    }
+    it = pending_.erase(it);
+  }
+  for (auto it = pending_scenes_.begin(); it != pending_scenes_.end();) {
+    if (it->data.wait_for(std::chrono::seconds(0)) !=
+        std::future_status::ready) {
+      ++it;
+      continue;
+    }
+    try {
+      add_scene(it->load, it->data.get());
+    } catch (const std::exception &e) {
+      std::cerr << "Can't load scene " << it->load->path << ": " << e.what()
+                << '\n';
+    }
+    it = pending_scenes_.erase(it);
+  }
+
+  // Oldest loads first, so each model becomes visible as soon as possible
+  for (auto it = uploading_.begin();
+       it != uploading_.end() && upload_budget != 0;) {
+    const size_t written = it->model.upload(upload_budget);
+    upload_budget -= std::min(written, upload_budget);
+    it->load->uploaded_bytes += written;
+    if (it->model.pending_upload_bytes() != 0) {
+      ++it;
+      continue;
+    }
+    models_.emplace_back(std::move(it->model));
+    it = uploading_.erase(it);
+  }
+}
+
 void ResourceManager::load_shaders(const std::string_view vert_path,
                                    const std::string_view frag_path) {
   std::vector<gl::Shader> shaders;
@@ -20,6 +601,11 @@ void ResourceManager::load_shaders(const std::string_view vert_path,
   // Link the vertex and fragment shader into a shader program
   program_.compile(shaders);
   program_.use();
+  glUniform1i(static_cast<GLint>(program_.get_draw_data_uniform()),
+              draw_data_unit);
+  glUniformBlockBinding(program_.get(), program_.get_camera_block(),
+                        camera_binding);
+  glUniform1i(static_cast<GLint>(program_.get_draw_slot_uniform()), -1);
 
   // We don't need shaders anymore as the program is compiled
   shaders.clear();
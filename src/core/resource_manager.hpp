@@ -1,11 +1,45 @@
 #pragma once
 
+#include "core/asset_cache.hpp"
 #include "core/model.hpp"
+#include "core/render_queue.hpp"
+#include "utils/bvh.hpp"
+#include "utils/frustum.hpp"
+#include "utils/geometry_arena.hpp"
+#include "utils/scene_graph.hpp"
+#include "utils/texture_atlas.hpp"
+#include "utils/transform_store.hpp"
+#include <array>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <optional>
+#include <string>
 #include <vector>
 
+enum struct load_stage_enum { LOAD_QUEUED, LOAD_READING, LOAD_UPLOADING };
+
+// Progress of a load started by `ResourceManager::load_model_async`. The
+// stage is written by a worker thread, the upload counters by the render
+// thread while the model is streamed to the GPU.
+struct ModelLoad {
+  std::string name;
+  std::string path;
+  std::atomic<load_stage_enum> stage = load_stage_enum::LOAD_QUEUED;
+  size_t upload_total_bytes = 0;
+  size_t uploaded_bytes = 0;
+};
+
+// Contents of the `Camera` uniform block in shader.vert
+struct Camera {
+  glm::mat4 view = glm::mat4(1.0F);
+  glm::mat4 projection = glm::mat4(1.0F);
+  glm::mat4 view_projection = glm::mat4(1.0F);
+};
+
 struct ResourceManager {
   ResourceManager() = default;
-  ~ResourceManager() = default;
+  ~ResourceManager();
 
   ResourceManager(const ResourceManager &) = delete;
   ResourceManager(ResourceManager &&other) noexcept = delete;
@@ -16,13 +50,145 @@ struct ResourceManager {
   template <typename... Args> auto load_model(Args &&... args) -> Model &;
   void load_shaders(std::string_view, std::string_view);
 
+  // Reads, parses and decodes the model on the shared thread pool. The model
+  // shows up in `get_models` once `finish_loads` uploads it.
+  auto load_model_async(std::string_view name, loader_enum loader,
+                        std::string_view path,
+                        std::string_view texture_path = {},
+                        const LoadOptions &options = {})
+      -> std::shared_ptr<const ModelLoad>;
+  // Like `load_model_async` with the Assimp loader, but keeps the node
+  // hierarchy of the file under a new root of `get_scene`. Every mesh becomes
+  // a model of its own, drawn once per node referencing it.
+  auto load_scene_async(std::string_view name, std::string_view path,
+                        std::string_view texture_path = {},
+                        const LoadOptions &options = {})
+      -> std::shared_ptr<const ModelLoad>;
+
+  // Creates GL objects for every finished load and streams at most
+  // `upload_budget` bytes of their data to the GPU. Models are moved to
+  // `get_models` once fully uploaded. Call once per frame on the render
+  // thread. Failed loads are reported and dropped.
+  void finish_loads(size_t upload_budget);
+
+  // Used by the next `render_all`. The product is taken once here instead of
+  // once per model. `viewport_height` in pixels scales the error of the
+  // levels of detail.
+  void set_camera(const glm::dmat4 &view, const glm::dmat4 &projection,
+                  int viewport_height);
+  // Whether `render_all` draws simplified meshes for distant models
+  void set_lod_enabled(bool enabled);
+  // Draws every model inside the view frustum out of the geometry arena
+  // through the render queue. Culling, levels of detail and the draw list
+  // are computed on the thread pool, this thread only submits the result.
   void render_all();
 
+  // Index in `get_models` of the model whose bounds are hit first by the
+  // ray through `ndc`, a point on the screen in normalized device
+  // coordinates, seen through the camera from the last `set_camera`
+  auto pick_model(const glm::vec2 &ndc) -> std::optional<size_t>;
+  // Indices in `get_models` of the models whose bounds overlap `box`
+  auto query_models(const Aabb &box) -> std::vector<size_t>;
+
   auto get_models() -> std::vector<Model> &;
+  // Transforms of all models, updated by `render_all`
+  auto get_transforms() -> TransformStore &;
+  // Hierarchies of the scenes loaded by `load_scene_async`, updated by
+  // `render_all`
+  auto get_scene() -> SceneGraph &;
+  auto get_pending_loads() const
+      -> std::vector<std::shared_ptr<const ModelLoad>>;
+  // Bytes of loaded models that still have to be uploaded
+  [[nodiscard]] auto get_upload_backlog() const -> size_t;
+  [[nodiscard]] auto get_render_stats() const -> const RenderStats &;
+  [[nodiscard]] auto get_asset_stats() const -> AssetCacheStats;
 
 private:
+  // Uniform block binding point of `Camera`
+  static constexpr GLuint camera_binding = 0;
+
+  struct PendingModel {
+    std::shared_ptr<ModelLoad> load;
+    std::future<ModelData> data;
+  };
+  struct PendingScene {
+    std::shared_ptr<ModelLoad> load;
+    std::future<SceneModelData> data;
+  };
+  struct UploadingModel {
+    std::shared_ptr<ModelLoad> load;
+    Model model;
+  };
+  // A visible model, prepared on the thread pool for the render thread
+  struct DrawEntry {
+    uint32_t model = 0;
+    // Entry of the draw data, see `render_all`
+    size_t slot = 0;
+    // Everything but the instances, they are uploaded while submitting
+    DrawItem item{};
+    // The copies to draw, null unless the model is instanced or a scene part
+    gl::InstanceBuffer *instances = nullptr;
+    float depth = 0.0F;
+  };
+
+  // Creates the nodes and the models of a loaded scene
+  void add_scene(const std::shared_ptr<ModelLoad> &load,
+                 SceneModelData &&data);
+  // Frees the hierarchies no model is drawn at anymore
+  void remove_unused_scenes();
+  // Recomputes the transforms that changed and brings the scene tree up to
+  // date with them and the models. The per-model work runs on the thread
+  // pool.
+  void update_scene();
+  // Level of detail to draw the model at, based on how many pixels the
+  // simplification error of each level covers
+  [[nodiscard]] auto select_lod(Model &model) const -> size_t;
+  // The same for the mesh of `layout` under `matrix`, which was drawn at
+  // `previous` last frame
+  [[nodiscard]] auto select_lod(const gl::MeshLayout &layout,
+                                const glm::mat4 &matrix, size_t previous) const
+      -> size_t;
+
   gl::Program program_;
+  // Models free their geometry, textures and transforms into these, so they
+  // have to outlive them
+  gl::GeometryArena arena_;
+  gl::TextureAtlas atlas_;
+  AssetCache assets_{arena_, atlas_};
+  TransformStore transforms_;
+  SceneGraph scene_;
+  // One per scene in `scene_`
+  std::vector<SceneGraph::Node> scene_roots_;
+  gl::TextureBuffer draw_data_buffer_{GL_RGBA32F};
+  gl::UniformBuffer camera_buffer_{camera_binding};
+  Camera camera_;
+  // Pixels covered by one world unit at unit distance from the camera
+  float lod_scale_ = 0.0F;
+  bool use_lods_ = true;
   std::vector<Model> models_;
+  // World space bounds of `models_`, by index
+  Bvh bvh_;
+  std::vector<PendingModel> pending_;
+  std::vector<PendingScene> pending_scenes_;
+  std::vector<UploadingModel> uploading_;
+
+  // Rebuilt every frame, kept to reuse their memory
+  RenderQueue queue_;
+  std::vector<bool> slot_taken_;
+  std::vector<uint32_t> drawn_;
+  std::vector<uint32_t> intersecting_;
+  std::vector<uint32_t> instanced_;
+  std::vector<uint8_t> transform_changed_;
+  std::vector<DrawEntry> draw_list_;
+  // Scene parts not culled by the tree, where the spheres of their nodes
+  // start in `bounds_` and the depth of their closest node at every level
+  // of detail
+  std::vector<uint32_t> scene_parts_;
+  std::vector<size_t> scene_spheres_;
+  std::vector<std::array<float, gl::max_lod_levels>> scene_depths_;
+  BoundingSpheres bounds_;
+  std::vector<uint8_t> visible_;
+  RenderStats stats_;
 };
 
-#include "core/resource_manager_impl.hpp"
\ No newline at end of file
+#include "core/resource_manager_impl.hpp"
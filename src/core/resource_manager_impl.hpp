@@ -4,5 +4,5 @@
 
 template <typename... Args>
 auto ResourceManager::load_model(Args &&... args) -> Model & {
-  return models_.emplace_back(args...);
+  return models_.emplace_back(assets_, transforms_, args...);
 }
\ No newline at end of file
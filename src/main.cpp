@@ -5,10 +5,20 @@
 #include "utils/GL.hpp"
 #include "utils/SDL.hpp"
 #include "utils/imgui.hpp"
+#include "utils/parsers/obj_benchmark.hpp"
+#include "utils/thread_pool.hpp"
 #include "utils/timer.hpp"
+#include <algorithm>
+#include <cmath>
 #include <glm/gtx/transform.hpp>
 #include <string_view>
 
+auto current_resolution() -> const settings::Resolution & {
+  return static_cast<bool>(settings::fullscreen)
+             ? settings::fullscreen_resolution
+             : settings::window_resolution;
+}
+
 void toggle_fullscreen(const sdl2::unique_ptr<SDL_Window> &window) {
   switch (settings::fullscreen) {
   case 0:
@@ -31,7 +41,107 @@ void toggle_fullscreen(const sdl2::unique_ptr<SDL_Window> &window) {
   }
 }
 
-auto main([[maybe_unused]] int argc, [[maybe_unused]] char *argv[]) -> int try {
+// Replaces the instances of `model` with a cube shaped grid of `count`
+// copies around the model
+void spawn_instance_grid(Model &model, size_t count) {
+  auto &instances = model.get_instances();
+  instances.clear();
+  instances.reserve(count);
+
+  const auto &layout = model.get_layout();
+  const auto extent = layout.bounds_max - layout.bounds_min;
+  constexpr float spacing_factor = 1.5F;
+  float spacing = std::max({extent.x, extent.y, extent.z}) * spacing_factor;
+  if (!(spacing > 0.0F)) {
+    spacing = 1.0F;
+  }
+  const auto side = static_cast<size_t>(
+      std::ceil(std::cbrt(static_cast<double>(count))));
+  const float center = static_cast<float>(side - 1) / 2.0F;
+
+  constexpr float rotation_step = 0.1F;
+  for (size_t i = 0; i != count; ++i) {
+    gl::Instance instance;
+    instance.offset = glm::vec3(static_cast<float>(i % side) - center,
+                                static_cast<float>(i / side % side) - center,
+                                static_cast<float>(i / side / side) - center) *
+                      spacing;
+    // Varied orientations, so the copies can be told apart
+    instance.rotation.y = static_cast<float>(i) * rotation_step;
+    instances.add(instance);
+  }
+}
+
+// One bar per worker of the thread pool, filled where it ran tasks during
+// the frame
+void draw_frame_timeline(const PoolTimeline &timeline) {
+  using milliseconds = std::chrono::duration<float, std::milli>;
+  const float frame = milliseconds(timeline.end - timeline.begin).count();
+  if (!(frame > 0.0F)) {
+    return;
+  }
+  float total_busy = 0.0F;
+  for (const auto &spans : timeline.workers) {
+    for (const auto &span : spans) {
+      total_busy += milliseconds(std::min(span.end, timeline.end) -
+                                 std::max(span.begin, timeline.begin))
+                        .count();
+    }
+  }
+  const float occupancy =
+      total_busy / (frame * static_cast<float>(timeline.workers.size()));
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg, hicpp-vararg)
+  ImGui::Text("%zu workers, %.0f%% busy over %.2f ms",
+              timeline.workers.size(), static_cast<double>(occupancy) * 100.0,
+              static_cast<double>(frame));
+
+  constexpr float bar_height = 4.0F;
+  constexpr float bar_spacing = 1.0F;
+  auto *draw_list = ImGui::GetWindowDrawList();
+  const ImVec2 origin = ImGui::GetCursorScreenPos();
+  const float width = ImGui::GetContentRegionAvail().x;
+  const ImU32 idle_color = IM_COL32(60, 60, 60, 255);
+  const ImU32 busy_color = IM_COL32(90, 200, 90, 255);
+  float top = origin.y;
+  for (const auto &spans : timeline.workers) {
+    draw_list->AddRectFilled(ImVec2(origin.x, top),
+                             ImVec2(origin.x + width, top + bar_height),
+                             idle_color);
+    for (const auto &span : spans) {
+      const float begin =
+          milliseconds(std::max(span.begin, timeline.begin) - timeline.begin)
+              .count();
+      const float end =
+          milliseconds(std::min(span.end, timeline.end) - timeline.begin)
+              .count();
+      if (end > begin) {
+        draw_list->AddRectFilled(
+            ImVec2(origin.x + width * begin / frame, top),
+            ImVec2(origin.x + width * end / frame, top + bar_height),
+            busy_color);
+      }
+    }
+    top += bar_height + bar_spacing;
+  }
+  ImGui::Dummy(ImVec2(width, top - origin.y));
+}
+
+auto main(int argc, char *argv[]) -> int try {
+  // Parser benchmarks run headless, without creating a window
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  const auto args = std::vector<std::string_view>(argv, argv + argc);
+  if (args.size() >= 3 && args[1] == "--bench-obj") {
+    parser::obj::benchmark(args[2]);
+    return 0;
+  }
+  if (args.size() >= 2 && args[1] == "--bench-obj-synthetic") {
+    constexpr size_t default_megabytes = 1024;
+    parser::obj::benchmark_synthetic(
+        args.size() >= 3 ? std::stoul(std::string(args[2]))
+                         : default_megabytes);
+    return 0;
+  }
+
   auto sdl = sdl2::SDL(SDL_INIT_VIDEO);
 
   // Set up OpenGL attributes
@@ -73,10 +183,6 @@ auto main([[maybe_unused]] int argc, [[maybe_unused]] char *argv[]) -> int try {
   // Initialize ImGui
   auto imgui = imgui::Imgui(window, context);
 
-  // Create Vertex Array Object
-  // Single VAO for entire application
-  auto vao = gl::VertexArrayObject();
-
   // Create resource manager
   auto resource_manager = ResourceManager();
 
@@ -122,6 +228,9 @@ auto main([[maybe_unused]] int argc, [[maybe_unused]] char *argv[]) -> int try {
   std::array<char, settings::file_str_size> model_name{};
 
   loader_enum loader = loader_enum::LOADER_OBJ;
+  LoadOptions load_options;
+  bool keep_hierarchy = false;
+  bool use_lods = true;
   bool preserve_scale_ratio = true;
 
   bool show_open_dialogue = false;
@@ -189,6 +298,22 @@ auto main([[maybe_unused]] int argc, [[maybe_unused]] char *argv[]) -> int try {
           break;
         }
         break;
+      case SDL_MOUSEBUTTONDOWN:
+        // Clicking a model in the scene opens its settings
+        if (e.button.button == SDL_BUTTON_LEFT &&
+            !ImGui::GetIO().WantCaptureMouse) {
+          const auto &resolution = current_resolution();
+          const glm::vec2 ndc(
+              2.0F * static_cast<float>(e.button.x) /
+                      static_cast<float>(resolution.w) -
+                  1.0F,
+              1.0F - 2.0F * static_cast<float>(e.button.y) /
+                         static_cast<float>(resolution.h));
+          if (const auto picked = resource_manager.pick_model(ndc)) {
+            models[*picked].settings.is_open = true;
+          }
+        }
+        break;
       }
     }
 
@@ -197,6 +322,9 @@ auto main([[maybe_unused]] int argc, [[maybe_unused]] char *argv[]) -> int try {
     glClear(static_cast<unsigned int>(GL_COLOR_BUFFER_BIT) |
             static_cast<unsigned int>(GL_DEPTH_BUFFER_BIT));
 
+    // Upload models that finished loading in the background
+    resource_manager.finish_loads(settings::upload_budget);
+
     // Delete models marked for deletion using erase-remove idiom
     models.erase(
         std::remove_if(models.begin(), models.end(),
@@ -207,10 +335,9 @@ auto main([[maybe_unused]] int argc, [[maybe_unused]] char *argv[]) -> int try {
     glm::dmat4 projection_matrix =
         glm::perspective(fov, aspect_ratio, z_near, z_far);
 
-    // Calculate new model mvp matrices
-    for (auto &&model : models) {
-      model.calculate_mvp_matrix(projection_matrix, view_matrix);
-    }
+    // The camera is shared, models only compute their own transform
+    resource_manager.set_camera(view_matrix, projection_matrix,
+                                current_resolution().h);
 
     // Clock to rotate models
     auto t_now = std::chrono::steady_clock::now();
@@ -223,11 +350,9 @@ auto main([[maybe_unused]] int argc, [[maybe_unused]] char *argv[]) -> int try {
 
     auto rotation_time = time.count() * time_delta;
 
-    for (auto &&model : models) {
-      if (model.settings.is_rotating) {
-        model.rotate(rotation_time * glm::radians(pi_rad), axis);
-      }
-    }
+    // Rotating models share the angle, only their slots are recomputed
+    resource_manager.get_transforms().set_spin(glm::vec3(
+        axis * (rotation_time * glm::radians(pi_rad))));
 
     // Render all the models
     resource_manager.render_all();
@@ -249,7 +374,12 @@ auto main([[maybe_unused]] int argc, [[maybe_unused]] char *argv[]) -> int try {
         loader = loader_enum::LOADER_OBJ;
       }
       ImGui::SameLine();
-      if (ImGui::RadioButton("Assimp loader (fbx only)",
+      if (ImGui::RadioButton("OBJ loader (X3)",
+                             loader == loader_enum::LOADER_OBJ_X3)) {
+        loader = loader_enum::LOADER_OBJ_X3;
+      }
+      ImGui::SameLine();
+      if (ImGui::RadioButton("Assimp loader",
                              loader == loader_enum::LOADER_ASSIMP)) {
         loader = loader_enum::LOADER_ASSIMP;
       }
@@ -260,12 +390,38 @@ auto main([[maybe_unused]] int argc, [[maybe_unused]] char *argv[]) -> int try {
         ImGui::InputTextWithHint("Albedo map location",
                                  "Enter file location...", albedo_str.data(),
                                  albedo_str.size());
+        ImGui::Checkbox("Keep hierarchy", &keep_hierarchy);
+      }
+      ImGui::Checkbox("Optimize mesh", &load_options.optimize_mesh);
+      ImGui::SameLine();
+      ImGui::Checkbox("Generate LODs", &load_options.generate_lods);
+      ImGui::SameLine();
+      bool compact_vertices = load_options.vertex_format ==
+                              mesh::vertex_format_enum::VERTEX_COMPACT;
+      if (ImGui::Checkbox("Compact vertices", &compact_vertices)) {
+        load_options.vertex_format =
+            compact_vertices ? mesh::vertex_format_enum::VERTEX_COMPACT
+                             : mesh::vertex_format_enum::VERTEX_FULL;
+      }
+      ImGui::SameLine();
+      bool keep_cpu_copy = load_options.residency ==
+                           gl::residency_enum::RESIDENCY_RETAINED;
+      if (ImGui::Checkbox("Keep CPU copy", &keep_cpu_copy)) {
+        load_options.residency = keep_cpu_copy
+                                     ? gl::residency_enum::RESIDENCY_RETAINED
+                                     : gl::residency_enum::RESIDENCY_GPU_ONLY;
       }
 
       if (ImGui::Button("Open")) {
-        auto &model = resource_manager.load_model(loader, file_str.data(),
-                                                  albedo_str.data());
-        model.settings.name = std::string(model_name.data());
+        // Parsing runs on worker threads, the model appears once uploaded
+        if (loader == loader_enum::LOADER_ASSIMP && keep_hierarchy) {
+          resource_manager.load_scene_async(model_name.data(), file_str.data(),
+                                            albedo_str.data(), load_options);
+        } else {
+          resource_manager.load_model_async(model_name.data(), loader,
+                                            file_str.data(), albedo_str.data(),
+                                            load_options);
+        }
         show_open_dialogue = false;
       }
 
@@ -327,7 +483,38 @@ auto main([[maybe_unused]] int argc, [[maybe_unused]] char *argv[]) -> int try {
                                  3, &MIN_OFFSET, &MAX_OFFSET, "%.4f")) {
           model.set_offset(glm::dvec3(offset[0], offset[1], offset[2]));
         }
-        ImGui::Checkbox("Rotate", &is_rotating);
+        if (ImGui::Checkbox("Rotate", &is_rotating)) {
+          model.set_rotating(is_rotating);
+        }
+        if (const auto root = model.get_scene_root();
+            root != SceneGraph::no_node) {
+          // Moves every part of the scene, its nodes follow the root
+          auto &scene = resource_manager.get_scene();
+          auto local = scene.get_local(root);
+          std::array<float, 3> assembly_offset = {local[3].x, local[3].y,
+                                                  local[3].z};
+          constexpr float MIN_ASSEMBLY_OFFSET = -10.0F;
+          constexpr float MAX_ASSEMBLY_OFFSET = 10.0F;
+          if (ImGui::SliderScalarN("Assembly offset", ImGuiDataType_Float,
+                                   assembly_offset.data(), 3,
+                                   &MIN_ASSEMBLY_OFFSET, &MAX_ASSEMBLY_OFFSET,
+                                   "%.4f")) {
+            local[3] = glm::vec4(assembly_offset[0], assembly_offset[1],
+                                 assembly_offset[2], 1.0F);
+            scene.set_local(root, local);
+          }
+        } else {
+          // The instances of a scene part are its nodes
+          constexpr int MAX_INSTANCES = 1000000;
+          auto &instance_count = model.settings.instance_count;
+          if (ImGui::InputInt("Instances", &instance_count)) {
+            instance_count = std::clamp(instance_count, 0, MAX_INSTANCES);
+          }
+          ImGui::SameLine();
+          if (ImGui::Button("Spawn")) {
+            spawn_instance_grid(model, static_cast<size_t>(instance_count));
+          }
+        }
         if (ImGui::Button("Delete")) {
           model.settings.delete_me = true;
         }
@@ -335,6 +522,72 @@ auto main([[maybe_unused]] int argc, [[maybe_unused]] char *argv[]) -> int try {
       }
       ImGui::PopID();
     }
+
+    // Models that are still loading in the background
+    for (const auto &load : resource_manager.get_pending_loads()) {
+      constexpr float stage_count = 3.0F;
+      const auto stage = load->stage.load();
+      const char *stage_name = "Queued";
+      float stage_progress = 0.0F;
+      if (stage == load_stage_enum::LOAD_READING) {
+        stage_name = "Reading";
+      } else if (stage == load_stage_enum::LOAD_UPLOADING) {
+        stage_name = "Uploading";
+        if (load->upload_total_bytes != 0) {
+          stage_progress = static_cast<float>(load->uploaded_bytes) /
+                           static_cast<float>(load->upload_total_bytes);
+        }
+      }
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg, hicpp-vararg)
+      ImGui::Text("%s", load->name.c_str());
+      ImGui::ProgressBar((static_cast<float>(stage) + stage_progress) /
+                             stage_count,
+                         ImVec2(-1.0F, 0.0F), stage_name);
+    }
+    if (const auto backlog = resource_manager.get_upload_backlog();
+        backlog != 0) {
+      constexpr double bytes_in_megabyte = 1024.0 * 1024.0;
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg, hicpp-vararg)
+      ImGui::Text("Upload backlog: %.1f MB",
+                  static_cast<double>(backlog) / bytes_in_megabyte);
+    }
+    const auto &render_stats = resource_manager.get_render_stats();
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg, hicpp-vararg)
+    ImGui::Text("%zu models, %zu instances", render_stats.models,
+                render_stats.instances);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg, hicpp-vararg)
+    ImGui::Text("%zu visible, %zu culled", render_stats.visible_models,
+                render_stats.culled_models);
+    if (ImGui::Checkbox("Levels of detail", &use_lods)) {
+      resource_manager.set_lod_enabled(use_lods);
+    }
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg, hicpp-vararg)
+    ImGui::Text("%zu triangles, %zu at full detail", render_stats.triangles,
+                render_stats.full_detail_triangles);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg, hicpp-vararg)
+    ImGui::Text("%zu draws in %zu draw calls", render_stats.draws,
+                render_stats.draw_calls);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg, hicpp-vararg)
+    ImGui::Text("%zu state changes, %zu binds skipped",
+                render_stats.state_changes, render_stats.binds_skipped);
+    const auto asset_stats = resource_manager.get_asset_stats();
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg, hicpp-vararg)
+    ImGui::Text("Meshes: %zu resident, %zu hits, %zu misses",
+                asset_stats.meshes, asset_stats.mesh_hits,
+                asset_stats.mesh_misses);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg, hicpp-vararg)
+    ImGui::Text("Textures: %zu resident, %zu hits, %zu misses",
+                asset_stats.textures, asset_stats.texture_hits,
+                asset_stats.texture_misses);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg, hicpp-vararg)
+    ImGui::Text("Sharing saves %.1f MB",
+                static_cast<double>(asset_stats.shared_bytes) /
+                    (1024.0 * 1024.0));
+    // Taken every frame, so each one only shows the frame before
+    const auto timeline = ThreadPool::instance().take_timeline();
+    if (ImGui::CollapsingHeader("Frame timeline")) {
+      draw_frame_timeline(timeline);
+    }
     ImGui::End();
 
     if (ImGui::BeginMainMenuBar()) {
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstddef>
+#include <string_view>
+
 namespace settings {
 constexpr struct {
   int major;
@@ -33,4 +36,19 @@ static Resolution fullscreen_resolution;
 
 constexpr size_t file_str_size = 50;
 
+// Bytes of mesh and texture data streamed to the GPU per frame
+constexpr size_t upload_budget = 8 * 1024 * 1024;
+
+// Coarser levels of detail are drawn as long as they stay within this many
+// pixels of the full mesh. Switching to a coarser level needs the error to
+// drop below `lod_hysteresis` times that, so models near the threshold don't
+// flicker between two levels.
+constexpr float lod_pixel_error = 1.0F;
+constexpr float lod_hysteresis = 0.75F;
+
+// Baked meshes are written here, relative to the working directory
+constexpr std::string_view mesh_cache_directory = "./cache";
+// Compressed textures, as KTX files
+constexpr std::string_view texture_cache_directory = "./cache";
+
 } // namespace settings
\ No newline at end of file
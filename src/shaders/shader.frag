@@ -2,11 +2,35 @@
 
 sample in vec3 fragment_color;
 in vec2 fragment_uv;
+flat in vec4 fragment_uv_rect;
+flat in float fragment_layer;
 
 out vec4 program_color;
 
-uniform sampler2D tex;
+// Shared by many models, each one samples its own region of a layer
+uniform sampler2DArray tex;
 
 void main() {
-  program_color = texture(tex, fragment_uv) * vec4(fragment_color, 1.0);
+  // Textures with a layer of their own wrap through GL_REPEAT
+  if (fragment_uv_rect.zw == vec2(1.0)) {
+    program_color = texture(tex, vec3(fragment_uv, fragment_layer)) *
+                    vec4(fragment_color, 1.0);
+    return;
+  }
+
+  // Gradients of the unwrapped coordinates, so the mip level doesn't jump
+  // where fract wraps around
+  vec2 unwrapped_uv = fragment_uv * fragment_uv_rect.zw;
+  vec2 uv_dx = dFdx(unwrapped_uv);
+  vec2 uv_dy = dFdy(unwrapped_uv);
+  // Half a texel of the coarser of the two levels trilinear filtering reads
+  float level = ceil(textureQueryLod(tex, unwrapped_uv).x);
+  vec2 inset = 0.5 * exp2(level) / vec2(textureSize(tex, 0).xy);
+  // Repeats the texture inside its region, like GL_REPEAT would, but keeps
+  // the filter from reaching past the region into the neighbouring tiles
+  vec2 uv = fragment_uv_rect.xy +
+            clamp(fract(fragment_uv) * fragment_uv_rect.zw, inset,
+                  fragment_uv_rect.zw - inset);
+  program_color = textureGrad(tex, vec3(uv, fragment_layer), uv_dx, uv_dy) *
+                  vec4(fragment_color, 1.0);
 }
\ No newline at end of file
@@ -3,16 +3,60 @@
 layout(location = 0) in vec3 position;
 layout(location = 3) in vec3 vertex_color;
 layout(location = 6) in vec2 vertex_uv;
+// Which model the vertex belongs to, selects its entry in draw_data
+layout(location = 7) in uint draw_slot;
+// Rows of the affine transform of an instance, the identity for models that
+// aren't instanced
+layout(location = 8) in vec4 instance_transform[3];
 
 out vec3 fragment_color;
 out vec2 fragment_uv;
+// Region of the texture in its atlas layer: offset in xy, size in zw
+flat out vec4 fragment_uv_rect;
+flat out float fragment_layer;
 
-uniform mat4 mvp_matrix;
+layout(std140) uniform Camera {
+  mat4 view;
+  mat4 projection;
+  mat4 view_projection;
+};
+
+// Per model: the rows of the affine model matrix, then position scale and
+// offset, which undo the position quantization of compact vertex formats,
+// then the material color with the atlas layer of the texture in w, then the
+// region of the texture in that layer. Formats without a vertex color read
+// 1.0 instead.
+uniform samplerBuffer draw_data;
+// Where this frame's entries start, draw_data is a ring of several frames
+uniform int draw_data_base;
+const int draw_data_texels = 7;
+// Replaces draw_slot when it's not negative, for models that share their
+// vertices with another model
+uniform int draw_slot_override;
+
+vec3 transform(vec4 rows[3], vec4 point) {
+  return vec3(dot(rows[0], point), dot(rows[1], point), dot(rows[2], point));
+}
 
 void main() {
-  fragment_color = vertex_color;
+  int slot = draw_slot_override >= 0 ? draw_slot_override : int(draw_slot);
+  int base = draw_data_base + slot * draw_data_texels;
+  vec4 model_matrix[3] = vec4[3](texelFetch(draw_data, base),
+                                 texelFetch(draw_data, base + 1),
+                                 texelFetch(draw_data, base + 2));
+  vec3 position_scale = texelFetch(draw_data, base + 3).xyz;
+  vec3 position_offset = texelFetch(draw_data, base + 4).xyz;
+  vec4 material = texelFetch(draw_data, base + 5);
+
+  fragment_color = vertex_color * material.rgb;
   fragment_uv = vertex_uv;
+  fragment_uv_rect = texelFetch(draw_data, base + 6);
+  fragment_layer = material.w;
+
+  vec4 model_position = vec4(position * position_scale + position_offset, 1.0);
+  vec3 instance_position = transform(instance_transform, model_position);
+  vec3 world_position = transform(model_matrix, vec4(instance_position, 1.0));
 
   // gl_Position is a special variable
-  gl_Position = mvp_matrix * vec4(position, 1.0);
-}
\ No newline at end of file
+  gl_Position = view_projection * vec4(world_position, 1.0);
+}
@@ -1,5 +1,6 @@
 #include "utils/GL.hpp"
 
+#include <algorithm>
 #include <iostream>
 
 namespace gl {
@@ -38,14 +39,15 @@ auto Shader::operator=(Shader &&other) noexcept -> Shader & {
 
 void Shader::swap(Shader &other) { std::swap(this->shader_, other.shader_); }
 void Shader::load(const std::string_view path) {
-  auto source = load_file(path);
-  compile(source);
+  auto source = map_file(path);
+  compile(source.view());
 }
 auto Shader::get() const -> const GLuint & { return shader_; };
-void Shader::compile(const std::vector<char> &source) const {
+void Shader::compile(const std::string_view source) const {
   const char *shader_ptr = source.data();
+  const auto shader_length = static_cast<GLint>(source.size());
 
-  glShaderSource(shader_, 1, &shader_ptr, nullptr);
+  glShaderSource(shader_, 1, &shader_ptr, &shader_length);
   glCompileShader(shader_);
   check_error_log(shader_, glGetShaderiv, glGetShaderInfoLog);
 }
@@ -65,8 +67,20 @@ void Program::swap(Program &other) {
 
 auto Program::get() const -> const GLuint & { return shader_program_; }
 
-auto Program::get_matrix_uniform() const -> const GLuint & {
-  return matrix_uniform_;
+auto Program::get_draw_data_uniform() const -> const GLuint & {
+  return draw_data_uniform_;
+}
+
+auto Program::get_draw_data_base_uniform() const -> const GLuint & {
+  return draw_data_base_uniform_;
+}
+
+auto Program::get_draw_slot_uniform() const -> const GLuint & {
+  return draw_slot_uniform_;
+}
+
+auto Program::get_camera_block() const -> const GLuint & {
+  return camera_block_;
 }
 
 void Program::use() const { glUseProgram(shader_program_); }
@@ -76,8 +90,12 @@ void Program::compile(const std::vector<Shader> &shaders) {
   set_output();
   link();
   detach(shaders);
-  set_input();
-  matrix_uniform_ = glGetUniformLocation(shader_program_, "mvp_matrix");
+  draw_data_uniform_ = glGetUniformLocation(shader_program_, "draw_data");
+  draw_data_base_uniform_ =
+      glGetUniformLocation(shader_program_, "draw_data_base");
+  draw_slot_uniform_ =
+      glGetUniformLocation(shader_program_, "draw_slot_override");
+  camera_block_ = glGetUniformBlockIndex(shader_program_, "Camera");
 }
 
 void Program::attach(const Shader &shader) const {
@@ -105,66 +123,165 @@ void Program::link() const {
   check_error_log(shader_program_, glGetProgramiv, glGetProgramInfoLog);
 }
 
-void Program::set_input() const {
-  // Enable shader attributes
-  GLint posAttrib = glGetAttribLocation(shader_program_, "position");
-  glEnableVertexAttribArray(posAttrib);
-
-  GLint colAttrib = glGetAttribLocation(shader_program_, "vertex_color");
-  glEnableVertexAttribArray(colAttrib);
-
-  GLint uvAttrib = glGetAttribLocation(shader_program_, "vertex_uv");
-  glEnableVertexAttribArray(uvAttrib);
-}
-
 void Program::set_output() const {
   glBindFragDataLocation(shader_program_, 0, "program_color");
 }
 
-VertexArrayObject::VertexArrayObject() {
+VertexArrayObject::VertexArrayObject(GLuint element_buffer,
+                                     GLuint vertex_buffer,
+                                     void (*set_attributes)()) {
   glGenVertexArrays(1, &vao_);
   glBindVertexArray(vao_);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer);
+  glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+  set_attributes();
+  // Later element buffer binds would otherwise end up in this VAO
+  glBindVertexArray(0);
 }
 VertexArrayObject::~VertexArrayObject() { glDeleteVertexArrays(1, &vao_); }
 
-Texture::Texture(const std::string_view path) {
-  // Load SDL_image surface from file
-  auto surface = load_image(path);
-  create(surface->w, surface->h, surface->pixels);
+VertexArrayObject::VertexArrayObject(VertexArrayObject &&other) noexcept {
+  swap(other);
+}
+auto VertexArrayObject::operator=(VertexArrayObject &&other) noexcept
+    -> VertexArrayObject & {
+  swap(other);
+  return *this;
 }
 
-Texture::Texture(size_t width, size_t height, void *pixels) {
-  create(width, height, pixels);
+void VertexArrayObject::swap(VertexArrayObject &other) {
+  std::swap(this->vao_, other.vao_);
 }
+void VertexArrayObject::bind() const { glBindVertexArray(vao_); }
 
-Texture::~Texture() { glDeleteTextures(1, &texture_id_); }
+TextureBuffer::TextureBuffer(GLenum format) : format_(format) {
+  glGenBuffers(1, &buffer_);
+  glGenTextures(1, &texture_);
+}
+TextureBuffer::~TextureBuffer() {
+  for (auto *fence : fences_) {
+    glDeleteSync(fence);
+  }
+  glDeleteTextures(1, &texture_);
+  glDeleteBuffers(1, &buffer_);
+}
 
-Texture::Texture(Texture &&other) noexcept { swap(other); }
-auto Texture::operator=(Texture &&other) noexcept -> Texture & {
+TextureBuffer::TextureBuffer(TextureBuffer &&other) noexcept { swap(other); }
+auto TextureBuffer::operator=(TextureBuffer &&other) noexcept
+    -> TextureBuffer & {
   swap(other);
   return *this;
-};
+}
+
+void TextureBuffer::swap(TextureBuffer &other) {
+  std::swap(this->buffer_, other.buffer_);
+  std::swap(this->texture_, other.texture_);
+  std::swap(this->format_, other.format_);
+  std::swap(this->region_size_, other.region_size_);
+  std::swap(this->region_, other.region_);
+  std::swap(this->fences_, other.fences_);
+  std::swap(this->staging_, other.staging_);
+  std::swap(this->mapped_size_, other.mapped_size_);
+  std::swap(this->mapped_, other.mapped_);
+}
+
+void TextureBuffer::bind(GLenum texture_unit) const {
+  glActiveTexture(texture_unit);
+  glBindTexture(GL_TEXTURE_BUFFER, texture_);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+auto TextureBuffer::map(size_t size) -> void * {
+  // Zero sized mappings are an error
+  mapped_size_ = std::max<size_t>(size, 1);
+  if (mapped_size_ > region_size_) {
+    reserve(std::max(mapped_size_, region_size_ * 2));
+  }
+  auto &fence = fences_.at(region_);
+  if (fence != nullptr) {
+    constexpr GLuint64 timeout_ns = 1000 * 1000 * 1000;
+    GLenum result = GL_TIMEOUT_EXPIRED;
+    while (result == GL_TIMEOUT_EXPIRED) {
+      result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout_ns);
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+  }
+
+  glBindBuffer(GL_TEXTURE_BUFFER, buffer_);
+  // The fence guarantees the GPU is done with the region
+  constexpr auto access = static_cast<GLbitfield>(GL_MAP_WRITE_BIT) |
+                          static_cast<GLbitfield>(GL_MAP_INVALIDATE_RANGE_BIT) |
+                          static_cast<GLbitfield>(GL_MAP_UNSYNCHRONIZED_BIT);
+  void *target = glMapBufferRange(
+      GL_TEXTURE_BUFFER, static_cast<GLintptr>(region_ * region_size_),
+      static_cast<GLsizeiptr>(mapped_size_), access);
+  mapped_ = target != nullptr;
+  if (!mapped_) {
+    staging_.resize(mapped_size_);
+    target = staging_.data();
+  }
+  return target;
+}
+
+auto TextureBuffer::unmap(size_t texel_size) -> GLint {
+  glBindBuffer(GL_TEXTURE_BUFFER, buffer_);
+  const auto offset = static_cast<GLintptr>(region_ * region_size_);
+  if (mapped_) {
+    // A corrupted region shows stale data for one frame at worst
+    glUnmapBuffer(GL_TEXTURE_BUFFER);
+  } else {
+    glBufferSubData(GL_TEXTURE_BUFFER, offset,
+                    static_cast<GLsizeiptr>(mapped_size_), staging_.data());
+  }
+  return static_cast<GLint>(region_ * region_size_ / texel_size);
+}
+
+void TextureBuffer::fence() {
+  fences_.at(region_) = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  region_ = (region_ + 1) % region_count;
+}
+
+void TextureBuffer::reserve(size_t region_size) {
+  // Regions start on texel boundaries for any texel of up to 16 bytes
+  constexpr size_t alignment = 16;
+  region_size_ = (region_size + alignment - 1) / alignment * alignment;
+  region_ = 0;
+  // The new storage isn't read by anything yet
+  for (auto &fence : fences_) {
+    glDeleteSync(fence);
+    fence = nullptr;
+  }
+  glBindBuffer(GL_TEXTURE_BUFFER, buffer_);
+  glBufferData(GL_TEXTURE_BUFFER,
+               static_cast<GLsizeiptr>(region_size_ * region_count), nullptr,
+               GL_STREAM_DRAW);
+  glBindTexture(GL_TEXTURE_BUFFER, texture_);
+  glTexBuffer(GL_TEXTURE_BUFFER, format_, buffer_);
+}
+
+UniformBuffer::UniformBuffer(GLuint binding) : binding_(binding) {
+  glGenBuffers(1, &buffer_);
+  glBindBufferBase(GL_UNIFORM_BUFFER, binding_, buffer_);
+}
+UniformBuffer::~UniformBuffer() { glDeleteBuffers(1, &buffer_); }
+
+UniformBuffer::UniformBuffer(UniformBuffer &&other) noexcept { swap(other); }
+auto UniformBuffer::operator=(UniformBuffer &&other) noexcept
+    -> UniformBuffer & {
+  swap(other);
+  return *this;
+}
+
+void UniformBuffer::swap(UniformBuffer &other) {
+  std::swap(this->buffer_, other.buffer_);
+  std::swap(this->binding_, other.binding_);
+}
 
-void Texture::swap(Texture &other) {
-  std::swap(this->texture_id_, other.texture_id_);
-}
-void Texture::bind() const { glBindTexture(GL_TEXTURE_2D, texture_id_); }
-
-void Texture::create(size_t width, size_t height, void *pixels) {
-  // Create texture
-  glGenTextures(1, &texture_id_);
-  bind();
-  // Load image
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, static_cast<GLsizei>(width),
-               static_cast<GLsizei>(height), 0, GL_RGBA, GL_UNSIGNED_BYTE,
-               pixels);
-  // Nice trilinear filtering with mipmaps
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                  GL_LINEAR_MIPMAP_LINEAR);
-  glGenerateMipmap(GL_TEXTURE_2D);
+void UniformBuffer::update(const void *data, size_t size) {
+  glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+  glBufferData(GL_UNIFORM_BUFFER, static_cast<GLsizeiptr>(size), data,
+               GL_STREAM_DRAW);
 }
 
 } // namespace gl
\ No newline at end of file
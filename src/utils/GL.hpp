@@ -2,6 +2,9 @@
 
 #include "utils/io.hpp"
 #include <GL/glew.h>
+#include <array>
+#include <cstddef>
+#include <vector>
 
 namespace gl {
 
@@ -27,7 +30,7 @@ struct Shader {
   [[nodiscard]] auto get() const -> const GLuint &;
 
 private:
-  void compile(const std::vector<char> &source) const;
+  void compile(std::string_view source) const;
 
   GLuint shader_ = 0;
 };
@@ -43,7 +46,11 @@ struct Program {
 
   void swap(Program &other);
   [[nodiscard]] auto get() const -> const GLuint &;
-  [[nodiscard]] auto get_matrix_uniform() const -> const GLuint &;
+  [[nodiscard]] auto get_draw_data_uniform() const -> const GLuint &;
+  [[nodiscard]] auto get_draw_data_base_uniform() const -> const GLuint &;
+  [[nodiscard]] auto get_draw_slot_uniform() const -> const GLuint &;
+  // Index of the `Camera` uniform block
+  [[nodiscard]] auto get_camera_block() const -> const GLuint &;
 
   void use() const;
 
@@ -58,70 +65,103 @@ private:
 
   void link() const;
 
-  void set_input() const;
   void set_output() const;
 
   GLuint shader_program_ = 0;
-  GLuint matrix_uniform_ = 0;
+  GLuint draw_data_uniform_ = 0;
+  GLuint draw_data_base_uniform_ = 0;
+  GLuint draw_slot_uniform_ = 0;
+  GLuint camera_block_ = 0;
 };
 
-template <typename T> struct Buffer {
-  Buffer() = default;
-  Buffer(const GLenum &buffer_type, std::vector<T> &&data);
-  ~Buffer();
+// Whether a buffer keeps its CPU copy after the upload finished
+enum struct residency_enum { RESIDENCY_GPU_ONLY, RESIDENCY_RETAINED };
 
-  Buffer(const Buffer &) = delete;
-  Buffer(Buffer &&other) noexcept;
-  auto operator=(const Buffer &) -> Buffer & = delete;
-  auto operator=(Buffer &&other) noexcept -> Buffer &;
-
-  void swap(Buffer &other);
-  auto get_data() const -> const std::vector<T> &;
-  void bind();
-
-private:
-  void set_layout();
-
-  GLuint buf_ = 0;
-  GLenum buffer_type_ = 0;
-  std::vector<T> data_;
-};
+// Uploads go through a binding point that isn't part of any VAO, so streaming
+// an element buffer can't change what a bound VAO draws from
+constexpr GLenum upload_target = GL_COPY_WRITE_BUFFER;
 
 struct VertexArrayObject {
-  VertexArrayObject();
+  VertexArrayObject() = default;
+  // Captures the index buffer, the vertex buffer and the attribute layout
+  // `set_attributes` sets up for it
+  VertexArrayObject(GLuint element_buffer, GLuint vertex_buffer,
+                    void (*set_attributes)());
   ~VertexArrayObject();
 
   VertexArrayObject(const VertexArrayObject &) = delete;
-  VertexArrayObject(VertexArrayObject &&other) noexcept = delete;
+  VertexArrayObject(VertexArrayObject &&other) noexcept;
   auto operator=(const VertexArrayObject &) -> VertexArrayObject & = delete;
-  auto operator=(VertexArrayObject &&other) noexcept
-      -> VertexArrayObject & = delete;
+  auto operator=(VertexArrayObject &&other) noexcept -> VertexArrayObject &;
+
+  void swap(VertexArrayObject &other);
+  void bind() const;
 
 private:
   GLuint vao_ = 0;
 };
 
-struct Texture {
-  Texture() = default;
-  Texture(std::string_view path);
-  Texture(size_t width, size_t height, void *pixels);
-  ~Texture();
+// Buffer that shaders read through a samplerBuffer, rewritten every frame.
+// Frames write to the regions of a ring in turn and each region is fenced,
+// so a write only waits for the GPU if it is `region_count` frames behind.
+struct TextureBuffer {
+  static constexpr size_t region_count = 3;
+
+  TextureBuffer() = default;
+  explicit TextureBuffer(GLenum format);
+  ~TextureBuffer();
+
+  TextureBuffer(const TextureBuffer &) = delete;
+  TextureBuffer(TextureBuffer &&other) noexcept;
+  auto operator=(const TextureBuffer &) -> TextureBuffer & = delete;
+  auto operator=(TextureBuffer &&other) noexcept -> TextureBuffer &;
+
+  void swap(TextureBuffer &other);
+  void bind(GLenum texture_unit) const;
+
+  // Returns `size` bytes of the next region to write this frame's data to,
+  // growing the ring if needed
+  auto map(size_t size) -> void *;
+  // Finishes the write. Returns the offset of the region in units of
+  // `texel_size`, which the shader adds to its texelFetch coordinates.
+  auto unmap(size_t texel_size) -> GLint;
+  // Call after the last draw that reads the region written last
+  void fence();
 
-  Texture(const Texture &) = delete;
-  Texture(Texture &&other) noexcept;
-  auto operator=(const Texture &) -> Texture & = delete;
-  auto operator=(Texture &&other) noexcept -> Texture &;
+private:
+  void reserve(size_t region_size);
+
+  GLuint buffer_ = 0;
+  GLuint texture_ = 0;
+  GLenum format_ = 0;
+  size_t region_size_ = 0;
+  size_t region_ = 0;
+  std::array<GLsync, region_count> fences_{};
+  // Used when the buffer can't be mapped
+  std::vector<std::byte> staging_;
+  size_t mapped_size_ = 0;
+  bool mapped_ = false;
+};
 
-  void swap(Texture &other);
-  void bind() const;
+// Storage of a uniform block, bound to a fixed binding point
+struct UniformBuffer {
+  UniformBuffer() = default;
+  explicit UniformBuffer(GLuint binding);
+  ~UniformBuffer();
 
-private:
-  void create(size_t width, size_t height, void *pixels);
+  UniformBuffer(const UniformBuffer &) = delete;
+  UniformBuffer(UniformBuffer &&other) noexcept;
+  auto operator=(const UniformBuffer &) -> UniformBuffer & = delete;
+  auto operator=(UniformBuffer &&other) noexcept -> UniformBuffer &;
+
+  void swap(UniformBuffer &other);
 
-  GLuint texture_id_ = 0;
+  // Replaces the contents, orphaning the storage draws may still read
+  void update(const void *data, size_t size);
+
+private:
+  GLuint buffer_ = 0;
+  GLuint binding_ = 0;
 };
 
 } // namespace gl
-
-// Include all template implementations
-#include "utils/GL_impl.hpp"
\ No newline at end of file
@@ -0,0 +1,455 @@
+#include "utils/bvh.hpp"
+
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <utility>
+
+namespace {
+
+// Leaves hold at most this many items unless no split is possible
+constexpr uint32_t max_leaf_items = 4;
+// Larger leaves are split even if the heuristic says it doesn't pay off
+constexpr uint32_t max_leaf_size = 16;
+// Candidate split planes per axis
+constexpr size_t bin_count = 16;
+// Cost of visiting a node, relative to testing the box of one item
+constexpr float traversal_cost = 1.0F;
+// Rebuild once refits have grown the summed node area by this much
+constexpr float rebuild_threshold = 1.5F;
+constexpr uint32_t all_planes = (1U << 6U) - 1U;
+
+enum struct overlap_enum { OVERLAP_OUTSIDE, OVERLAP_PARTIAL, OVERLAP_INSIDE };
+
+// Tests `box` against the planes set in `mask` and clears the ones it is
+// entirely in front of, which then don't need testing for anything inside it
+auto classify(const Aabb &box, const FrustumPlanes &planes, uint32_t &mask)
+    -> overlap_enum {
+  for (size_t p = 0; p != planes.size(); ++p) {
+    const auto bit = 1U << p;
+    if ((mask & bit) == 0) {
+      continue;
+    }
+    const auto &plane = planes.at(p);
+    const glm::vec3 normal(plane);
+    // The corners furthest along and against the normal
+    const glm::vec3 front(normal.x > 0.0F ? box.max.x : box.min.x,
+                          normal.y > 0.0F ? box.max.y : box.min.y,
+                          normal.z > 0.0F ? box.max.z : box.min.z);
+    const glm::vec3 back(normal.x > 0.0F ? box.min.x : box.max.x,
+                         normal.y > 0.0F ? box.min.y : box.max.y,
+                         normal.z > 0.0F ? box.min.z : box.max.z);
+    if (glm::dot(normal, front) + plane.w < 0.0F) {
+      return overlap_enum::OVERLAP_OUTSIDE;
+    }
+    if (glm::dot(normal, back) + plane.w >= 0.0F) {
+      mask &= ~bit;
+    }
+  }
+  return mask == 0 ? overlap_enum::OVERLAP_INSIDE
+                   : overlap_enum::OVERLAP_PARTIAL;
+}
+
+// Distance along the ray where it enters `box`, if it does before
+// `max_distance`
+auto intersect(const Aabb &box, const glm::vec3 &origin,
+               const glm::vec3 &inverse_direction, float max_distance)
+    -> std::optional<float> {
+  const auto t1 = (box.min - origin) * inverse_direction;
+  const auto t2 = (box.max - origin) * inverse_direction;
+  const float entry = std::max({std::min(t1.x, t2.x), std::min(t1.y, t2.y),
+                                std::min(t1.z, t2.z), 0.0F});
+  const float exit = std::min({std::max(t1.x, t2.x), std::max(t1.y, t2.y),
+                               std::max(t1.z, t2.z), max_distance});
+  if (entry > exit) {
+    return std::nullopt;
+  }
+  return entry;
+}
+
+} // namespace
+
+void Aabb::grow(const glm::vec3 &point) {
+  min = glm::min(min, point);
+  max = glm::max(max, point);
+}
+
+void Aabb::grow(const Aabb &other) {
+  min = glm::min(min, other.min);
+  max = glm::max(max, other.max);
+}
+
+auto Aabb::is_empty() const -> bool {
+  return min.x > max.x || min.y > max.y || min.z > max.z;
+}
+
+auto Aabb::center() const -> glm::vec3 { return (min + max) * 0.5F; }
+
+auto Aabb::surface_area() const -> float {
+  if (is_empty()) {
+    return 0.0F;
+  }
+  const auto extent = max - min;
+  return 2.0F * (extent.x * extent.y + extent.y * extent.z +
+                 extent.z * extent.x);
+}
+
+auto Aabb::overlaps(const Aabb &other) const -> bool {
+  return min.x <= other.max.x && other.min.x <= max.x &&
+         min.y <= other.max.y && other.min.y <= max.y &&
+         min.z <= other.max.z && other.min.z <= max.z;
+}
+
+auto Aabb::contains(const Aabb &other) const -> bool {
+  return min.x <= other.min.x && other.max.x <= max.x &&
+         min.y <= other.min.y && other.max.y <= max.y &&
+         min.z <= other.min.z && other.max.z <= max.z;
+}
+
+auto Aabb::transformed(const glm::mat4 &matrix) const -> Aabb {
+  if (is_empty()) {
+    return {};
+  }
+  // Arvo: every matrix element moves the new bounds by the smaller or the
+  // larger of its products with the old ones
+  Aabb box;
+  box.min = glm::vec3(matrix[3]);
+  box.max = box.min;
+  for (int column = 0; column != 3; ++column) {
+    for (int row = 0; row != 3; ++row) {
+      const float a = matrix[column][row] * min[column];
+      const float b = matrix[column][row] * max[column];
+      box.min[row] += std::min(a, b);
+      box.max[row] += std::max(a, b);
+    }
+  }
+  return box;
+}
+
+auto Bvh::Node::is_leaf() const -> bool { return left == 0; }
+
+void Bvh::build(std::vector<Aabb> bounds) {
+  bounds_ = std::move(bounds);
+  const auto count = static_cast<uint32_t>(bounds_.size());
+  leaf_of_.assign(count, 0);
+  build_items_.resize(count);
+  for (uint32_t item = 0; item != count; ++item) {
+    build_items_[item] = {bounds_[item], bounds_[item].center(), item};
+  }
+
+  nodes_.clear();
+  area_sum_ = 0.0F;
+  built_ratio_ = 0.0F;
+  if (count == 0) {
+    return;
+  }
+  // A binary tree with single item leaves has the most nodes
+  nodes_.reserve(2 * static_cast<size_t>(count) - 1);
+  nodes_.push_back({{}, 0, count, 0, 0, false});
+  stack_.assign(1, 0);
+  while (!stack_.empty()) {
+    const auto node = stack_.back();
+    stack_.pop_back();
+    split(node);
+  }
+  items_.resize(count);
+  std::transform(build_items_.begin(), build_items_.end(), items_.begin(),
+                 [](const BuildItem &built) { return built.item; });
+  built_ratio_ = loose_ratio();
+}
+
+void Bvh::split(const uint32_t node) {
+  const auto first = nodes_[node].first;
+  const auto count = nodes_[node].count;
+  // Splits move the items themselves, so the builder reads them in order
+  const auto begin = build_items_.begin() + first;
+  const auto end = begin + count;
+
+  Aabb bounds;
+  Aabb centroid_bounds;
+  for (auto it = begin; it != end; ++it) {
+    bounds.grow(it->bounds);
+    centroid_bounds.grow(it->centroid);
+  }
+  nodes_[node].bounds = bounds;
+  area_sum_ += bounds.surface_area();
+
+  auto make_leaf = [&]() {
+    for (auto it = begin; it != end; ++it) {
+      leaf_of_[it->item] = node;
+    }
+  };
+  if (count <= max_leaf_items) {
+    make_leaf();
+    return;
+  }
+
+  // Binned surface area heuristic along the longest axis of the centroids.
+  // Splitting has to beat testing every item of a leaf.
+  const auto extent = centroid_bounds.max - centroid_bounds.min;
+  int axis = extent.y > extent.x ? 1 : 0;
+  if (extent.z > extent[axis]) {
+    axis = 2;
+  }
+  const float area = bounds.surface_area();
+  float best_cost = static_cast<float>(count);
+  size_t best_bin = 0;
+  const float scale = static_cast<float>(bin_count) / extent[axis];
+  auto bin_of = [&](const BuildItem &item) {
+    const auto bin = static_cast<size_t>(
+        (item.centroid[axis] - centroid_bounds.min[axis]) * scale);
+    return std::min(bin, bin_count - 1);
+  };
+  if (area > 0.0F && extent[axis] > 0.0F) {
+    std::array<Aabb, bin_count> bins;
+    std::array<uint32_t, bin_count> counts{};
+    for (auto it = begin; it != end; ++it) {
+      const auto bin = bin_of(*it);
+      bins.at(bin).grow(it->bounds);
+      ++counts.at(bin);
+    }
+    // Everything right of each split plane, swept from the right
+    std::array<float, bin_count> right_areas{};
+    std::array<uint32_t, bin_count> right_counts{};
+    Aabb right;
+    uint32_t right_count = 0;
+    for (size_t bin = bin_count - 1; bin != 0; --bin) {
+      right.grow(bins.at(bin));
+      right_count += counts.at(bin);
+      right_areas.at(bin) = right.surface_area();
+      right_counts.at(bin) = right_count;
+    }
+    Aabb left;
+    uint32_t left_count = 0;
+    for (size_t bin = 1; bin != bin_count; ++bin) {
+      left.grow(bins.at(bin - 1));
+      left_count += counts.at(bin - 1);
+      const float cost =
+          traversal_cost +
+          (left.surface_area() * static_cast<float>(left_count) +
+           right_areas.at(bin) * static_cast<float>(right_counts.at(bin))) /
+              area;
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_bin = bin;
+      }
+    }
+  }
+
+  auto middle = begin;
+  if (best_bin != 0) {
+    middle = std::partition(begin, end, [&](const BuildItem &item) {
+      return bin_of(item) < best_bin;
+    });
+  } else if (count <= max_leaf_size) {
+    make_leaf();
+    return;
+  }
+  if (middle == begin || middle == end) {
+    // No useful plane, e.g. all centroids coincide. Halving keeps the
+    // leaves small.
+    middle = begin + count / 2;
+    std::nth_element(begin, middle, end,
+                     [axis](const BuildItem &a, const BuildItem &b) {
+                       return a.centroid[axis] < b.centroid[axis];
+                     });
+  }
+
+  const auto left = static_cast<uint32_t>(nodes_.size());
+  const auto left_count = static_cast<uint32_t>(middle - begin);
+  nodes_[node].left = left;
+  nodes_.push_back({{}, first, left_count, 0, node, false});
+  nodes_.push_back(
+      {{}, first + left_count, count - left_count, 0, node, false});
+  stack_.push_back(left);
+  stack_.push_back(left + 1);
+}
+
+void Bvh::update(const uint32_t item, const Aabb &bounds) {
+  bounds_[item] = bounds;
+  // Stops at the first node already on the path of another moved item
+  for (auto node = leaf_of_[item]; !nodes_[node].dirty;
+       node = nodes_[node].parent) {
+    nodes_[node].dirty = true;
+    if (node == 0) {
+      break;
+    }
+  }
+}
+
+void Bvh::refit() {
+  if (nodes_.empty() || !nodes_[0].dirty) {
+    return;
+  }
+  // Parents are found before their children, so going through the dirty
+  // nodes backwards fixes every child before its parent
+  dirty_.clear();
+  stack_.assign(1, 0);
+  while (!stack_.empty()) {
+    const auto node = stack_.back();
+    stack_.pop_back();
+    if (!nodes_[node].dirty) {
+      continue;
+    }
+    dirty_.push_back(node);
+    if (!nodes_[node].is_leaf()) {
+      stack_.push_back(nodes_[node].left);
+      stack_.push_back(nodes_[node].left + 1);
+    }
+  }
+  for (auto it = dirty_.rbegin(); it != dirty_.rend(); ++it) {
+    auto &node = nodes_[*it];
+    Aabb bounds;
+    if (node.is_leaf()) {
+      for (uint32_t i = node.first; i != node.first + node.count; ++i) {
+        bounds.grow(bounds_[items_[i]]);
+      }
+    } else {
+      bounds.grow(nodes_[node.left].bounds);
+      bounds.grow(nodes_[node.left + 1].bounds);
+    }
+    area_sum_ += bounds.surface_area() - node.bounds.surface_area();
+    node.bounds = bounds;
+    node.dirty = false;
+  }
+
+  // Items that moved far apart leave large, mostly empty nodes behind
+  if (loose_ratio() > rebuild_threshold * built_ratio_) {
+    build(std::move(bounds_));
+  }
+}
+
+auto Bvh::loose_ratio() const -> float {
+  if (nodes_.empty()) {
+    return 0.0F;
+  }
+  const float root_area = nodes_[0].bounds.surface_area();
+  return root_area > 0.0F ? area_sum_ / root_area : 0.0F;
+}
+
+auto Bvh::size() const -> size_t { return bounds_.size(); }
+
+auto Bvh::get_bounds(const uint32_t item) const -> const Aabb & {
+  return bounds_[item];
+}
+
+void Bvh::query_frustum(const FrustumPlanes &planes,
+                        std::vector<uint32_t> &inside,
+                        std::vector<uint32_t> &intersecting) const {
+  inside.clear();
+  intersecting.clear();
+  if (nodes_.empty()) {
+    return;
+  }
+  // Nodes with the planes their parent wasn't entirely in front of
+  std::vector<std::pair<uint32_t, uint32_t>> stack = {{0, all_planes}};
+  while (!stack.empty()) {
+    auto [index, mask] = stack.back();
+    stack.pop_back();
+    const auto &node = nodes_[index];
+    const auto overlap = classify(node.bounds, planes, mask);
+    if (overlap == overlap_enum::OVERLAP_OUTSIDE) {
+      continue;
+    }
+    const auto begin = items_.begin() + node.first;
+    const auto end = begin + node.count;
+    if (overlap == overlap_enum::OVERLAP_INSIDE) {
+      inside.insert(inside.end(), begin, end);
+    } else if (!node.is_leaf()) {
+      stack.emplace_back(node.left, mask);
+      stack.emplace_back(node.left + 1, mask);
+    } else {
+      for (auto it = begin; it != end; ++it) {
+        auto item_mask = mask;
+        const auto item_overlap = classify(bounds_[*it], planes, item_mask);
+        if (item_overlap == overlap_enum::OVERLAP_INSIDE) {
+          inside.push_back(*it);
+        } else if (item_overlap == overlap_enum::OVERLAP_PARTIAL) {
+          intersecting.push_back(*it);
+        }
+      }
+    }
+  }
+}
+
+void Bvh::query_box(const Aabb &box, std::vector<uint32_t> &items) const {
+  items.clear();
+  if (nodes_.empty()) {
+    return;
+  }
+  std::vector<uint32_t> stack = {0};
+  while (!stack.empty()) {
+    const auto &node = nodes_[stack.back()];
+    stack.pop_back();
+    if (!box.overlaps(node.bounds)) {
+      continue;
+    }
+    const auto begin = items_.begin() + node.first;
+    const auto end = begin + node.count;
+    if (box.contains(node.bounds)) {
+      items.insert(items.end(), begin, end);
+    } else if (!node.is_leaf()) {
+      stack.push_back(node.left);
+      stack.push_back(node.left + 1);
+    } else {
+      std::copy_if(begin, end, std::back_inserter(items),
+                   [&](uint32_t item) { return box.overlaps(bounds_[item]); });
+    }
+  }
+}
+
+auto Bvh::query_ray(const glm::vec3 &origin, const glm::vec3 &direction) const
+    -> std::optional<RayHit> {
+  if (nodes_.empty()) {
+    return std::nullopt;
+  }
+  const auto inverse_direction = glm::vec3(1.0F) / direction;
+  std::optional<RayHit> hit;
+  auto max_distance = [&hit]() {
+    return hit ? hit->distance : std::numeric_limits<float>::max();
+  };
+
+  // Nodes with the distance the ray enters them, nearest child on top
+  std::vector<std::pair<uint32_t, float>> stack;
+  if (const auto entry =
+          intersect(nodes_[0].bounds, origin, inverse_direction,
+                    max_distance())) {
+    stack.emplace_back(0, *entry);
+  }
+  while (!stack.empty()) {
+    const auto [index, entry] = stack.back();
+    stack.pop_back();
+    if (entry > max_distance()) {
+      continue;
+    }
+    const auto &node = nodes_[index];
+    if (node.is_leaf()) {
+      for (uint32_t i = node.first; i != node.first + node.count; ++i) {
+        const auto item = items_[i];
+        const auto distance = intersect(bounds_[item], origin,
+                                        inverse_direction, max_distance());
+        if (distance && (!hit || *distance < hit->distance)) {
+          hit = RayHit{item, *distance};
+        }
+      }
+      continue;
+    }
+    auto near = node.left;
+    auto far = node.left + 1;
+    auto near_entry = intersect(nodes_[near].bounds, origin,
+                                inverse_direction, max_distance());
+    auto far_entry = intersect(nodes_[far].bounds, origin, inverse_direction,
+                               max_distance());
+    if (near_entry && far_entry && *far_entry < *near_entry) {
+      std::swap(near, far);
+      std::swap(near_entry, far_entry);
+    }
+    if (far_entry) {
+      stack.emplace_back(far, *far_entry);
+    }
+    if (near_entry) {
+      stack.emplace_back(near, *near_entry);
+    }
+  }
+  return hit;
+}
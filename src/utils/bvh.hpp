@@ -0,0 +1,102 @@
+#pragma once
+
+#include "utils/frustum.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+#include <optional>
+#include <vector>
+
+// Axis aligned box, empty as long as nothing was added to it
+struct Aabb {
+  glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+  glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+
+  void grow(const glm::vec3 &point);
+  void grow(const Aabb &other);
+  [[nodiscard]] auto is_empty() const -> bool;
+  [[nodiscard]] auto center() const -> glm::vec3;
+  // Zero for empty boxes
+  [[nodiscard]] auto surface_area() const -> float;
+  [[nodiscard]] auto overlaps(const Aabb &other) const -> bool;
+  [[nodiscard]] auto contains(const Aabb &other) const -> bool;
+  // Box around this one after `matrix`, which may rotate it
+  [[nodiscard]] auto transformed(const glm::mat4 &matrix) const -> Aabb;
+};
+
+struct RayHit {
+  uint32_t item = 0;
+  // Where the ray enters the item's box, in multiples of its direction
+  float distance = 0.0F;
+};
+
+// Bounding volume hierarchy over boxes identified by their index, e.g. the
+// models of a scene. Built with the surface area heuristic. Moving a box
+// only refits the nodes above it, until the tree has loosened enough that
+// rebuilding it pays off.
+//
+// Every node covers a contiguous range of items, so queries hand out whole
+// subtrees at once and cost about as much as the number of items found.
+struct Bvh {
+  // Replaces the tree with one over `bounds`, where item `i` is `bounds[i]`
+  void build(std::vector<Aabb> bounds);
+  // Moves an item. The tree only sees it after the next `refit`.
+  void update(uint32_t item, const Aabb &bounds);
+  // Fixes the nodes above every moved item
+  void refit();
+
+  [[nodiscard]] auto size() const -> size_t;
+  [[nodiscard]] auto get_bounds(uint32_t item) const -> const Aabb &;
+
+  // Items entirely inside the frustum go to `inside`, the ones whose box
+  // crosses one of its planes to `intersecting`. Both are cleared first.
+  void query_frustum(const FrustumPlanes &planes,
+                     std::vector<uint32_t> &inside,
+                     std::vector<uint32_t> &intersecting) const;
+  // Items whose box overlaps `box`, after clearing `items`
+  void query_box(const Aabb &box, std::vector<uint32_t> &items) const;
+  // The item whose box the ray enters first. Rays starting inside a box hit
+  // it at distance zero.
+  [[nodiscard]] auto query_ray(const glm::vec3 &origin,
+                               const glm::vec3 &direction) const
+      -> std::optional<RayHit>;
+
+private:
+  struct Node {
+    Aabb bounds;
+    // Items `items_[first, first + count)` are below this node
+    uint32_t first = 0;
+    uint32_t count = 0;
+    // Children are `left` and `left + 1`, leaves have none
+    uint32_t left = 0;
+    uint32_t parent = 0;
+    // Below an item moved since the last refit
+    bool dirty = false;
+
+    [[nodiscard]] auto is_leaf() const -> bool;
+  };
+  struct BuildItem {
+    Aabb bounds;
+    glm::vec3 centroid;
+    uint32_t item;
+  };
+
+  // Turns `node` into a leaf or gives it two children holding its items
+  void split(uint32_t node);
+  [[nodiscard]] auto loose_ratio() const -> float;
+
+  std::vector<Node> nodes_;
+  // Item indices, ordered so every node's items are next to each other
+  std::vector<uint32_t> items_;
+  std::vector<Aabb> bounds_;
+  // Leaf holding every item
+  std::vector<uint32_t> leaf_of_;
+  // Summed surface area of all nodes, which grows as refits loosen the tree
+  float area_sum_ = 0.0F;
+  float built_ratio_ = 0.0F;
+  // Kept to reuse their memory
+  std::vector<BuildItem> build_items_;
+  std::vector<uint32_t> stack_;
+  std::vector<uint32_t> dirty_;
+};
@@ -0,0 +1,114 @@
+#include "utils/frustum.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMPLE_GRAPHICS_HAS_SSE2
+#include <emmintrin.h>
+#endif
+
+auto extract_planes(const glm::mat4 &view_projection) -> FrustumPlanes {
+  // Gribb and Hartmann: every plane is the last row of the matrix plus or
+  // minus one of the others. glm is column major, so gather the rows first.
+  std::array<glm::vec4, 4> rows;
+  for (int row = 0; row != 4; ++row) {
+    rows.at(row) = glm::vec4(view_projection[0][row], view_projection[1][row],
+                             view_projection[2][row], view_projection[3][row]);
+  }
+  FrustumPlanes planes = {rows[3] + rows[0], rows[3] - rows[0],
+                          rows[3] + rows[1], rows[3] - rows[1],
+                          rows[3] + rows[2], rows[3] - rows[2]};
+  // Unit normals, so the distance to a plane can be compared to a radius
+  for (auto &plane : planes) {
+    plane /= glm::length(glm::vec3(plane));
+  }
+  return planes;
+}
+
+void BoundingSpheres::clear() {
+  x.clear();
+  y.clear();
+  z.clear();
+  radius.clear();
+}
+
+void BoundingSpheres::push(const glm::vec3 &center, const float sphere_radius) {
+  x.push_back(center.x);
+  y.push_back(center.y);
+  z.push_back(center.z);
+  radius.push_back(sphere_radius);
+}
+
+void BoundingSpheres::resize(const size_t count) {
+  x.resize(count);
+  y.resize(count);
+  z.resize(count);
+  radius.resize(count);
+}
+
+void BoundingSpheres::set(const size_t index, const glm::vec3 &center,
+                          const float sphere_radius) {
+  x.at(index) = center.x;
+  y[index] = center.y;
+  z[index] = center.z;
+  radius[index] = sphere_radius;
+}
+
+auto BoundingSpheres::size() const -> size_t { return x.size(); }
+
+auto cull_spheres(const BoundingSpheres &spheres, const FrustumPlanes &planes,
+                  std::vector<uint8_t> &visible) -> size_t {
+  const size_t count = spheres.size();
+  visible.resize(count);
+  // Plain pointers and a local copy of the planes: the byte stores into
+  // `visible` may alias anything, which would force reloads every iteration
+  const float *xs = spheres.x.data();
+  const float *ys = spheres.y.data();
+  const float *zs = spheres.z.data();
+  const float *radii = spheres.radius.data();
+  uint8_t *out = visible.data();
+  const FrustumPlanes local_planes = planes;
+  size_t visible_count = 0;
+  size_t i = 0;
+
+  // NOLINTBEGIN(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+#ifdef SIMPLE_GRAPHICS_HAS_SSE2
+  // Four spheres against all six planes per iteration, without branches
+  for (; i + 4 <= count; i += 4) {
+    const __m128 x = _mm_loadu_ps(xs + i);
+    const __m128 y = _mm_loadu_ps(ys + i);
+    const __m128 z = _mm_loadu_ps(zs + i);
+    const __m128 negative_radius =
+        _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radii + i));
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (const auto &plane : local_planes) {
+      const __m128 distance = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), x),
+                     _mm_mul_ps(_mm_set1_ps(plane.y), y)),
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), z),
+                     _mm_set1_ps(plane.w)));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negative_radius));
+    }
+    const auto mask = static_cast<unsigned>(_mm_movemask_ps(inside));
+    out[i] = static_cast<uint8_t>(mask & 1U);
+    out[i + 1] = static_cast<uint8_t>((mask >> 1U) & 1U);
+    out[i + 2] = static_cast<uint8_t>((mask >> 2U) & 1U);
+    out[i + 3] = static_cast<uint8_t>(mask >> 3U);
+    // Population count of the four bits
+    visible_count += (0x4332322132212110ULL >> (mask * 4U)) & 0xFU;
+  }
+#endif
+
+  // The spheres left over, or all of them without SSE2
+  for (; i != count; ++i) {
+    const glm::vec3 center(xs[i], ys[i], zs[i]);
+    bool inside = true;
+    for (const auto &plane : local_planes) {
+      inside = inside &&
+               glm::dot(glm::vec3(plane), center) + plane.w >= -radii[i];
+    }
+    out[i] = static_cast<uint8_t>(inside);
+    visible_count += static_cast<size_t>(inside);
+  }
+  // NOLINTEND(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  return visible_count;
+}
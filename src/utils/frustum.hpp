@@ -0,0 +1,34 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Planes of the view frustum as (normal, distance) with unit normals
+// pointing inwards: left, right, bottom, top, near, far
+using FrustumPlanes = std::array<glm::vec4, 6>;
+
+auto extract_planes(const glm::mat4 &view_projection) -> FrustumPlanes;
+
+// World space bounding spheres as one array per component, so the culling
+// kernel tests several of them with every instruction
+struct BoundingSpheres {
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> z;
+  std::vector<float> radius;
+
+  void clear();
+  void push(const glm::vec3 &center, float sphere_radius);
+  // Spheres can then be set from several threads, each writing its own
+  void resize(size_t count);
+  void set(size_t index, const glm::vec3 &center, float sphere_radius);
+  [[nodiscard]] auto size() const -> size_t;
+};
+
+// Sets `visible[i]` to 1 if sphere `i` touches the frustum and to 0 if it is
+// entirely outside one of the planes. Returns the number of visible spheres.
+auto cull_spheres(const BoundingSpheres &spheres, const FrustumPlanes &planes,
+                  std::vector<uint8_t> &visible) -> size_t;
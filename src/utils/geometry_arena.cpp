@@ -0,0 +1,386 @@
+#include "utils/geometry_arena.hpp"
+
+#include "utils/instance_buffer.hpp"
+#include "utils/timer.hpp"
+#include "utils/vertex_format.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace gl {
+
+namespace {
+
+// 32 bit indices have to start on a 4 byte boundary
+constexpr size_t index_alignment = 4;
+
+auto align_indices(size_t bytes) -> size_t {
+  return (bytes + index_alignment - 1) / index_alignment * index_alignment;
+}
+
+auto create_buffer(size_t size) -> GLuint {
+  GLuint buffer = 0;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(upload_target, buffer);
+  glBufferData(upload_target, static_cast<GLsizeiptr>(size), nullptr,
+               GL_STATIC_DRAW);
+  return buffer;
+}
+
+// Lets `fill` write `size` bytes at `offset` of `buffer`. Returns false if the
+// data got corrupted and has to be written again.
+template <typename Fill>
+auto write_range(GLuint buffer, size_t offset, size_t size, Fill &&fill)
+    -> bool {
+  glBindBuffer(upload_target, buffer);
+  // Nothing draws from a range before it's complete and freed ranges are
+  // only reused frames later, so there's no need to synchronize with the GPU
+  constexpr auto access = static_cast<GLbitfield>(GL_MAP_WRITE_BIT) |
+                          static_cast<GLbitfield>(GL_MAP_INVALIDATE_RANGE_BIT) |
+                          static_cast<GLbitfield>(GL_MAP_UNSYNCHRONIZED_BIT);
+  void *target =
+      glMapBufferRange(upload_target, static_cast<GLintptr>(offset),
+                       static_cast<GLsizeiptr>(size), access);
+  if (target == nullptr) {
+    std::vector<std::byte> staging(size);
+    fill(staging.data());
+    glBufferSubData(upload_target, static_cast<GLintptr>(offset),
+                    static_cast<GLsizeiptr>(size), staging.data());
+    return true;
+  }
+  fill(target);
+  return glUnmapBuffer(upload_target) == GL_TRUE;
+}
+
+void copy_range(GLuint source, GLuint target, size_t source_offset,
+                size_t target_offset, size_t size) {
+  glBindBuffer(GL_COPY_READ_BUFFER, source);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, target);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                      static_cast<GLintptr>(source_offset),
+                      static_cast<GLintptr>(target_offset),
+                      static_cast<GLsizeiptr>(size));
+}
+
+} // namespace
+
+GeometryArena::Page::Page(void (*attribute_setter)(), size_t vertex_stride,
+                          size_t vertex_capacity, size_t index_capacity)
+    : set_attributes(attribute_setter), vertex_size(vertex_stride),
+      vertices(vertex_capacity), indices(index_capacity),
+      vertex_buffer(create_buffer(vertex_capacity * vertex_stride)),
+      index_buffer(create_buffer(index_capacity)),
+      slot_buffer(create_buffer(vertex_capacity * sizeof(Handle))),
+      vao(index_buffer, vertex_buffer, attribute_setter) {
+  vao.bind();
+  glBindBuffer(GL_ARRAY_BUFFER, slot_buffer);
+  glEnableVertexAttribArray(draw_slot_location);
+  glVertexAttribIPointer(draw_slot_location, 1, GL_UNSIGNED_INT, 0, nullptr);
+  InstanceBuffer::reset_attributes();
+  glBindVertexArray(0);
+}
+
+GeometryArena::Page::~Page() {
+  glDeleteBuffers(1, &vertex_buffer);
+  glDeleteBuffers(1, &index_buffer);
+  glDeleteBuffers(1, &slot_buffer);
+}
+
+GeometryArena::Page::Page(Page &&other) noexcept { swap(other); }
+auto GeometryArena::Page::operator=(Page &&other) noexcept -> Page & {
+  swap(other);
+  return *this;
+}
+
+void GeometryArena::Page::swap(Page &other) {
+  std::swap(this->set_attributes, other.set_attributes);
+  std::swap(this->vertex_size, other.vertex_size);
+  std::swap(this->vertices, other.vertices);
+  std::swap(this->indices, other.indices);
+  std::swap(this->vertex_buffer, other.vertex_buffer);
+  std::swap(this->index_buffer, other.index_buffer);
+  std::swap(this->slot_buffer, other.slot_buffer);
+  this->vao.swap(other.vao);
+  std::swap(this->allocations, other.allocations);
+  std::swap(this->retiring, other.retiring);
+}
+
+auto GeometryArena::allocate(mesh::PackedMesh &&mesh,
+                             const residency_enum residency) -> Handle {
+  const auto layout = mesh.layout;
+  Allocation allocation;
+  allocation.vertex_count = mesh.vertex_data().size / layout.vertex_size;
+  allocation.index_bytes = mesh.index_data().size;
+  allocation.lods = layout.lods;
+  allocation.lod_count = layout.lod_count;
+  allocation.index_type = layout.index_type;
+  allocation.source = std::move(mesh);
+  allocation.residency = residency;
+  allocation.in_use = true;
+
+  bool placed = false;
+  for (size_t page = 0; page != pages_.size() && !placed; ++page) {
+    if (pages_[page].set_attributes == layout.set_attributes) {
+      placed = place(page, allocation);
+    }
+  }
+  if (!placed && !place(add_page(layout, allocation), allocation)) {
+    throw std::runtime_error("Mesh doesn't fit into a new geometry page!");
+  }
+
+  Handle handle = 0;
+  if (free_handles_.empty()) {
+    if (allocations_.size() == no_handle) {
+      throw std::runtime_error("Out of geometry arena handles!");
+    }
+    handle = static_cast<Handle>(allocations_.size());
+    allocations_.emplace_back(std::move(allocation));
+  } else {
+    handle = free_handles_.back();
+    free_handles_.pop_back();
+    allocations_[handle] = std::move(allocation);
+  }
+  return handle;
+}
+
+void GeometryArena::free(const Handle handle) {
+  auto &allocation = allocations_.at(handle);
+  allocation.source = mesh::PackedMesh();
+  // Nothing is left to upload
+  allocation.uploaded_bytes = upload_size(allocation);
+  allocation.freed_frame = frame_;
+  ++pages_[allocation.page].retiring;
+  retiring_.push_back(handle);
+}
+
+auto GeometryArena::upload(const Handle handle, const size_t max_bytes)
+    -> size_t {
+  auto &allocation = allocations_.at(handle);
+  const auto &page = pages_[allocation.page];
+  const size_t index_end = allocation.index_bytes;
+  const size_t vertex_end =
+      index_end + allocation.vertex_count * page.vertex_size;
+
+  const auto indices = allocation.source.index_data();
+  const auto vertices = allocation.source.vertex_data();
+  size_t written = 0;
+  while (written < max_bytes && pending_bytes(handle) != 0) {
+    const size_t position = allocation.uploaded_bytes;
+    size_t size = std::min(max_bytes - written, pending_bytes(handle));
+    bool valid = true;
+    if (position < index_end) {
+      size = std::min(size, index_end - position);
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      const auto *source = indices.data + position;
+      valid = write_range(page.index_buffer, allocation.index_offset + position,
+                          size, [source, size](void *target) {
+                            std::memcpy(target, source, size);
+                          });
+    } else if (position < vertex_end) {
+      size = std::min(size, vertex_end - position);
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      const auto *source = vertices.data + (position - index_end);
+      valid = write_range(
+          page.vertex_buffer,
+          allocation.vertex_offset * page.vertex_size + (position - index_end),
+          size,
+          [source, size](void *target) { std::memcpy(target, source, size); });
+    } else {
+      // Whole slots only, at least one even if that exceeds the budget
+      size = std::max(size - size % sizeof(Handle), sizeof(Handle));
+      valid = write_range(page.slot_buffer,
+                          allocation.vertex_offset * sizeof(Handle) +
+                              (position - vertex_end),
+                          size, [handle, size](void *target) {
+                            std::fill_n(static_cast<Handle *>(target),
+                                        size / sizeof(Handle), handle);
+                          });
+    }
+    written += size;
+    if (!valid) {
+      // The data store got corrupted while mapped, start over
+      allocation.uploaded_bytes = 0;
+      return written;
+    }
+    allocation.uploaded_bytes += size;
+  }
+
+  if (pending_bytes(handle) == 0 &&
+      allocation.residency == residency_enum::RESIDENCY_GPU_ONLY) {
+    // Releases the memory or unmaps the cache file, clear() would keep the
+    // capacity
+    allocation.source = mesh::PackedMesh();
+  }
+  return written;
+}
+
+auto GeometryArena::pending_bytes(const Handle handle) const -> size_t {
+  const auto &allocation = allocations_.at(handle);
+  return upload_size(allocation) - allocation.uploaded_bytes;
+}
+
+auto GeometryArena::get_vertices(const Handle handle) const
+    -> mesh::ByteView {
+  return allocations_.at(handle).source.vertex_data();
+}
+
+auto GeometryArena::get_indices(const Handle handle) const -> mesh::ByteView {
+  return allocations_.at(handle).source.index_data();
+}
+
+auto GeometryArena::get_range(const Handle handle, const size_t lod) const
+    -> DrawRange {
+  const auto &allocation = allocations_.at(handle);
+  const auto &level =
+      allocation.lods.at(std::min(lod, allocation.lod_count - 1));
+  const size_t index_size =
+      allocation.index_type == GL_UNSIGNED_SHORT ? sizeof(uint16_t)
+                                                 : sizeof(uint32_t);
+  return {allocation.page, allocation.index_type,
+          static_cast<GLsizei>(level.index_count),
+          // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+          reinterpret_cast<const void *>(allocation.index_offset +
+                                         level.first_index * index_size),
+          static_cast<GLint>(allocation.vertex_offset)};
+}
+
+auto GeometryArena::handle_count() const -> size_t {
+  return allocations_.size();
+}
+
+void GeometryArena::bind_page(const size_t page) const {
+  pages_.at(page).vao.bind();
+}
+
+void GeometryArena::end_frame() {
+  ++frame_;
+
+  std::vector<size_t> released_pages;
+  auto retired = std::stable_partition(
+      retiring_.begin(), retiring_.end(), [this](const Handle handle) {
+        return frame_ - allocations_[handle].freed_frame <
+               arena_frames_in_flight;
+      });
+  for (auto it = retired; it != retiring_.end(); ++it) {
+    auto &allocation = allocations_[*it];
+    auto &page = pages_[allocation.page];
+    page.vertices.free(allocation.vertex_offset, allocation.vertex_count);
+    page.indices.free(allocation.index_offset,
+                      align_indices(allocation.index_bytes));
+    --page.allocations;
+    --page.retiring;
+    released_pages.push_back(allocation.page);
+    allocation = Allocation();
+    free_handles_.push_back(*it);
+  }
+  retiring_.erase(retired, retiring_.end());
+  std::sort(released_pages.begin(), released_pages.end());
+  released_pages.erase(
+      std::unique(released_pages.begin(), released_pages.end()),
+      released_pages.end());
+
+  for (const auto page : released_pages) {
+    if (pages_[page].allocations == 0) {
+      // Frees the GL objects, the slot is reused by the next page
+      pages_[page] = Page();
+    } else if (pages_[page].retiring == 0 && is_fragmented(pages_[page])) {
+      compact(page);
+    }
+  }
+}
+
+auto GeometryArena::place(const size_t page_index, Allocation &allocation)
+    -> bool {
+  auto &page = pages_[page_index];
+  const auto vertex_offset = page.vertices.allocate(allocation.vertex_count);
+  if (!vertex_offset) {
+    return false;
+  }
+  const auto index_offset =
+      page.indices.allocate(align_indices(allocation.index_bytes));
+  if (!index_offset) {
+    page.vertices.free(*vertex_offset, allocation.vertex_count);
+    return false;
+  }
+  allocation.page = page_index;
+  allocation.vertex_offset = *vertex_offset;
+  allocation.index_offset = *index_offset;
+  ++page.allocations;
+  return true;
+}
+
+auto GeometryArena::add_page(const MeshLayout &layout,
+                             const Allocation &allocation) -> size_t {
+  const size_t vertex_capacity = std::max(
+      arena_vertex_page_bytes / layout.vertex_size, allocation.vertex_count);
+  const size_t index_capacity = std::max(
+      arena_index_page_bytes, align_indices(allocation.index_bytes));
+  Page page(layout.set_attributes, layout.vertex_size, vertex_capacity,
+            index_capacity);
+
+  const auto vacant =
+      std::find_if(pages_.begin(), pages_.end(), [](const Page &candidate) {
+        return candidate.set_attributes == nullptr;
+      });
+  if (vacant != pages_.end()) {
+    *vacant = std::move(page);
+    return static_cast<size_t>(vacant - pages_.begin());
+  }
+  pages_.emplace_back(std::move(page));
+  return pages_.size() - 1;
+}
+
+auto GeometryArena::upload_size(const Allocation &allocation) const
+    -> size_t {
+  if (!allocation.in_use) {
+    return 0;
+  }
+  const auto &page = pages_[allocation.page];
+  return allocation.index_bytes +
+         allocation.vertex_count * (page.vertex_size + sizeof(Handle));
+}
+
+auto GeometryArena::is_fragmented(const Page &page) -> bool {
+  // A quarter of the page is free, but not in one piece
+  auto fragmented = [](const RangeAllocator &allocator) {
+    const size_t free_size = allocator.free_size();
+    return free_size > allocator.capacity() / 4 &&
+           allocator.largest_free_block() < free_size / 2;
+  };
+  return fragmented(page.vertices) || fragmented(page.indices);
+}
+
+void GeometryArena::compact(const size_t page_index) {
+  Timer timer("Compacting geometry page took ");
+  auto &page = pages_[page_index];
+  Page compacted(page.set_attributes, page.vertex_size,
+                 page.vertices.capacity(), page.indices.capacity());
+
+  // Copies on the GPU into a new page, overlapping copies within one buffer
+  // aren't allowed
+  for (auto &allocation : allocations_) {
+    if (!allocation.in_use || allocation.page != page_index) {
+      continue;
+    }
+    const auto vertex_offset =
+        *compacted.vertices.allocate(allocation.vertex_count);
+    const auto index_bytes = align_indices(allocation.index_bytes);
+    const auto index_offset = *compacted.indices.allocate(index_bytes);
+    copy_range(page.index_buffer, compacted.index_buffer,
+               allocation.index_offset, index_offset, index_bytes);
+    copy_range(page.vertex_buffer, compacted.vertex_buffer,
+               allocation.vertex_offset * page.vertex_size,
+               vertex_offset * page.vertex_size,
+               allocation.vertex_count * page.vertex_size);
+    copy_range(page.slot_buffer, compacted.slot_buffer,
+               allocation.vertex_offset * sizeof(Handle),
+               vertex_offset * sizeof(Handle),
+               allocation.vertex_count * sizeof(Handle));
+    allocation.vertex_offset = vertex_offset;
+    allocation.index_offset = index_offset;
+    ++compacted.allocations;
+  }
+  page.swap(compacted);
+}
+
+} // namespace gl
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "utils/GL.hpp"
+#include "utils/mesh/packed_mesh.hpp"
+#include "utils/range_allocator.hpp"
+#include <GL/glew.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace gl {
+
+// Default page sizes, meshes that don't fit get a page of their own
+constexpr size_t arena_vertex_page_bytes = 32 * 1024 * 1024;
+constexpr size_t arena_index_page_bytes = 16 * 1024 * 1024;
+
+// Freed ranges are reused after this many frames, the GPU may still be
+// drawing from them until then
+constexpr uint64_t arena_frames_in_flight = 3;
+
+// Stores the vertices and indices of many meshes in a few large buffers, one
+// set of pages per vertex format. Meshes are referred to by handle, as their
+// ranges move when a fragmented page is compacted.
+//
+// Every vertex also stores the handle of its mesh as the `draw_slot`
+// attribute, so the shader can look up per-mesh data in draws that span
+// several meshes.
+struct GeometryArena {
+  using Handle = uint32_t;
+  static constexpr Handle no_handle = std::numeric_limits<Handle>::max();
+
+  // Arguments of one mesh in glMultiDrawElementsBaseVertex
+  struct DrawRange {
+    size_t page;
+    GLenum index_type;
+    GLsizei index_count;
+    const void *index_offset;
+    GLint base_vertex;
+  };
+
+  GeometryArena() = default;
+  ~GeometryArena() = default;
+
+  GeometryArena(const GeometryArena &) = delete;
+  GeometryArena(GeometryArena &&other) noexcept = delete;
+  auto operator=(const GeometryArena &) -> GeometryArena & = delete;
+  auto operator=(GeometryArena &&other) noexcept -> GeometryArena & = delete;
+
+  // Reserves space for the mesh, its data is written by `upload`
+  auto allocate(mesh::PackedMesh &&mesh,
+                residency_enum residency = residency_enum::RESIDENCY_GPU_ONLY)
+      -> Handle;
+  // The ranges are reused `arena_frames_in_flight` frames later
+  void free(Handle handle);
+
+  // Writes at most `max_bytes` of the mesh that isn't on the GPU yet and
+  // returns the number of bytes written
+  auto upload(Handle handle, size_t max_bytes) -> size_t;
+  [[nodiscard]] auto pending_bytes(Handle handle) const -> size_t;
+  // Empty once a GPU-only mesh is fully uploaded
+  [[nodiscard]] auto get_vertices(Handle handle) const -> mesh::ByteView;
+  [[nodiscard]] auto get_indices(Handle handle) const -> mesh::ByteView;
+
+  // Draws the mesh at level of detail `lod`, or its coarsest one if it has
+  // fewer levels
+  [[nodiscard]] auto get_range(Handle handle, size_t lod = 0) const
+      -> DrawRange;
+  // Upper bound of all handles in use, for sizing per-mesh data
+  [[nodiscard]] auto handle_count() const -> size_t;
+  void bind_page(size_t page) const;
+
+  // Releases ranges freed long enough ago and compacts pages that became
+  // fragmented. Call once per frame, after the last draw.
+  void end_frame();
+
+private:
+  struct Page {
+    Page() = default;
+    Page(void (*attribute_setter)(), size_t vertex_stride,
+         size_t vertex_capacity, size_t index_capacity);
+    ~Page();
+
+    Page(const Page &) = delete;
+    Page(Page &&other) noexcept;
+    auto operator=(const Page &) -> Page & = delete;
+    auto operator=(Page &&other) noexcept -> Page &;
+
+    void swap(Page &other);
+
+    void (*set_attributes)() = nullptr;
+    size_t vertex_size = 0;
+    // Counted in vertices
+    RangeAllocator vertices;
+    // Counted in bytes
+    RangeAllocator indices;
+    GLuint vertex_buffer = 0;
+    GLuint index_buffer = 0;
+    // One `Handle` per vertex
+    GLuint slot_buffer = 0;
+    VertexArrayObject vao;
+    // Allocations that still own ranges, including freed ones
+    size_t allocations = 0;
+    size_t retiring = 0;
+  };
+
+  struct Allocation {
+    size_t page = 0;
+    size_t vertex_offset = 0;
+    size_t vertex_count = 0;
+    size_t index_offset = 0;
+    size_t index_bytes = 0;
+    std::array<LodLevel, max_lod_levels> lods{};
+    size_t lod_count = 1;
+    GLenum index_type = GL_UNSIGNED_INT;
+    // Released with its vectors or its mapped cache file once uploaded,
+    // unless the mesh is retained
+    mesh::PackedMesh source;
+    // Indices, then vertices, then draw slots
+    size_t uploaded_bytes = 0;
+    residency_enum residency = residency_enum::RESIDENCY_GPU_ONLY;
+    bool in_use = false;
+    uint64_t freed_frame = 0;
+  };
+
+  // Reserves the ranges of `allocation` in `page` if they fit
+  auto place(size_t page, Allocation &allocation) -> bool;
+  // Returns the index of a new page that fits `allocation`
+  auto add_page(const MeshLayout &layout, const Allocation &allocation)
+      -> size_t;
+  [[nodiscard]] auto upload_size(const Allocation &allocation) const
+      -> size_t;
+  static auto is_fragmented(const Page &page) -> bool;
+  void compact(size_t page);
+
+  std::vector<Page> pages_;
+  std::vector<Allocation> allocations_;
+  std::vector<Handle> free_handles_;
+  std::vector<Handle> retiring_;
+  uint64_t frame_ = 0;
+};
+
+} // namespace gl
@@ -0,0 +1,107 @@
+#include "utils/hash.hpp"
+
+#include <cstring>
+
+namespace {
+
+constexpr uint64_t prime1 = 11400714785074694791ULL;
+constexpr uint64_t prime2 = 14029467366897019727ULL;
+constexpr uint64_t prime3 = 1609587929392839161ULL;
+constexpr uint64_t prime4 = 9650029242287828579ULL;
+constexpr uint64_t prime5 = 2870177450012600261ULL;
+
+auto rotl(uint64_t x, unsigned int r) -> uint64_t {
+  constexpr unsigned int bits = 64;
+  return (x << r) | (x >> (bits - r));
+}
+
+auto read64(const char *p) -> uint64_t {
+  uint64_t value = 0;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+auto read32(const char *p) -> uint32_t {
+  uint32_t value = 0;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+auto round(uint64_t accumulator, uint64_t input) -> uint64_t {
+  accumulator += input * prime2;
+  accumulator = rotl(accumulator, 31);
+  return accumulator * prime1;
+}
+
+auto merge_round(uint64_t accumulator, uint64_t value) -> uint64_t {
+  accumulator ^= round(0, value);
+  return accumulator * prime1 + prime4;
+}
+
+} // namespace
+
+auto hash_bytes(const std::string_view data, const uint64_t seed) -> uint64_t {
+  const char *p = data.data();
+  const char *last = data.data() + data.size();
+  uint64_t h = 0;
+
+  constexpr size_t stripe = 32;
+  if (data.size() >= stripe) {
+    uint64_t v1 = seed + prime1 + prime2;
+    uint64_t v2 = seed + prime2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - prime1;
+    while (last - p >= static_cast<std::ptrdiff_t>(stripe)) {
+      // NOLINTBEGIN(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      v1 = round(v1, read64(p));
+      v2 = round(v2, read64(p + 8));
+      v3 = round(v3, read64(p + 16));
+      v4 = round(v4, read64(p + 24));
+      p += stripe;
+      // NOLINTEND(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    }
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    h = merge_round(h, v1);
+    h = merge_round(h, v2);
+    h = merge_round(h, v3);
+    h = merge_round(h, v4);
+  } else {
+    h = seed + prime5;
+  }
+
+  h += static_cast<uint64_t>(data.size());
+
+  while (last - p >= 8) {
+    h ^= round(0, read64(p));
+    h = rotl(h, 27) * prime1 + prime4;
+    p += 8;
+  }
+  if (last - p >= 4) {
+    h ^= static_cast<uint64_t>(read32(p)) * prime1;
+    h = rotl(h, 23) * prime2 + prime3;
+    p += 4;
+  }
+  while (p != last) {
+    h ^= static_cast<uint64_t>(static_cast<unsigned char>(*p)) * prime5;
+    h = rotl(h, 11) * prime1;
+    ++p;
+  }
+
+  h ^= h >> 33U;
+  h *= prime2;
+  h ^= h >> 29U;
+  h *= prime3;
+  h ^= h >> 32U;
+  return h;
+}
+
+auto to_hex(uint64_t value) -> std::string {
+  constexpr std::string_view digits = "0123456789abcdef";
+  constexpr size_t nibbles = 16;
+  std::string result(nibbles, '0');
+  for (size_t i = 0; i != nibbles; ++i) {
+    result[nibbles - 1 - i] = digits[value & 0xFU];
+    value >>= 4U;
+  }
+  return result;
+}
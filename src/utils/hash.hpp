@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// 64-bit XXH64 hash of `data`. Fast enough to fingerprint whole asset files.
+auto hash_bytes(std::string_view data, uint64_t seed = 0) -> uint64_t;
+
+// Sixteen lowercase hex digits, e.g. to name cache files after a hash
+auto to_hex(uint64_t value) -> std::string;
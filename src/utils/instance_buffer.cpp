@@ -0,0 +1,173 @@
+#include "utils/instance_buffer.hpp"
+
+#include "utils/GL.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace gl {
+
+namespace {
+
+constexpr GLuint instance_transform_rows = 3;
+
+auto to_transform(const Instance &instance) -> InstanceTransform {
+  const auto &angle = instance.rotation;
+  const float cx = std::cos(angle.x);
+  const float sx = std::sin(angle.x);
+  const float cy = std::cos(angle.y);
+  const float sy = std::sin(angle.y);
+  const float cz = std::cos(angle.z);
+  const float sz = std::sin(angle.z);
+  const auto &scale = instance.scale;
+  const auto &offset = instance.offset;
+
+  // translate * rotate_z * rotate_y * rotate_x * scale
+  InstanceTransform transform{};
+  transform.rows[0] = glm::vec4(cz * cy * scale.x,
+                                (cz * sy * sx - sz * cx) * scale.y,
+                                (cz * sy * cx + sz * sx) * scale.z, offset.x);
+  transform.rows[1] = glm::vec4(sz * cy * scale.x,
+                                (sz * sy * sx + cz * cx) * scale.y,
+                                (sz * sy * cx - cz * sx) * scale.z, offset.y);
+  transform.rows[2] = glm::vec4(-sy * scale.x, cy * sx * scale.y,
+                                cy * cx * scale.z, offset.z);
+  return transform;
+}
+
+auto to_transform(const glm::mat4 &matrix) -> InstanceTransform {
+  // The last row of an affine transform is always (0, 0, 0, 1)
+  InstanceTransform transform{};
+  const auto transposed = glm::transpose(matrix);
+  transform.rows[0] = transposed[0];
+  transform.rows[1] = transposed[1];
+  transform.rows[2] = transposed[2];
+  return transform;
+}
+
+} // namespace
+
+InstanceBuffer::~InstanceBuffer() { glDeleteBuffers(1, &buffer_); }
+
+InstanceBuffer::InstanceBuffer(InstanceBuffer &&other) noexcept {
+  swap(other);
+}
+auto InstanceBuffer::operator=(InstanceBuffer &&other) noexcept
+    -> InstanceBuffer & {
+  swap(other);
+  return *this;
+}
+
+void InstanceBuffer::swap(InstanceBuffer &other) {
+  std::swap(this->instances_, other.instances_);
+  std::swap(this->transforms_, other.transforms_);
+  std::swap(this->buffer_, other.buffer_);
+  std::swap(this->capacity_, other.capacity_);
+  std::swap(this->dirty_begin_, other.dirty_begin_);
+  std::swap(this->dirty_end_, other.dirty_end_);
+}
+
+auto InstanceBuffer::add(const Instance &instance) -> size_t {
+  instances_.push_back(instance);
+  transforms_.push_back(to_transform(instance));
+  mark_dirty(instances_.size() - 1);
+  return instances_.size() - 1;
+}
+
+void InstanceBuffer::set(const size_t index, const Instance &instance) {
+  instances_.at(index) = instance;
+  transforms_[index] = to_transform(instance);
+  mark_dirty(index);
+}
+
+auto InstanceBuffer::add(const glm::mat4 &transform) -> size_t {
+  instances_.emplace_back();
+  transforms_.push_back(to_transform(transform));
+  mark_dirty(instances_.size() - 1);
+  return instances_.size() - 1;
+}
+
+void InstanceBuffer::set(const size_t index, const glm::mat4 &transform) {
+  instances_.at(index) = Instance();
+  transforms_[index] = to_transform(transform);
+  mark_dirty(index);
+}
+
+void InstanceBuffer::reserve(const size_t count) {
+  instances_.reserve(count);
+  transforms_.reserve(count);
+}
+
+void InstanceBuffer::clear() {
+  instances_.clear();
+  transforms_.clear();
+  dirty_begin_ = 0;
+  dirty_end_ = 0;
+}
+
+auto InstanceBuffer::get(const size_t index) const -> const Instance & {
+  return instances_.at(index);
+}
+
+auto InstanceBuffer::size() const -> size_t { return instances_.size(); }
+
+auto InstanceBuffer::update() -> size_t {
+  if (dirty_begin_ == dirty_end_) {
+    return 0;
+  }
+  if (buffer_ == 0) {
+    glGenBuffers(1, &buffer_);
+  }
+  glBindBuffer(upload_target, buffer_);
+  if (transforms_.size() > capacity_) {
+    // Grows geometrically, so adding instances one at a time stays cheap
+    capacity_ = std::max(transforms_.size(), capacity_ * 2);
+    glBufferData(upload_target,
+                 static_cast<GLsizeiptr>(capacity_ * sizeof(InstanceTransform)),
+                 nullptr, GL_DYNAMIC_DRAW);
+    dirty_begin_ = 0;
+    dirty_end_ = transforms_.size();
+  }
+
+  const size_t size = (dirty_end_ - dirty_begin_) * sizeof(InstanceTransform);
+  glBufferSubData(
+      upload_target,
+      static_cast<GLintptr>(dirty_begin_ * sizeof(InstanceTransform)),
+      static_cast<GLsizeiptr>(size), &transforms_[dirty_begin_]);
+  dirty_begin_ = 0;
+  dirty_end_ = 0;
+  return size;
+}
+
+void InstanceBuffer::bind_attributes() const {
+  glBindBuffer(GL_ARRAY_BUFFER, buffer_);
+  for (GLuint row = 0; row != instance_transform_rows; ++row) {
+    const GLuint location = instance_transform_location + row;
+    glEnableVertexAttribArray(location);
+    glVertexAttribPointer(
+        location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceTransform),
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        reinterpret_cast<void *>(row * sizeof(glm::vec4)));
+    glVertexAttribDivisor(location, 1);
+  }
+}
+
+void InstanceBuffer::reset_attributes() {
+  for (GLuint row = 0; row != instance_transform_rows; ++row) {
+    const GLuint location = instance_transform_location + row;
+    glDisableVertexAttribArray(location);
+    glVertexAttrib4f(location, row == 0 ? 1.0F : 0.0F,
+                     row == 1 ? 1.0F : 0.0F, row == 2 ? 1.0F : 0.0F, 0.0F);
+  }
+}
+
+void InstanceBuffer::mark_dirty(const size_t index) {
+  if (dirty_begin_ == dirty_end_) {
+    dirty_begin_ = index;
+    dirty_end_ = index + 1;
+    return;
+  }
+  dirty_begin_ = std::min(dirty_begin_, index);
+  dirty_end_ = std::max(dirty_end_, index + 1);
+}
+
+} // namespace gl
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "utils/vertex_format.hpp"
+#include <GL/glew.h>
+#include <cstddef>
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace gl {
+
+// Placement of one copy of a model, relative to the model itself
+struct Instance {
+  glm::vec3 offset = glm::vec3(0.0F);
+  glm::vec3 scale = glm::vec3(1.0F);
+  // Euler angles in radians, applied in x, y, z order
+  glm::vec3 rotation = glm::vec3(0.0F);
+};
+
+// Instances of one model and the GPU buffer of their transforms. Only the
+// transforms that changed since the last `update` are streamed again.
+struct InstanceBuffer {
+  InstanceBuffer() = default;
+  ~InstanceBuffer();
+
+  InstanceBuffer(const InstanceBuffer &) = delete;
+  InstanceBuffer(InstanceBuffer &&other) noexcept;
+  auto operator=(const InstanceBuffer &) -> InstanceBuffer & = delete;
+  auto operator=(InstanceBuffer &&other) noexcept -> InstanceBuffer &;
+
+  void swap(InstanceBuffer &other);
+
+  auto add(const Instance &instance) -> size_t;
+  void set(size_t index, const Instance &instance);
+  // Any affine transform, `get` then returns the default instance for it
+  auto add(const glm::mat4 &transform) -> size_t;
+  void set(size_t index, const glm::mat4 &transform);
+  void reserve(size_t count);
+  void clear();
+  [[nodiscard]] auto get(size_t index) const -> const Instance &;
+  [[nodiscard]] auto size() const -> size_t;
+
+  // Writes the transforms that changed, creating or growing the buffer if
+  // needed. Returns the number of bytes written.
+  auto update() -> size_t;
+
+  // Points the instance attributes of the bound VAO at the buffer
+  void bind_attributes() const;
+  // Disables the instance attributes of the bound VAO, they then read the
+  // identity transform
+  static void reset_attributes();
+
+private:
+  void mark_dirty(size_t index);
+
+  std::vector<Instance> instances_;
+  std::vector<InstanceTransform> transforms_;
+  GLuint buffer_ = 0;
+  // Transforms the buffer has room for
+  size_t capacity_ = 0;
+  // Transforms that changed since the last `update`
+  size_t dirty_begin_ = 0;
+  size_t dirty_end_ = 0;
+};
+
+} // namespace gl
@@ -3,11 +3,92 @@
 #include "utils/flip_vertical.hpp"
 #include "utils/timer.hpp"
 #include <fstream>
+#include <random>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SIMPLE_GRAPHICS_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+FileView::FileView(const std::string_view path) {
+  Timer timer("Mapping file " + std::string(path) + " took ");
+#ifdef SIMPLE_GRAPHICS_HAS_MMAP
+  const std::string path_str(path);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg, hicpp-vararg)
+  const int fd = open(path_str.c_str(), O_RDONLY);
+  if (fd != -1) {
+    struct stat st {};
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      const auto size = static_cast<size_t>(st.st_size);
+      void *ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (ptr != MAP_FAILED) {
+        // Parsers walk the file front to back exactly once
+        madvise(ptr, size, MADV_SEQUENTIAL);
+        data_ = static_cast<const char *>(ptr);
+        size_ = size;
+        mapped_ = true;
+      }
+    }
+    close(fd);
+    if (mapped_) {
+      return;
+    }
+  }
+#endif
+  // Fall back to reading the file into memory
+  fallback_ = load_file(path);
+  data_ = fallback_.data();
+  // Don't expose the null terminator appended by load_file
+  size_ = fallback_.size() - 1;
+}
+
+FileView::~FileView() { unmap(); }
+
+FileView::FileView(FileView &&other) noexcept { swap(other); }
+auto FileView::operator=(FileView &&other) noexcept -> FileView & {
+  swap(other);
+  return *this;
+}
+
+void FileView::swap(FileView &other) {
+  std::swap(this->data_, other.data_);
+  std::swap(this->size_, other.size_);
+  std::swap(this->mapped_, other.mapped_);
+  std::swap(this->fallback_, other.fallback_);
+}
+
+auto FileView::data() const -> const char * { return data_; }
+auto FileView::size() const -> size_t { return size_; }
+auto FileView::view() const -> std::string_view { return {data_, size_}; }
+auto FileView::is_mapped() const -> bool { return mapped_; }
+
+void FileView::unmap() {
+#ifdef SIMPLE_GRAPHICS_HAS_MMAP
+  if (mapped_) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+    munmap(const_cast<char *>(data_), size_);
+  }
+#endif
+  data_ = nullptr;
+  size_ = 0;
+  mapped_ = false;
+}
+
+auto map_file(const std::string_view path) -> FileView {
+  return FileView(path);
+}
 
 auto load_file(const std::string_view path) -> std::vector<char> {
   Timer timer("Loading file " + std::string(path) + " took ");
-  std::ifstream file(path.data(), std::ios::binary | std::ios::ate);
+  std::ifstream file(std::string(path), std::ios::binary | std::ios::ate);
   const std::streamsize size = file.tellg();
+  if (size < 0) {
+    throw std::runtime_error(
+        "Can't read from file! File location: " + std::string(path) + '\n');
+  }
   file.seekg(0, std::ios::beg);
   std::vector<char> buffer(size + 1);
   if (!file.read(buffer.data(), size)) {
@@ -19,7 +100,8 @@ auto load_file(const std::string_view path) -> std::vector<char> {
 }
 
 auto load_image(const std::string_view path) -> sdl2::unique_ptr<SDL_Surface> {
-  auto loaded_surface = sdl2::unique_ptr<SDL_Surface>(IMG_Load(path.data()));
+  auto loaded_surface =
+      sdl2::unique_ptr<SDL_Surface>(IMG_Load(std::string(path).c_str()));
   if (!loaded_surface) {
     throw std::runtime_error("Unable to load image " + std::string(path) +
                              "!\nSDL_image error: " + IMG_GetError() + '\n');
@@ -31,3 +113,9 @@ auto load_image(const std::string_view path) -> sdl2::unique_ptr<SDL_Surface> {
   auto flipped_surface = flip_vertical(converted_surface);
   return flipped_surface;
 }
+
+auto unique_temporary_path(const std::string_view path) -> std::string {
+  // Seeded once per thread, so threads and processes draw different names
+  thread_local std::mt19937_64 engine(std::random_device{}());
+  return std::string(path) + "." + std::to_string(engine()) + ".tmp";
+}
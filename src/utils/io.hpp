@@ -1,8 +1,45 @@
 #pragma once
 
 #include "utils/SDL.hpp"
+#include <string>
+#include <string_view>
 #include <vector>
 
+// Read-only view of a whole file. Memory-mapped where the platform allows it,
+// otherwise backed by a buffer filled through `load_file`.
+struct FileView {
+  FileView() = default;
+  explicit FileView(std::string_view path);
+  ~FileView();
+
+  FileView(const FileView &) = delete;
+  FileView(FileView &&other) noexcept;
+  auto operator=(const FileView &) -> FileView & = delete;
+  auto operator=(FileView &&other) noexcept -> FileView &;
+
+  void swap(FileView &other);
+
+  [[nodiscard]] auto data() const -> const char *;
+  [[nodiscard]] auto size() const -> size_t;
+  [[nodiscard]] auto view() const -> std::string_view;
+  [[nodiscard]] auto is_mapped() const -> bool;
+
+private:
+  void unmap();
+
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+  bool mapped_ = false;
+  std::vector<char> fallback_;
+};
+
+auto map_file(std::string_view path) -> FileView;
+
 auto load_file(std::string_view path) -> std::vector<char>;
 
-auto load_image(std::string_view path) -> sdl2::unique_ptr<SDL_Surface>;
\ No newline at end of file
+auto load_image(std::string_view path) -> sdl2::unique_ptr<SDL_Surface>;
+
+// A path next to `path` that no other writer, in this process or another,
+// picks at the same time. Files are written there and then renamed over
+// `path`, so concurrent writers never share a half written file.
+auto unique_temporary_path(std::string_view path) -> std::string;
@@ -0,0 +1,106 @@
+#include "utils/mesh/index_builder.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+
+namespace mesh {
+
+namespace {
+
+constexpr uint32_t empty_slot = UINT32_MAX;
+
+// Final mix of MurmurHash3, spreads consecutive ids over the whole table
+auto mix(uint32_t h) -> uint32_t {
+  constexpr uint32_t m1 = 0x85ebca6bU;
+  constexpr uint32_t m2 = 0xc2b2ae35U;
+  h ^= h >> 16U;
+  h *= m1;
+  h ^= h >> 13U;
+  h *= m2;
+  h ^= h >> 16U;
+  return h;
+}
+
+auto hash(const parser::obj::Vertex &corner) -> uint32_t {
+  constexpr uint32_t golden = 0x9e3779b9U;
+  uint32_t h = mix(corner.vertex_id);
+  h = mix(h ^ (corner.uv_id + golden + (h << 6U) + (h >> 2U)));
+  h = mix(h ^ (corner.normal_id + golden + (h << 6U) + (h >> 2U)));
+  return h;
+}
+
+auto operator==(const parser::obj::Vertex &lhs, const parser::obj::Vertex &rhs)
+    -> bool {
+  return lhs.vertex_id == rhs.vertex_id && lhs.uv_id == rhs.uv_id &&
+         lhs.normal_id == rhs.normal_id;
+}
+
+// Smallest power of two that keeps the load factor at or below 2/3
+auto table_capacity(size_t max_entries) -> size_t {
+  size_t capacity = 16;
+  while (capacity * 2 < max_entries * 3) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+} // namespace
+
+auto build_indexed(const std::vector<parser::obj::Face> &faces,
+                   const std::vector<Point> &points,
+                   const std::vector<parser::obj::TextureCoords> &uvs,
+                   const Color &color) -> MeshData {
+  const size_t corner_count = faces.size() * 3;
+
+  // Open addressing with linear probing. Slots hold indices into `corners`,
+  // which doubles as the key storage for every emitted vertex.
+  std::vector<uint32_t> table(table_capacity(corner_count), empty_slot);
+  const size_t mask = table.size() - 1;
+  std::vector<parser::obj::Vertex> corners;
+
+  MeshData mesh;
+  mesh.elements.reserve(faces.size());
+  // Most meshes have at least one output vertex per position
+  mesh.vertices.reserve(points.size());
+  corners.reserve(points.size());
+
+  auto emit = [&](const parser::obj::Vertex &corner) -> unsigned int {
+    size_t slot = hash(corner) & mask;
+    while (table[slot] != empty_slot) {
+      if (corners[table[slot]] == corner) {
+        return table[slot];
+      }
+      slot = (slot + 1) & mask;
+    }
+
+    if (corner.vertex_id >= points.size()) {
+      throw std::runtime_error("Face references a missing vertex!");
+    }
+    const auto &point = points[corner.vertex_id];
+    // Faces without texture coordinates sample the texture's corner
+    const auto uv = corner.uv_id < uvs.size() ? uvs[corner.uv_id]
+                                              : parser::obj::TextureCoords{};
+
+    const auto index = static_cast<uint32_t>(corners.size());
+    table[slot] = index;
+    corners.push_back(corner);
+    mesh.vertices.push_back({{point.x, point.y, point.z},
+                             {color.r, color.g, color.b},
+                             {uv.u, uv.v}});
+    return index;
+  };
+
+  for (const auto &face : faces) {
+    const auto &v = face.vertices;
+    // Keep the winding order the de-indexed loader used to produce
+    mesh.elements.push_back({{emit(v[2]), emit(v[1]), emit(v[0])}});
+  }
+
+  std::cout << "Indexed mesh: " << corner_count << " face corners welded into "
+            << mesh.vertices.size() << " vertices.\n";
+
+  return mesh;
+}
+
+} // namespace mesh
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "utils/mesh/mesh_data.hpp"
+#include "utils/primitives.hpp"
+#include <vector>
+
+namespace mesh {
+
+// Turns OBJ faces into an indexed triangle list. Every distinct
+// (vertex_id, uv_id, normal_id) corner becomes exactly one output vertex.
+auto build_indexed(const std::vector<parser::obj::Face> &faces,
+                   const std::vector<Point> &points,
+                   const std::vector<parser::obj::TextureCoords> &uvs,
+                   const Color &color) -> MeshData;
+
+} // namespace mesh
@@ -0,0 +1,549 @@
+#include "utils/mesh/mesh_cache.hpp"
+
+#include "utils/hash.hpp"
+#include "utils/io.hpp"
+#include "utils/timer.hpp"
+#include "utils/vertex_format.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace mesh {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+constexpr std::array<char, 8> magic = {'S', 'G', 'M', 'E', 'S', 'H', 0, 0};
+constexpr std::array<char, 8> scene_magic = {'S', 'G', 'S', 'C',
+                                             'E', 'N', 'E', 0};
+
+// Bump whenever the layout below or the meaning of its contents changes
+constexpr uint32_t format_version = 4;
+
+// Vertex and index arrays start on cache line boundaries, so a mapped file
+// can be uploaded without another copy
+constexpr uint64_t section_alignment = 64;
+
+// Attribute setters can't be stored, the file records which of these vertex
+// types the vertices are
+constexpr std::array<void (*)(), 3> vertex_types = {
+    &gl::set_attributes<gl::Vertex>, &gl::set_attributes<gl::CompactVertex>,
+    &gl::set_attributes<gl::CompactColorVertex>};
+constexpr std::array<size_t, 3> vertex_sizes = {
+    sizeof(gl::Vertex), sizeof(gl::CompactVertex),
+    sizeof(gl::CompactColorVertex)};
+
+// One per level of detail, in the order of `MeshLayout::lods`
+struct LodEntry {
+  uint64_t first_index;
+  uint64_t index_count;
+  float error;
+  uint32_t padding;
+};
+
+using Vec3 = std::array<float, 3>;
+using Mat4 = std::array<float, 16>;
+
+// The file starts with this header, followed by the source path, the texture
+// path, the level of detail table and the index and vertex arrays at the
+// recorded offsets, exactly as they are uploaded
+struct Header {
+  std::array<char, 8> magic;
+  uint32_t version;
+  uint32_t pipeline;
+  uint64_t source_size;
+  int64_t source_mtime;
+  uint64_t content_hash;
+  // Index in `vertex_types`
+  uint32_t vertex_type;
+  uint32_t vertex_size;
+  uint32_t index_type;
+  uint32_t padding;
+  uint64_t index_count;
+  uint64_t vertex_offset;
+  uint64_t vertex_bytes;
+  uint64_t index_offset;
+  uint64_t index_bytes;
+  uint64_t source_path_offset;
+  uint64_t source_path_size;
+  uint64_t texture_path_offset;
+  uint64_t texture_path_size;
+  uint64_t lod_count;
+  uint64_t lod_table_offset;
+  // The rest of `gl::MeshLayout`
+  Vec3 position_scale;
+  Vec3 position_offset;
+  Vec3 material_color;
+  Vec3 bounds_min;
+  Vec3 bounds_max;
+  Vec3 sphere_center;
+  float sphere_radius;
+};
+
+// The scene file starts with this header, followed by the source path, every
+// mesh name as its size and its characters, then every node as a
+// `NodeEntry`, its name and the indices of its meshes
+struct SceneHeader {
+  std::array<char, 8> magic;
+  uint32_t version;
+  uint32_t pipeline;
+  uint64_t source_size;
+  int64_t source_mtime;
+  uint64_t content_hash;
+  uint64_t source_path_size;
+  uint64_t mesh_count;
+  uint64_t node_count;
+};
+
+struct NodeEntry {
+  Mat4 transform;
+  uint32_t parent;
+  uint32_t mesh_count;
+  uint64_t name_size;
+};
+
+auto align(uint64_t offset) -> uint64_t {
+  return (offset + section_alignment - 1) / section_alignment *
+         section_alignment;
+}
+
+// Whether [offset, offset + size) lies inside a file of `file_size` bytes
+auto in_bounds(uint64_t offset, uint64_t size, uint64_t file_size) -> bool {
+  return offset <= file_size && size <= file_size - offset;
+}
+
+// Reads the scene file front to back, failing instead of reading past its
+// end
+struct SceneReader {
+  std::string_view contents;
+  uint64_t offset = 0;
+  bool failed = false;
+
+  void read(void *bytes, uint64_t size) {
+    if (failed || !in_bounds(offset, size, contents.size())) {
+      failed = true;
+      return;
+    }
+    if (size == 0) {
+      return;
+    }
+    std::memcpy(bytes, contents.data() + offset, size);
+    offset += size;
+  }
+
+  auto read_string(uint64_t size) -> std::string {
+    if (failed || !in_bounds(offset, size, contents.size())) {
+      failed = true;
+      return {};
+    }
+    std::string value(contents.substr(offset, size));
+    offset += size;
+    return value;
+  }
+};
+
+auto to_array(const glm::vec3 &value) -> Vec3 {
+  return {value.x, value.y, value.z};
+}
+
+auto to_vec3(const Vec3 &value) -> glm::vec3 {
+  return {value[0], value[1], value[2]};
+}
+
+// Column by column, like glm stores them
+auto to_array(const glm::mat4 &value) -> Mat4 {
+  Mat4 result{};
+  for (int column = 0; column != 4; ++column) {
+    for (int row = 0; row != 4; ++row) {
+      result.at(column * 4 + row) = value[column][row];
+    }
+  }
+  return result;
+}
+
+auto to_mat4(const Mat4 &value) -> glm::mat4 {
+  glm::mat4 result(1.0F);
+  for (int column = 0; column != 4; ++column) {
+    for (int row = 0; row != 4; ++row) {
+      result[column][row] = value.at(column * 4 + row);
+    }
+  }
+  return result;
+}
+
+auto index_size(uint32_t index_type) -> uint64_t {
+  switch (index_type) {
+  case GL_UNSIGNED_SHORT:
+    return sizeof(uint16_t);
+  case GL_UNSIGNED_INT:
+    return sizeof(uint32_t);
+  default:
+    return 0;
+  }
+}
+
+// Whether the header describes vertices and indices that can be drawn and
+// that lie inside the file
+auto is_consistent(const Header &header, uint64_t file_size) -> bool {
+  if (header.vertex_type >= vertex_types.size() ||
+      header.vertex_size != vertex_sizes.at(header.vertex_type) ||
+      index_size(header.index_type) == 0 ||
+      header.lod_count == 0 || header.lod_count > gl::max_lod_levels) {
+    return false;
+  }
+  return header.vertex_bytes % header.vertex_size == 0 &&
+         header.index_count <= file_size / index_size(header.index_type) &&
+         header.index_bytes ==
+             header.index_count * index_size(header.index_type) &&
+         in_bounds(header.source_path_offset, header.source_path_size,
+                   file_size) &&
+         in_bounds(header.texture_path_offset, header.texture_path_size,
+                   file_size) &&
+         in_bounds(header.lod_table_offset,
+                   header.lod_count * sizeof(LodEntry), file_size) &&
+         in_bounds(header.vertex_offset, header.vertex_bytes, file_size) &&
+         in_bounds(header.index_offset, header.index_bytes, file_size);
+}
+
+} // namespace
+
+auto make_cache_key(const std::string_view path,
+                    const std::string_view contents, const uint32_t pipeline,
+                    const std::initializer_list<std::string_view> dependencies)
+    -> CacheKey {
+  std::error_code path_error;
+  const auto canonical = fs::weakly_canonical(fs::path(path), path_error);
+  std::error_code time_error;
+  const auto mtime = fs::last_write_time(fs::path(path), time_error);
+
+  CacheKey key;
+  key.source_path = path_error ? std::string(path) : canonical.string();
+  key.source_size = contents.size();
+  key.source_mtime =
+      time_error ? 0 : static_cast<int64_t>(mtime.time_since_epoch().count());
+  key.content_hash = hash_bytes(contents);
+  for (const auto dependency : dependencies) {
+    key.content_hash = hash_bytes(dependency, key.content_hash);
+  }
+  key.pipeline = pipeline;
+  return key;
+}
+
+auto cache_path(const std::string_view cache_directory, const CacheKey &key)
+    -> std::string {
+  // Every pipeline of a file gets a bake of its own, so switching options
+  // back and forth doesn't overwrite the other variant each time
+  const auto name =
+      to_hex(hash_bytes(key.source_path, key.pipeline)) + ".sgmesh";
+  return (fs::path(cache_directory) / name).string();
+}
+
+auto load_cached(const std::string_view cache_directory, const CacheKey &key)
+    -> std::optional<PackedMesh> {
+  const auto path = cache_path(cache_directory, key);
+  std::error_code error;
+  if (!fs::is_regular_file(path, error)) {
+    return std::nullopt;
+  }
+
+  Timer timer("Loading cached mesh " + path + " took ");
+  auto file = map_file(path);
+  Header header{};
+  if (file.size() < sizeof(header)) {
+    return std::nullopt;
+  }
+  std::memcpy(&header, file.data(), sizeof(header));
+
+  const bool valid =
+      header.magic == magic && header.version == format_version &&
+      header.pipeline == key.pipeline &&
+      header.source_size == key.source_size &&
+      header.source_mtime == key.source_mtime &&
+      header.content_hash == key.content_hash &&
+      is_consistent(header, file.size());
+  if (!valid) {
+    return std::nullopt;
+  }
+
+  const auto contents = file.view();
+  // Guards against two sources whose paths hash to the same file name
+  if (contents.substr(header.source_path_offset, header.source_path_size) !=
+      key.source_path) {
+    return std::nullopt;
+  }
+
+  PackedMesh data;
+  auto &layout = data.layout;
+  layout.set_attributes = vertex_types.at(header.vertex_type);
+  layout.vertex_size = header.vertex_size;
+  layout.index_type = header.index_type;
+  layout.index_count = header.index_count;
+  layout.lod_count = header.lod_count;
+  std::array<LodEntry, gl::max_lod_levels> lods{};
+  std::memcpy(lods.data(), contents.data() + header.lod_table_offset,
+              header.lod_count * sizeof(LodEntry));
+  for (size_t i = 0; i != layout.lod_count; ++i) {
+    const auto &lod = lods.at(i);
+    if (lod.first_index > header.index_count ||
+        lod.index_count > header.index_count - lod.first_index) {
+      return std::nullopt;
+    }
+    layout.lods.at(i) = {lod.first_index, lod.index_count, lod.error};
+  }
+  layout.position_scale = to_vec3(header.position_scale);
+  layout.position_offset = to_vec3(header.position_offset);
+  layout.material_color = to_vec3(header.material_color);
+  layout.bounds_min = to_vec3(header.bounds_min);
+  layout.bounds_max = to_vec3(header.bounds_max);
+  layout.sphere_center = to_vec3(header.sphere_center);
+  layout.sphere_radius = header.sphere_radius;
+
+  data.texture_path = std::string(
+      contents.substr(header.texture_path_offset, header.texture_path_size));
+  data.vertex_section = {header.vertex_offset, header.vertex_bytes};
+  data.index_section = {header.index_offset, header.index_bytes};
+  data.file = std::move(file);
+  return data;
+}
+
+void store_cached(const std::string_view cache_directory, const CacheKey &key,
+                  const PackedMesh &data) {
+  Timer timer("Baking mesh " + key.source_path + " took ");
+  const auto path = cache_path(cache_directory, key);
+  const auto temporary_path = unique_temporary_path(path);
+
+  std::error_code error;
+  fs::create_directories(fs::path(cache_directory), error);
+  if (error) {
+    std::cerr << "Can't create mesh cache directory " << cache_directory
+              << ": " << error.message() << '\n';
+    return;
+  }
+
+  const auto &layout = data.layout;
+  const auto vertex_type = std::find(vertex_types.begin(), vertex_types.end(),
+                                     layout.set_attributes);
+  if (vertex_type == vertex_types.end()) {
+    std::cerr << "Can't bake mesh " << key.source_path
+              << ": unknown vertex type\n";
+    return;
+  }
+  const auto vertices = data.vertex_data();
+  const auto indices = data.index_data();
+
+  Header header{};
+  header.magic = magic;
+  header.version = format_version;
+  header.pipeline = key.pipeline;
+  header.source_size = key.source_size;
+  header.source_mtime = key.source_mtime;
+  header.content_hash = key.content_hash;
+  header.vertex_type =
+      static_cast<uint32_t>(vertex_type - vertex_types.begin());
+  header.vertex_size = static_cast<uint32_t>(layout.vertex_size);
+  header.index_type = layout.index_type;
+  header.index_count = layout.index_count;
+  header.source_path_offset = sizeof(header);
+  header.source_path_size = key.source_path.size();
+  header.texture_path_offset =
+      header.source_path_offset + header.source_path_size;
+  header.texture_path_size = data.texture_path.size();
+  header.lod_count = layout.lod_count;
+  header.lod_table_offset =
+      align(header.texture_path_offset + header.texture_path_size);
+  header.index_bytes = indices.size;
+  header.index_offset =
+      align(header.lod_table_offset + header.lod_count * sizeof(LodEntry));
+  header.vertex_bytes = vertices.size;
+  header.vertex_offset = align(header.index_offset + header.index_bytes);
+  header.position_scale = to_array(layout.position_scale);
+  header.position_offset = to_array(layout.position_offset);
+  header.material_color = to_array(layout.material_color);
+  header.bounds_min = to_array(layout.bounds_min);
+  header.bounds_max = to_array(layout.bounds_max);
+  header.sphere_center = to_array(layout.sphere_center);
+  header.sphere_radius = layout.sphere_radius;
+
+  std::vector<LodEntry> lods;
+  for (size_t i = 0; i != layout.lod_count; ++i) {
+    const auto &lod = layout.lods.at(i);
+    lods.push_back({lod.first_index, lod.index_count, lod.error, 0});
+  }
+
+  {
+    std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+    auto write_at = [&file](uint64_t offset, const void *bytes, size_t size) {
+      // Zero padding up to the section offset
+      while (static_cast<uint64_t>(file.tellp()) < offset) {
+        file.put('\0');
+      }
+      file.write(static_cast<const char *>(bytes),
+                 static_cast<std::streamsize>(size));
+    };
+    write_at(0, &header, sizeof(header));
+    write_at(header.source_path_offset, key.source_path.data(),
+             key.source_path.size());
+    write_at(header.texture_path_offset, data.texture_path.data(),
+             data.texture_path.size());
+    write_at(header.lod_table_offset, lods.data(),
+             lods.size() * sizeof(LodEntry));
+    write_at(header.index_offset, indices.data, indices.size);
+    write_at(header.vertex_offset, vertices.data, vertices.size);
+    if (!file) {
+      std::cerr << "Can't write baked mesh " << temporary_path << '\n';
+      fs::remove(temporary_path, error);
+      return;
+    }
+  }
+
+  // Readers never see a partially written file
+  fs::rename(temporary_path, path, error);
+  if (error) {
+    std::cerr << "Can't write baked mesh " << path << ": " << error.message()
+              << '\n';
+    fs::remove(temporary_path, error);
+  }
+}
+
+auto scene_cache_path(const std::string_view cache_directory,
+                      const CacheKey &key) -> std::string {
+  const auto name =
+      to_hex(hash_bytes(key.source_path, key.pipeline)) + ".sgscene";
+  return (fs::path(cache_directory) / name).string();
+}
+
+auto load_cached_scene(const std::string_view cache_directory,
+                       const CacheKey &key) -> std::optional<SceneData> {
+  const auto path = scene_cache_path(cache_directory, key);
+  std::error_code error;
+  if (!fs::is_regular_file(path, error)) {
+    return std::nullopt;
+  }
+
+  Timer timer("Loading cached scene " + path + " took ");
+  const auto file = map_file(path);
+  SceneReader reader{file.view()};
+  SceneHeader header{};
+  reader.read(&header, sizeof(header));
+  const bool valid =
+      !reader.failed && header.magic == scene_magic &&
+      header.version == format_version && header.pipeline == key.pipeline &&
+      header.source_size == key.source_size &&
+      header.source_mtime == key.source_mtime &&
+      header.content_hash == key.content_hash &&
+      header.mesh_count < no_parent && header.node_count < no_parent &&
+      reader.read_string(header.source_path_size) == key.source_path;
+  if (!valid || reader.failed) {
+    return std::nullopt;
+  }
+
+  // Every count is checked against the bytes left before anything is
+  // allocated for it
+  const auto remaining = file.size() - reader.offset;
+  if (header.mesh_count > remaining / sizeof(uint64_t) ||
+      header.node_count > remaining / sizeof(NodeEntry)) {
+    return std::nullopt;
+  }
+  SceneData data;
+  data.mesh_names.resize(header.mesh_count);
+  for (auto &name : data.mesh_names) {
+    uint64_t size = 0;
+    reader.read(&size, sizeof(size));
+    name = reader.read_string(size);
+  }
+  data.nodes.resize(header.node_count);
+  for (size_t i = 0; i != data.nodes.size() && !reader.failed; ++i) {
+    auto &node = data.nodes[i];
+    NodeEntry entry{};
+    reader.read(&entry, sizeof(entry));
+    // Parents come first
+    if (entry.parent != no_parent && entry.parent >= i) {
+      return std::nullopt;
+    }
+    node.transform = to_mat4(entry.transform);
+    node.parent = entry.parent;
+    node.name = reader.read_string(entry.name_size);
+    if (entry.mesh_count > (file.size() - reader.offset) / sizeof(uint32_t)) {
+      return std::nullopt;
+    }
+    node.meshes.resize(entry.mesh_count);
+    reader.read(node.meshes.data(), node.meshes.size() * sizeof(uint32_t));
+    if (std::any_of(node.meshes.begin(), node.meshes.end(),
+                    [&](uint32_t mesh) { return mesh >= header.mesh_count; })) {
+      return std::nullopt;
+    }
+  }
+  if (reader.failed) {
+    return std::nullopt;
+  }
+  return data;
+}
+
+void store_cached_scene(const std::string_view cache_directory,
+                        const CacheKey &key, const SceneData &data) {
+  const auto path = scene_cache_path(cache_directory, key);
+  const auto temporary_path = unique_temporary_path(path);
+
+  std::error_code error;
+  fs::create_directories(fs::path(cache_directory), error);
+  if (error) {
+    std::cerr << "Can't create mesh cache directory " << cache_directory
+              << ": " << error.message() << '\n';
+    return;
+  }
+
+  SceneHeader header{};
+  header.magic = scene_magic;
+  header.version = format_version;
+  header.pipeline = key.pipeline;
+  header.source_size = key.source_size;
+  header.source_mtime = key.source_mtime;
+  header.content_hash = key.content_hash;
+  header.source_path_size = key.source_path.size();
+  header.mesh_count = data.mesh_names.size();
+  header.node_count = data.nodes.size();
+
+  {
+    std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+    auto write = [&file](const void *bytes, size_t size) {
+      file.write(static_cast<const char *>(bytes),
+                 static_cast<std::streamsize>(size));
+    };
+    write(&header, sizeof(header));
+    write(key.source_path.data(), key.source_path.size());
+    for (const auto &name : data.mesh_names) {
+      const uint64_t size = name.size();
+      write(&size, sizeof(size));
+      write(name.data(), name.size());
+    }
+    for (const auto &node : data.nodes) {
+      NodeEntry entry{};
+      entry.transform = to_array(node.transform);
+      entry.parent = node.parent;
+      entry.mesh_count = static_cast<uint32_t>(node.meshes.size());
+      entry.name_size = node.name.size();
+      write(&entry, sizeof(entry));
+      write(node.name.data(), node.name.size());
+      write(node.meshes.data(), node.meshes.size() * sizeof(uint32_t));
+    }
+    if (!file) {
+      std::cerr << "Can't write baked scene " << temporary_path << '\n';
+      fs::remove(temporary_path, error);
+      return;
+    }
+  }
+
+  fs::rename(temporary_path, path, error);
+  if (error) {
+    std::cerr << "Can't write baked scene " << path << ": " << error.message()
+              << '\n';
+    fs::remove(temporary_path, error);
+  }
+}
+
+} // namespace mesh
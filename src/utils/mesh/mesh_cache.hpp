@@ -0,0 +1,60 @@
+#pragma once
+
+#include "utils/mesh/packed_mesh.hpp"
+#include "utils/mesh/scene_data.hpp"
+#include <cstdint>
+#include <initializer_list>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace mesh {
+
+// Identifies the loader output a baked mesh was produced from. Any change to
+// the source file, to the files it depends on or to the processing pipeline
+// invalidates the cache entry.
+struct CacheKey {
+  std::string source_path;
+  uint64_t source_size = 0;
+  int64_t source_mtime = 0;
+  // Covers the dependencies too
+  uint64_t content_hash = 0;
+  // Loader, post-processing steps and vertex format of the mesh
+  uint32_t pipeline = 0;
+};
+
+// `dependencies` are the other inputs whose values end up in the mesh, like
+// the contents of an OBJ's material file
+auto make_cache_key(std::string_view path, std::string_view contents,
+                    uint32_t pipeline,
+                    std::initializer_list<std::string_view> dependencies = {})
+    -> CacheKey;
+
+// Where the baked mesh for `key` lives inside `cache_directory`
+auto cache_path(std::string_view cache_directory, const CacheKey &key)
+    -> std::string;
+
+// Returns the baked mesh if there is an up-to-date one for `key`. It keeps
+// the file mapped, its vertices and indices are uploaded without a copy.
+auto load_cached(std::string_view cache_directory, const CacheKey &key)
+    -> std::optional<PackedMesh>;
+
+// Bakes `data`. Failures are logged, a missing cache entry isn't an error.
+void store_cached(std::string_view cache_directory, const CacheKey &key,
+                  const PackedMesh &data);
+
+// Where the hierarchy of the scene for `key` lives inside `cache_directory`
+auto scene_cache_path(std::string_view cache_directory, const CacheKey &key)
+    -> std::string;
+
+// Returns the nodes and mesh names of the scene if there are up-to-date ones
+// for `key`. The meshes are left empty, they are baked one by one.
+auto load_cached_scene(std::string_view cache_directory, const CacheKey &key)
+    -> std::optional<SceneData>;
+
+// Bakes the nodes and mesh names of `data`, but not its meshes. Failures are
+// logged like those of `store_cached`.
+void store_cached_scene(std::string_view cache_directory, const CacheKey &key,
+                        const SceneData &data);
+
+} // namespace mesh
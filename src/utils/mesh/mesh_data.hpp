@@ -0,0 +1,25 @@
+#pragma once
+
+#include "utils/primitives.hpp"
+#include <string>
+#include <vector>
+
+namespace mesh {
+
+// Coarser version of a mesh, drawn with the same vertices
+struct Lod {
+  std::vector<gl::Element> elements;
+  // Largest distance the simplification moved the surface, in model units
+  float error = 0.0F;
+};
+
+// CPU-side output of every loader, before anything touches OpenGL
+struct MeshData {
+  std::vector<gl::Element> elements;
+  std::vector<gl::Vertex> vertices;
+  std::string texture_path;
+  // Coarser versions of `elements`, finest first
+  std::vector<Lod> lods;
+};
+
+} // namespace mesh
@@ -0,0 +1,354 @@
+#include "utils/mesh/mesh_optimizer.hpp"
+
+#include "utils/timer.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+namespace mesh {
+
+namespace {
+
+constexpr size_t no_vertex = std::numeric_limits<size_t>::max();
+
+// FIFO cache that records when each vertex entered it. A vertex is cached if
+// fewer than `cache_size` others entered after it.
+struct CacheSimulator {
+  CacheSimulator(size_t vertex_count, size_t cache_size)
+      : cached_at_(vertex_count, 0), time_(cache_size + 1),
+        cache_size_(cache_size) {}
+
+  [[nodiscard]] auto is_cached(uint32_t vertex) const -> bool {
+    return time_ - cached_at_[vertex] <= cache_size_;
+  }
+
+  // Returns whether `vertex` had to be transformed
+  auto access(uint32_t vertex) -> bool {
+    if (is_cached(vertex)) {
+      return false;
+    }
+    cached_at_[vertex] = time_++;
+    return true;
+  }
+
+  // Age of `vertex` in the cache, larger than the cache size if it isn't
+  [[nodiscard]] auto age(uint32_t vertex) const -> size_t {
+    return time_ - cached_at_[vertex];
+  }
+
+  // Evicts everything
+  void flush() { time_ += cache_size_; }
+
+private:
+  std::vector<size_t> cached_at_;
+  size_t time_;
+  size_t cache_size_;
+};
+
+auto count_misses(const std::vector<gl::Element> &elements, size_t first,
+                  size_t last, CacheSimulator &cache) -> size_t {
+  size_t misses = 0;
+  for (size_t i = first; i != last; ++i) {
+    for (const auto vertex : elements[i].vertices) {
+      misses += cache.access(vertex) ? 1 : 0;
+    }
+  }
+  return misses;
+}
+
+// Cuts every cluster where the triangles so far already reach `threshold`
+// times the ACMR of the whole cluster
+auto split_clusters(const std::vector<gl::Element> &elements,
+                    const std::vector<size_t> &clusters, size_t vertex_count,
+                    double threshold) -> std::vector<size_t> {
+  CacheSimulator cache(vertex_count, vertex_cache_size);
+  std::vector<size_t> result;
+  for (size_t index = 0; index != clusters.size(); ++index) {
+    const size_t first = clusters[index];
+    const size_t last = index + 1 != clusters.size() ? clusters[index + 1]
+                                                     : elements.size();
+
+    cache.flush();
+    const auto cluster_acmr =
+        static_cast<double>(count_misses(elements, first, last, cache)) /
+        static_cast<double>(last - first);
+
+    cache.flush();
+    result.push_back(first);
+    size_t misses = 0;
+    size_t triangles = 0;
+    for (size_t i = first; i != last; ++i) {
+      misses += count_misses(elements, i, i + 1, cache);
+      ++triangles;
+      const auto acmr =
+          static_cast<double>(misses) / static_cast<double>(triangles);
+      if (i + 1 != last && acmr <= threshold * cluster_acmr) {
+        result.push_back(i + 1);
+        cache.flush();
+        misses = 0;
+        triangles = 0;
+      }
+    }
+  }
+  return result;
+}
+
+} // namespace
+
+auto analyze_vertex_cache(const std::vector<gl::Element> &elements,
+                          const size_t vertex_count, const size_t cache_size)
+    -> VertexCacheStats {
+  if (elements.empty()) {
+    return {};
+  }
+
+  CacheSimulator cache(vertex_count, cache_size);
+  const size_t misses = count_misses(elements, 0, elements.size(), cache);
+
+  // Vertices no triangle uses don't count towards the ATVR
+  std::vector<bool> used(vertex_count, false);
+  for (const auto &element : elements) {
+    for (const auto vertex : element.vertices) {
+      used[vertex] = true;
+    }
+  }
+  const auto used_count = std::count(used.begin(), used.end(), true);
+
+  return {static_cast<double>(misses) / static_cast<double>(elements.size()),
+          static_cast<double>(misses) / static_cast<double>(used_count)};
+}
+
+auto optimize_vertex_cache(std::vector<gl::Element> &elements,
+                           const size_t vertex_count, const size_t cache_size)
+    -> std::vector<size_t> {
+  const size_t triangle_count = elements.size();
+
+  // Triangles that use each vertex, vertex v owns [offsets[v], offsets[v+1])
+  std::vector<uint32_t> offsets(vertex_count + 1, 0);
+  for (const auto &element : elements) {
+    for (const auto vertex : element.vertices) {
+      ++offsets[vertex + 1];
+    }
+  }
+  std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+  std::vector<uint32_t> adjacency(triangle_count * 3);
+  {
+    auto next = offsets;
+    for (size_t t = 0; t != triangle_count; ++t) {
+      for (const auto vertex : elements[t].vertices) {
+        adjacency[next[vertex]++] = static_cast<uint32_t>(t);
+      }
+    }
+  }
+
+  // Triangles that still have to be emitted, per vertex
+  std::vector<uint32_t> live(vertex_count);
+  for (size_t v = 0; v != vertex_count; ++v) {
+    live[v] = offsets[v + 1] - offsets[v];
+  }
+
+  CacheSimulator cache(vertex_count, cache_size);
+  std::vector<bool> emitted(triangle_count, false);
+  std::vector<uint32_t> dead_end;
+  std::vector<uint32_t> candidates;
+  size_t cursor = 0;
+
+  std::vector<gl::Element> result;
+  result.reserve(triangle_count);
+  std::vector<size_t> clusters;
+
+  // Falls back to recently used vertices, then to the input order
+  auto skip_dead_end = [&]() -> size_t {
+    while (!dead_end.empty()) {
+      const auto vertex = dead_end.back();
+      dead_end.pop_back();
+      if (live[vertex] > 0) {
+        return vertex;
+      }
+    }
+    for (; cursor != vertex_count; ++cursor) {
+      if (live[cursor] > 0) {
+        return cursor;
+      }
+    }
+    return no_vertex;
+  };
+
+  size_t fan = skip_dead_end();
+  while (fan != no_vertex) {
+    // Emit every remaining triangle around the fanning vertex
+    candidates.clear();
+    for (size_t i = offsets[fan]; i != offsets[fan + 1]; ++i) {
+      const auto triangle = adjacency[i];
+      if (emitted[triangle]) {
+        continue;
+      }
+      for (const auto vertex : elements[triangle].vertices) {
+        dead_end.push_back(vertex);
+        candidates.push_back(vertex);
+        --live[vertex];
+        cache.access(vertex);
+      }
+      emitted[triangle] = true;
+      result.push_back(elements[triangle]);
+    }
+
+    // Prefer the oldest candidate that stays cached while its fan is emitted
+    size_t next = no_vertex;
+    size_t best_priority = 0;
+    for (const auto vertex : candidates) {
+      if (live[vertex] == 0) {
+        continue;
+      }
+      size_t priority = 0;
+      if (cache.age(vertex) + 2 * live[vertex] <= cache_size) {
+        priority = cache.age(vertex);
+      }
+      if (next == no_vertex || priority > best_priority) {
+        next = vertex;
+        best_priority = priority;
+      }
+    }
+    if (next == no_vertex) {
+      next = skip_dead_end();
+      clusters.push_back(result.size());
+    }
+    fan = next;
+  }
+
+  // The last boundary is the end of the mesh, the first cluster starts at 0
+  if (!clusters.empty()) {
+    clusters.pop_back();
+  }
+  clusters.insert(clusters.begin(), 0);
+
+  elements = std::move(result);
+  return clusters;
+}
+
+void optimize_overdraw(std::vector<gl::Element> &elements,
+                       const std::vector<gl::Vertex> &vertices,
+                       const std::vector<size_t> &clusters,
+                       const double threshold) {
+  if (elements.empty()) {
+    return;
+  }
+  const auto boundaries =
+      split_clusters(elements, clusters, vertices.size(), threshold);
+
+  auto position = [&vertices](uint32_t vertex) {
+    return glm::dvec3(vertices[vertex].coord);
+  };
+
+  // Area weighted centroid and normal of every cluster
+  struct Cluster {
+    glm::dvec3 centroid = glm::dvec3(0.0);
+    glm::dvec3 normal = glm::dvec3(0.0);
+    double area = 0.0;
+  };
+  std::vector<Cluster> data(boundaries.size());
+  glm::dvec3 mesh_centroid(0.0);
+  double mesh_area = 0.0;
+  // Negative if the winding makes normals point into the mesh
+  double volume = 0.0;
+
+  for (size_t index = 0; index != boundaries.size(); ++index) {
+    const size_t last = index + 1 != boundaries.size() ? boundaries[index + 1]
+                                                       : elements.size();
+    auto &cluster = data[index];
+    for (size_t i = boundaries[index]; i != last; ++i) {
+      const auto &v = elements[i].vertices;
+      const auto a = position(v[0]);
+      const auto b = position(v[1]);
+      const auto c = position(v[2]);
+      const auto normal = glm::cross(b - a, c - a);
+      const auto area = glm::length(normal);
+      cluster.centroid += (a + b + c) / 3.0 * area;
+      cluster.normal += normal;
+      cluster.area += area;
+      volume += glm::dot(a, glm::cross(b, c));
+    }
+    mesh_centroid += cluster.centroid;
+    mesh_area += cluster.area;
+  }
+  if (mesh_area > 0.0) {
+    mesh_centroid /= mesh_area;
+  }
+  const double orientation = volume < 0.0 ? -1.0 : 1.0;
+
+  std::vector<double> keys(data.size(), 0.0);
+  for (size_t index = 0; index != data.size(); ++index) {
+    const auto &cluster = data[index];
+    const auto normal_length = glm::length(cluster.normal);
+    if (cluster.area > 0.0 && normal_length > 0.0) {
+      const auto centroid = cluster.centroid / cluster.area;
+      keys[index] = orientation * glm::dot(centroid - mesh_centroid,
+                                       cluster.normal / normal_length);
+    }
+  }
+
+  std::vector<size_t> order(data.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&keys](size_t lhs, size_t rhs) {
+                     return keys[lhs] > keys[rhs];
+                   });
+
+  std::vector<gl::Element> result;
+  result.reserve(elements.size());
+  for (const auto index : order) {
+    const size_t last = index + 1 != boundaries.size() ? boundaries[index + 1]
+                                                       : elements.size();
+    result.insert(result.end(),
+                  elements.begin() +
+                      static_cast<std::ptrdiff_t>(boundaries[index]),
+                  elements.begin() + static_cast<std::ptrdiff_t>(last));
+  }
+  elements = std::move(result);
+}
+
+void optimize_vertex_fetch(std::vector<gl::Element> &elements,
+                           std::vector<gl::Vertex> &vertices) {
+  constexpr uint32_t unused = std::numeric_limits<uint32_t>::max();
+  std::vector<uint32_t> remap(vertices.size(), unused);
+  std::vector<gl::Vertex> result;
+  result.reserve(vertices.size());
+
+  for (auto &element : elements) {
+    for (auto &vertex : element.vertices) {
+      if (remap[vertex] == unused) {
+        remap[vertex] = static_cast<uint32_t>(result.size());
+        result.push_back(vertices[vertex]);
+      }
+      vertex = remap[vertex];
+    }
+  }
+  vertices = std::move(result);
+}
+
+void optimize(MeshData &mesh) {
+  Timer timer("Optimizing mesh took ");
+  for (const auto &element : mesh.elements) {
+    for (const auto vertex : element.vertices) {
+      if (vertex >= mesh.vertices.size()) {
+        throw std::runtime_error("Element references a missing vertex!");
+      }
+    }
+  }
+
+  const auto before =
+      analyze_vertex_cache(mesh.elements, mesh.vertices.size());
+  const auto clusters =
+      optimize_vertex_cache(mesh.elements, mesh.vertices.size());
+  optimize_overdraw(mesh.elements, mesh.vertices, clusters);
+  optimize_vertex_fetch(mesh.elements, mesh.vertices);
+  const auto after = analyze_vertex_cache(mesh.elements, mesh.vertices.size());
+
+  std::cout << "Vertex cache: ACMR " << before.acmr << " -> " << after.acmr
+            << ", ATVR " << before.atvr << " -> " << after.atvr << '\n';
+}
+
+} // namespace mesh
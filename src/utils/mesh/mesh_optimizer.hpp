@@ -0,0 +1,51 @@
+#pragma once
+
+#include "utils/mesh/mesh_data.hpp"
+#include "utils/primitives.hpp"
+#include <cstddef>
+#include <vector>
+
+namespace mesh {
+
+// Size of the simulated post-transform cache. Recent GPUs don't use a FIFO
+// cache anymore, but the orderings that do well on one still batch better.
+constexpr size_t vertex_cache_size = 16;
+
+struct VertexCacheStats {
+  // Average cache miss ratio: transformed vertices per triangle
+  double acmr = 0.0;
+  // Average transform to vertex ratio: transformed vertices per vertex
+  double atvr = 0.0;
+};
+
+// Simulates a FIFO post-transform cache of `cache_size` entries
+auto analyze_vertex_cache(const std::vector<gl::Element> &elements,
+                          size_t vertex_count,
+                          size_t cache_size = vertex_cache_size)
+    -> VertexCacheStats;
+
+// Reorders triangles for the post-transform cache with Tipsify (Sander et
+// al. 2007). Returns the index of the first triangle of every cluster the
+// walk had to restart at, which `optimize_overdraw` sorts.
+auto optimize_vertex_cache(std::vector<gl::Element> &elements,
+                           size_t vertex_count,
+                           size_t cache_size = vertex_cache_size)
+    -> std::vector<size_t>;
+
+// Splits the clusters further where that costs at most `threshold` times
+// their ACMR, then draws outward facing clusters first so they occlude the
+// rest of the mesh.
+void optimize_overdraw(std::vector<gl::Element> &elements,
+                       const std::vector<gl::Vertex> &vertices,
+                       const std::vector<size_t> &clusters,
+                       double threshold = 1.05);
+
+// Renumbers vertices in the order triangles first use them, so fetches walk
+// the vertex buffer forwards. Unreferenced vertices are dropped.
+void optimize_vertex_fetch(std::vector<gl::Element> &elements,
+                           std::vector<gl::Vertex> &vertices);
+
+// Runs all of the above on a loaded mesh and reports the cache statistics
+void optimize(MeshData &mesh);
+
+} // namespace mesh
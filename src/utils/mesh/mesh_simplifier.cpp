@@ -0,0 +1,600 @@
+#include "utils/mesh/mesh_simplifier.hpp"
+
+#include "utils/mesh/mesh_optimizer.hpp"
+#include "utils/timer.hpp"
+#include "utils/vertex_format.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <tuple>
+#include <vector>
+
+namespace mesh {
+
+namespace {
+
+// Coarser levels than this aren't worth drawing
+constexpr size_t min_lod_triangles = 64;
+// Every level aims for this share of the triangles of the one before
+constexpr double lod_reduction = 0.5;
+// and is dropped if it doesn't get below this share
+constexpr double min_lod_reduction = 0.8;
+// Error budget of the coarsest level, relative to the bounding radius
+constexpr float max_lod_error = 0.1F;
+// Weight of the planes that hold seams and borders in place, relative to
+// the faces next to them
+constexpr double boundary_weight = 10.0;
+// A pass removing fewer than this share of the triangles ends the
+// simplification, the next ones would hardly do better
+constexpr double min_pass_reduction = 0.01;
+
+// Sum of squared distances to a set of weighted planes, as the symmetric
+// matrix of Garland and Heckbert
+struct Quadric {
+  // xx, xy, xz, xw, yy, yz, yw, zz, zw, ww
+  std::array<double, 10> terms{};
+  double weight = 0.0;
+
+  void add_plane(const glm::vec3 &normal, double distance,
+                 double plane_weight) {
+    const std::array<double, 4> plane = {normal.x, normal.y, normal.z,
+                                         distance};
+    size_t term = 0;
+    for (size_t row = 0; row != 4; ++row) {
+      for (size_t column = row; column != 4; ++column) {
+        terms.at(term++) += plane_weight * plane.at(row) * plane.at(column);
+      }
+    }
+    weight += plane_weight;
+  }
+
+  void add(const Quadric &other) {
+    for (size_t term = 0; term != terms.size(); ++term) {
+      terms.at(term) += other.terms.at(term);
+    }
+    weight += other.weight;
+  }
+
+  // Mean squared distance of `point` to the planes
+  [[nodiscard]] auto error(const glm::vec3 &point) const -> double {
+    if (weight <= 0.0) {
+      return 0.0;
+    }
+    const std::array<double, 4> v = {point.x, point.y, point.z, 1.0};
+    double sum = 0.0;
+    size_t term = 0;
+    for (size_t row = 0; row != 4; ++row) {
+      for (size_t column = row; column != 4; ++column) {
+        const double factor = row == column ? 1.0 : 2.0;
+        sum += factor * terms.at(term++) * v.at(row) * v.at(column);
+      }
+    }
+    return std::max(sum, 0.0) / weight;
+  }
+};
+
+auto edge_key(uint32_t from, uint32_t to) -> uint64_t {
+  constexpr unsigned shift = 32;
+  return static_cast<uint64_t>(from) << shift | to;
+}
+
+auto undirected_key(uint32_t a, uint32_t b) -> uint64_t {
+  return edge_key(std::min(a, b), std::max(a, b));
+}
+
+auto face_normal(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c)
+    -> glm::vec3 {
+  return glm::cross(b - a, c - a);
+}
+
+auto position_of(const gl::Vertex &vertex) {
+  const auto &p = vertex.coord;
+  return std::tie(p.x, p.y, p.z);
+}
+
+auto attributes_of(const gl::Vertex &vertex) {
+  const auto &p = vertex.coord;
+  const auto &uv = vertex.uv;
+  const auto &color = vertex.color;
+  return std::tie(p.x, p.y, p.z, uv.x, uv.y, color.r, color.g, color.b);
+}
+
+// Both map every vertex to the lowest index of a group of vertices
+struct Welds {
+  // Vertices at the same position, so the copies along a uv seam count as
+  // one point of the surface
+  std::vector<uint32_t> position;
+  // Vertices that are the same in every attribute, which files that repeat
+  // the shared corners of their objects are full of. Their triangles are
+  // connected, not separated by a seam.
+  std::vector<uint32_t> wedge;
+};
+
+auto weld(const std::vector<gl::Vertex> &vertices) -> Welds {
+  std::vector<uint32_t> order(vertices.size());
+  std::iota(order.begin(), order.end(), 0U);
+  std::sort(order.begin(), order.end(), [&vertices](uint32_t a, uint32_t b) {
+    return std::tuple_cat(attributes_of(vertices[a]), std::tie(a)) <
+           std::tuple_cat(attributes_of(vertices[b]), std::tie(b));
+  });
+  Welds welds{std::vector<uint32_t>(vertices.size()),
+              std::vector<uint32_t>(vertices.size())};
+  for (size_t i = 0; i != order.size(); ++i) {
+    const auto vertex = order[i];
+    const auto previous = i != 0 ? order[i - 1] : vertex;
+    welds.position[vertex] =
+        i != 0 && position_of(vertices[previous]) == position_of(vertices[vertex])
+            ? welds.position[previous]
+            : vertex;
+    welds.wedge[vertex] = i != 0 && attributes_of(vertices[previous]) ==
+                                        attributes_of(vertices[vertex])
+                              ? welds.wedge[previous]
+                              : vertex;
+  }
+  return welds;
+}
+
+// Fallback for what edge collapses can't reduce, like small parts of a few
+// triangles that would fold over before losing any: drops whole disconnected
+// parts, smallest first, while their bounding radius is below `max_error`
+// and more than `target_count` triangles are left. Returns the radius of the
+// largest part dropped.
+auto remove_small_parts(std::vector<gl::Element> &triangles,
+                        const std::vector<gl::Vertex> &vertices,
+                        const std::vector<uint32_t> &position,
+                        const size_t target_count, const float max_error)
+    -> float {
+  std::vector<uint32_t> parent(vertices.size());
+  std::iota(parent.begin(), parent.end(), 0U);
+  auto root = [&parent](uint32_t vertex) {
+    while (parent[vertex] != vertex) {
+      parent[vertex] = parent[parent[vertex]];
+      vertex = parent[vertex];
+    }
+    return vertex;
+  };
+  for (const auto &triangle : triangles) {
+    for (size_t corner = 1; corner != 3; ++corner) {
+      const auto a = root(position[triangle.vertices[0]]);
+      const auto b = root(position[triangle.vertices.at(corner)]);
+      parent[std::max(a, b)] = std::min(a, b);
+    }
+  }
+
+  struct Part {
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+    size_t triangle_count = 0;
+  };
+  std::vector<Part> parts(vertices.size());
+  for (const auto &triangle : triangles) {
+    auto &part = parts[root(position[triangle.vertices[0]])];
+    for (const auto vertex : triangle.vertices) {
+      part.min = glm::min(part.min, vertices[vertex].coord);
+      part.max = glm::max(part.max, vertices[vertex].coord);
+    }
+    ++part.triangle_count;
+  }
+  std::vector<std::pair<float, uint32_t>> small_parts;
+  for (uint32_t part = 0; part != parts.size(); ++part) {
+    if (parts[part].triangle_count == 0) {
+      continue;
+    }
+    const float radius = 0.5F * glm::length(parts[part].max - parts[part].min);
+    if (radius <= max_error) {
+      small_parts.emplace_back(radius, part);
+    }
+  }
+  std::sort(small_parts.begin(), small_parts.end());
+
+  std::vector<bool> removed(vertices.size(), false);
+  size_t triangles_left = triangles.size();
+  float error = 0.0F;
+  for (const auto &[radius, part] : small_parts) {
+    const auto count = parts[part].triangle_count;
+    // The last part stays, however small
+    if (triangles_left <= target_count || count == triangles_left) {
+      break;
+    }
+    removed[part] = true;
+    triangles_left -= count;
+    error = radius;
+  }
+  triangles.erase(std::remove_if(triangles.begin(), triangles.end(),
+                                 [&](const gl::Element &triangle) {
+                                   return removed[root(
+                                       position[triangle.vertices[0]])];
+                                 }),
+                  triangles.end());
+  return error;
+}
+
+struct Collapse {
+  uint32_t from;
+  uint32_t to;
+  double cost;
+};
+
+// An edge of a triangle, by its ends in either order
+struct EdgeRef {
+  uint64_t key;
+  // 1 if it runs from the lower end to the higher one, 2 otherwise
+  uint8_t direction;
+  // Key of the welded positions of its ends
+  uint64_t position_key;
+};
+
+// Seams and borders of the current triangles, by welded position. Sorted
+// arrays instead of hash sets, as they are rebuilt on every pass.
+struct Boundaries {
+  // Undirected keys, sorted
+  std::vector<uint64_t> edges;
+  // Boundary edges meeting at every position, and the other ends of the
+  // first two
+  std::vector<uint8_t> counts;
+  std::vector<std::array<uint32_t, 2>> neighbors;
+
+  void find(const std::vector<gl::Element> &triangles,
+            const std::vector<uint32_t> &position) {
+    vertex_edges_.clear();
+    position_edges_.clear();
+    for (const auto &triangle : triangles) {
+      for (size_t corner = 0; corner != 3; ++corner) {
+        const auto a = triangle.vertices.at(corner);
+        const auto b = triangle.vertices.at((corner + 1) % 3);
+        const auto key = undirected_key(position[a], position[b]);
+        vertex_edges_.push_back(
+            {undirected_key(a, b), static_cast<uint8_t>(a < b ? 1 : 2), key});
+        position_edges_.push_back(
+            {key, static_cast<uint8_t>(position[a] < position[b] ? 1 : 2),
+             key});
+      }
+    }
+
+    // An edge without a twin in the opposite direction is a border if no
+    // triangle shares its positions either, otherwise a seam
+    edges.clear();
+    add_open(vertex_edges_);
+    add_open(position_edges_);
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    constexpr unsigned shift = 32;
+    counts.assign(position.size(), 0);
+    neighbors.resize(position.size());
+    for (const auto edge : edges) {
+      const auto low = static_cast<uint32_t>(edge >> shift);
+      const auto high = static_cast<uint32_t>(edge);
+      for (const auto &[end, other] : {std::pair(low, high),
+                                       std::pair(high, low)}) {
+        if (counts[end] < 2) {
+          neighbors[end].at(counts[end]) = other;
+        }
+        counts[end] = static_cast<uint8_t>(std::min(counts[end] + 1, 3));
+      }
+    }
+  }
+
+  [[nodiscard]] auto is_boundary(uint32_t a, uint32_t b) const -> bool {
+    return std::binary_search(edges.begin(), edges.end(),
+                              undirected_key(a, b));
+  }
+
+  // Positions where seams or borders branch or end have to stay put, the
+  // others on one may only slide along it
+  [[nodiscard]] auto can_collapse(uint32_t from, uint32_t to) const -> bool {
+    return counts[from] == 0 ||
+           (counts[from] == 2 &&
+            (neighbors[from][0] == to || neighbors[from][1] == to));
+  }
+
+private:
+  // Adds the position keys of edges that run only one way
+  void add_open(std::vector<EdgeRef> &refs) {
+    std::sort(refs.begin(), refs.end(),
+              [](const EdgeRef &a, const EdgeRef &b) { return a.key < b.key; });
+    for (auto group = refs.begin(); group != refs.end();) {
+      auto end = group;
+      unsigned directions = 0;
+      for (; end != refs.end() && end->key == group->key; ++end) {
+        directions |= end->direction;
+      }
+      if (directions != 3) {
+        for (auto it = group; it != end; ++it) {
+          edges.push_back(it->position_key);
+        }
+      }
+      group = end;
+    }
+  }
+
+  // Kept to reuse their memory
+  std::vector<EdgeRef> vertex_edges_;
+  std::vector<EdgeRef> position_edges_;
+};
+
+} // namespace
+
+auto simplify(const std::vector<gl::Element> &elements,
+              const std::vector<gl::Vertex> &vertices,
+              const size_t target_count, const float max_error) -> Lod {
+  const auto welds = weld(vertices);
+  const auto &position = welds.position;
+  auto coord = [&vertices](uint32_t vertex) -> const glm::vec3 & {
+    return vertices[vertex].coord;
+  };
+  auto triangles = elements;
+  for (auto &triangle : triangles) {
+    for (auto &vertex : triangle.vertices) {
+      vertex = welds.wedge[vertex];
+    }
+  }
+
+  // The faces around every position, plus planes through seams and borders
+  // standing on their faces, which keep them from drifting sideways
+  Boundaries boundaries;
+  boundaries.find(triangles, position);
+  std::vector<Quadric> quadrics(vertices.size());
+  for (const auto &triangle : triangles) {
+    const auto &[a, b, c] = triangle.vertices;
+    const auto normal = face_normal(coord(a), coord(b), coord(c));
+    const float length = glm::length(normal);
+    if (!(length > 0.0F)) {
+      continue;
+    }
+    const auto unit = normal / length;
+    for (const auto vertex : triangle.vertices) {
+      quadrics[position[vertex]].add_plane(unit, -glm::dot(unit, coord(a)),
+                                           0.5 * length);
+    }
+    for (size_t corner = 0; corner != 3; ++corner) {
+      const auto from = triangle.vertices.at(corner);
+      const auto to = triangle.vertices.at((corner + 1) % 3);
+      if (!boundaries.is_boundary(position[from], position[to])) {
+        continue;
+      }
+      const auto edge = coord(to) - coord(from);
+      const auto side = glm::cross(edge, unit);
+      const float side_length = glm::length(side);
+      if (!(side_length > 0.0F)) {
+        continue;
+      }
+      const auto side_unit = side / side_length;
+      const double weight = boundary_weight * glm::dot(edge, edge);
+      quadrics[position[from]].add_plane(
+          side_unit, -glm::dot(side_unit, coord(from)), weight);
+      quadrics[position[to]].add_plane(
+          side_unit, -glm::dot(side_unit, coord(from)), weight);
+    }
+  }
+
+  const double max_cost = static_cast<double>(max_error) * max_error;
+  double largest_cost = 0.0;
+  std::vector<Collapse> best;
+  std::vector<Collapse> collapses;
+  std::vector<uint32_t> adjacency_offsets;
+  std::vector<uint32_t> adjacency;
+  std::vector<uint32_t> remap(vertices.size());
+  std::vector<bool> locked;
+  std::vector<std::pair<uint32_t, uint32_t>> wedges;
+  // Every pass collapses a set of edges far enough apart not to affect each
+  // other, then drops the triangles that became degenerate
+  while (triangles.size() > target_count) {
+    // Only the cheapest collapse of every position, the others would be
+    // locked out by it anyway
+    best.resize(vertices.size());
+    for (uint32_t vertex = 0; vertex != best.size(); ++vertex) {
+      best[vertex] = {vertex, vertex, max_cost};
+    }
+    for (const auto &triangle : triangles) {
+      for (size_t corner = 0; corner != 3; ++corner) {
+        const auto a = position[triangle.vertices.at(corner)];
+        const auto b = position[triangle.vertices.at((corner + 1) % 3)];
+        // Either way the collapsed vertex carries both quadrics
+        auto quadric = quadrics[a];
+        quadric.add(quadrics[b]);
+        for (const auto &[from, to] : {std::pair(a, b), std::pair(b, a)}) {
+          if (!boundaries.can_collapse(from, to)) {
+            continue;
+          }
+          const double cost = quadric.error(coord(to));
+          if (cost <= best[from].cost) {
+            best[from] = {from, to, cost};
+          }
+        }
+      }
+    }
+    collapses.clear();
+    for (const auto &collapse : best) {
+      if (collapse.from != collapse.to) {
+        collapses.push_back(collapse);
+      }
+    }
+    if (collapses.empty()) {
+      break;
+    }
+    std::sort(collapses.begin(), collapses.end(),
+              [](const Collapse &a, const Collapse &b) {
+                return a.cost < b.cost;
+              });
+
+    // Triangles around every position
+    adjacency_offsets.assign(vertices.size() + 1, 0);
+    for (const auto &triangle : triangles) {
+      for (const auto vertex : triangle.vertices) {
+        ++adjacency_offsets[position[vertex] + 1];
+      }
+    }
+    std::partial_sum(adjacency_offsets.begin(), adjacency_offsets.end(),
+                     adjacency_offsets.begin());
+    adjacency.resize(triangles.size() * 3);
+    {
+      auto next = adjacency_offsets;
+      for (size_t t = 0; t != triangles.size(); ++t) {
+        for (const auto vertex : triangles[t].vertices) {
+          adjacency[next[position[vertex]]++] = static_cast<uint32_t>(t);
+        }
+      }
+    }
+
+    std::iota(remap.begin(), remap.end(), 0U);
+    locked.assign(vertices.size(), false);
+    size_t triangles_left = triangles.size();
+    bool collapsed = false;
+    for (const auto &collapse : collapses) {
+      if (triangles_left <= target_count) {
+        break;
+      }
+      if (locked[collapse.from] || locked[collapse.to]) {
+        continue;
+      }
+      const auto begin = adjacency.begin() + adjacency_offsets[collapse.from];
+      const auto end = adjacency.begin() + adjacency_offsets[collapse.from + 1];
+
+      // Triangles on the edge vanish and tell which copy of `from` becomes
+      // which copy of `to`. The others must not flip over.
+      bool valid = true;
+      size_t removed = 0;
+      wedges.clear();
+      for (auto it = begin; it != end && valid; ++it) {
+        const auto &vertex_ids = triangles[*it].vertices;
+        size_t from_corner = 0;
+        size_t to_corner = 3;
+        for (size_t corner = 0; corner != 3; ++corner) {
+          if (position[vertex_ids.at(corner)] == collapse.from) {
+            from_corner = corner;
+          } else if (position[vertex_ids.at(corner)] == collapse.to) {
+            to_corner = corner;
+          }
+        }
+        if (to_corner != 3) {
+          wedges.emplace_back(vertex_ids.at(from_corner),
+                              vertex_ids.at(to_corner));
+          ++removed;
+          continue;
+        }
+        std::array<glm::vec3, 3> corners = {
+            coord(vertex_ids[0]), coord(vertex_ids[1]), coord(vertex_ids[2])};
+        const auto before = face_normal(corners[0], corners[1], corners[2]);
+        corners.at(from_corner) = coord(collapse.to);
+        const auto after = face_normal(corners[0], corners[1], corners[2]);
+        valid = glm::dot(before, after) > 0.0F;
+      }
+      // Every copy of `from` needs a copy of `to` on its side of a seam
+      for (auto it = begin; it != end && valid; ++it) {
+        for (const auto vertex : triangles[*it].vertices) {
+          if (position[vertex] != collapse.from) {
+            continue;
+          }
+          const auto match = std::find_if(
+              wedges.begin(), wedges.end(),
+              [vertex](const auto &wedge) { return wedge.first == vertex; });
+          valid = match != wedges.end() &&
+                  std::all_of(wedges.begin(), wedges.end(),
+                              [&match](const auto &wedge) {
+                                return wedge.first != match->first ||
+                                       wedge.second == match->second;
+                              });
+        }
+      }
+      if (!valid) {
+        continue;
+      }
+
+      for (const auto &[from, to] : wedges) {
+        remap[from] = to;
+      }
+      quadrics[collapse.to].add(quadrics[collapse.from]);
+      // Nothing else this pass may touch the triangles that changed
+      for (auto it = begin; it != end; ++it) {
+        for (const auto vertex : triangles[*it].vertices) {
+          locked[position[vertex]] = true;
+        }
+      }
+      locked[collapse.to] = true;
+      triangles_left -= std::min(removed, triangles_left);
+      largest_cost = std::max(largest_cost, collapse.cost);
+      collapsed = true;
+    }
+    if (!collapsed) {
+      break;
+    }
+
+    auto kept = triangles.begin();
+    for (const auto &triangle : triangles) {
+      gl::Element remapped;
+      for (size_t corner = 0; corner != 3; ++corner) {
+        remapped.vertices.at(corner) = remap[triangle.vertices.at(corner)];
+      }
+      const auto a = position[remapped.vertices[0]];
+      const auto b = position[remapped.vertices[1]];
+      const auto c = position[remapped.vertices[2]];
+      if (a != b && b != c && c != a) {
+        *kept++ = remapped;
+      }
+    }
+    const auto before = static_cast<double>(triangles.size());
+    triangles.erase(kept, triangles.end());
+    if (static_cast<double>(triangles.size()) >
+        before * (1.0 - min_pass_reduction)) {
+      break;
+    }
+    boundaries.find(triangles, position);
+  }
+
+  auto error = static_cast<float>(std::sqrt(largest_cost));
+  if (triangles.size() > target_count) {
+    error = std::max(error, remove_small_parts(triangles, vertices, position,
+                                               target_count, max_error));
+  }
+  return {std::move(triangles), error};
+}
+
+void build_lods(MeshData &mesh) {
+  mesh.lods.clear();
+  if (mesh.elements.size() < 2 * min_lod_triangles) {
+    return;
+  }
+  Timer timer("Building levels of detail took ");
+
+  auto min = glm::vec3(std::numeric_limits<float>::max());
+  auto max = glm::vec3(std::numeric_limits<float>::lowest());
+  for (const auto &vertex : mesh.vertices) {
+    min = glm::min(min, vertex.coord);
+    max = glm::max(max, vertex.coord);
+  }
+  const float error_budget = max_lod_error * 0.5F * glm::length(max - min);
+
+  // Every level simplifies the one before, so its error adds up
+  mesh.lods.reserve(gl::max_lod_levels - 1);
+  const auto *previous = &mesh.elements;
+  float previous_error = 0.0F;
+  std::cout << "Levels of detail: " << previous->size();
+  while (mesh.lods.size() + 1 < gl::max_lod_levels) {
+    const auto count = previous->size();
+    const auto target =
+        static_cast<size_t>(static_cast<double>(count) * lod_reduction);
+    if (target < min_lod_triangles || !(error_budget > previous_error)) {
+      break;
+    }
+    auto lod = simplify(*previous, mesh.vertices, target,
+                        error_budget - previous_error);
+    if (static_cast<double>(lod.elements.size()) >
+        static_cast<double>(count) * min_lod_reduction) {
+      break;
+    }
+    lod.error += previous_error;
+    optimize_vertex_cache(lod.elements, mesh.vertices.size());
+    previous_error = lod.error;
+    mesh.lods.push_back(std::move(lod));
+    previous = &mesh.lods.back().elements;
+    std::cout << " -> " << previous->size();
+  }
+  std::cout << " triangles\n";
+}
+
+} // namespace mesh
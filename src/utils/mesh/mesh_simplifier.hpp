@@ -0,0 +1,26 @@
+#pragma once
+
+#include "utils/mesh/mesh_data.hpp"
+#include "utils/primitives.hpp"
+#include <cstddef>
+#include <vector>
+
+namespace mesh {
+
+// Collapses edges of the mesh in order of their quadric error (Garland and
+// Heckbert 1997) until at most `target_count` triangles are left or the next
+// collapse would move the surface by more than `max_error`. Vertices only
+// collapse onto other vertices, so the result indexes the same vertex array.
+// Vertices on uv seams and open borders only slide along them, copies of a
+// vertex that match it in every attribute don't form a seam. Small
+// disconnected parts the collapses leave over `target_count` are dropped
+// whole if they are within `max_error`.
+auto simplify(const std::vector<gl::Element> &elements,
+              const std::vector<gl::Vertex> &vertices, size_t target_count,
+              float max_error) -> Lod;
+
+// Replaces `mesh.lods` with coarser versions of the mesh, each with about
+// half the triangles of the one before, ordered for the vertex cache
+void build_lods(MeshData &mesh);
+
+} // namespace mesh
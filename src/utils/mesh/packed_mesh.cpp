@@ -0,0 +1,183 @@
+#include "utils/mesh/packed_mesh.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <glm/gtc/packing.hpp>
+#include <iostream>
+#include <limits>
+#include <type_traits>
+
+namespace mesh {
+
+namespace {
+
+template <typename T>
+auto to_bytes(const std::vector<T> &values) -> std::vector<std::byte> {
+  std::vector<std::byte> bytes(values.size() * sizeof(T));
+  std::memcpy(bytes.data(), values.data(), bytes.size());
+  return bytes;
+}
+
+// Stores every level of detail in one buffer, the full mesh first
+auto pack_indices(const MeshData &mesh, gl::MeshLayout &layout)
+    -> std::vector<std::byte> {
+  std::vector<gl::Element> elements = mesh.elements;
+  layout.lods[0] = {0, elements.size() * 3, 0.0F};
+  layout.lod_count = 1;
+  for (const auto &lod : mesh.lods) {
+    if (layout.lod_count == gl::max_lod_levels) {
+      break;
+    }
+    layout.lods.at(layout.lod_count++) = {elements.size() * 3,
+                                          lod.elements.size() * 3, lod.error};
+    elements.insert(elements.end(), lod.elements.begin(), lod.elements.end());
+  }
+
+  layout.index_count = elements.size() * 3;
+  if (mesh.vertices.size() > std::numeric_limits<uint16_t>::max() + size_t{1}) {
+    layout.index_type = GL_UNSIGNED_INT;
+    return to_bytes(elements);
+  }
+
+  layout.index_type = GL_UNSIGNED_SHORT;
+  std::vector<uint16_t> indices;
+  indices.reserve(layout.index_count);
+  for (const auto &element : elements) {
+    for (const auto vertex : element.vertices) {
+      indices.push_back(static_cast<uint16_t>(vertex));
+    }
+  }
+  return to_bytes(indices);
+}
+
+auto same_color(const std::vector<gl::Vertex> &vertices) -> bool {
+  return std::all_of(vertices.begin(), vertices.end(),
+                     [&vertices](const gl::Vertex &vertex) {
+                       return vertex.color == vertices.front().color;
+                     });
+}
+
+auto to_unorm8(float value) -> uint8_t {
+  constexpr float max = std::numeric_limits<uint8_t>::max();
+  return static_cast<uint8_t>(std::lround(std::clamp(value, 0.0F, 1.0F) * max));
+}
+
+void compute_bounds(const std::vector<gl::Vertex> &vertices,
+                    gl::MeshLayout &layout) {
+  auto min = glm::vec3(std::numeric_limits<float>::max());
+  auto max = glm::vec3(std::numeric_limits<float>::lowest());
+  for (const auto &vertex : vertices) {
+    min = glm::min(min, vertex.coord);
+    max = glm::max(max, vertex.coord);
+  }
+  layout.bounds_min = min;
+  layout.bounds_max = max;
+
+  // Centered on the box, which is never far from the smallest sphere and
+  // needs just one more pass
+  const auto center = (min + max) * 0.5F;
+  float radius2 = 0.0F;
+  for (const auto &vertex : vertices) {
+    const auto offset = vertex.coord - center;
+    radius2 = std::max(radius2, glm::dot(offset, offset));
+  }
+  layout.sphere_center = center;
+  layout.sphere_radius = std::sqrt(radius2);
+}
+
+// Quantizes positions to the bounds of the mesh and records the transform
+// that maps them back
+template <typename CompactVertex>
+auto pack_compact(const std::vector<gl::Vertex> &vertices,
+                  gl::MeshLayout &layout) -> std::vector<CompactVertex> {
+  const auto min = layout.bounds_min;
+  auto extent = layout.bounds_max - min;
+  // Flat meshes would divide by zero along their flat axis
+  for (int axis = 0; axis != 3; ++axis) {
+    if (!(extent[axis] > 0.0F)) {
+      extent[axis] = 1.0F;
+    }
+  }
+  layout.position_scale = extent;
+  layout.position_offset = min;
+
+  constexpr float max_unorm16 = std::numeric_limits<uint16_t>::max();
+  std::vector<CompactVertex> result(vertices.size());
+  for (size_t i = 0; i != vertices.size(); ++i) {
+    const auto &vertex = vertices[i];
+    auto &packed = result[i];
+    const auto normalized = (vertex.coord - min) / extent;
+    for (int axis = 0; axis != 3; ++axis) {
+      packed.coord.at(axis) = static_cast<uint16_t>(std::lround(
+          std::clamp(normalized[axis], 0.0F, 1.0F) * max_unorm16));
+    }
+    packed.padding = 0;
+    packed.uv = {glm::packHalf1x16(vertex.uv.x),
+                 glm::packHalf1x16(vertex.uv.y)};
+    if constexpr (std::is_same_v<CompactVertex, gl::CompactColorVertex>) {
+      packed.color = {to_unorm8(vertex.color.r), to_unorm8(vertex.color.g),
+                      to_unorm8(vertex.color.b),
+                      std::numeric_limits<uint8_t>::max()};
+    }
+  }
+  return result;
+}
+
+auto mapped(const FileView &file, const PackedMesh::Section &section)
+    -> ByteView {
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  const auto *bytes = reinterpret_cast<const std::byte *>(file.data());
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  return {bytes + section.offset, section.size};
+}
+
+} // namespace
+
+auto PackedMesh::vertex_data() const -> ByteView {
+  return file.data() == nullptr ? ByteView{vertices.data(), vertices.size()}
+                                : mapped(file, vertex_section);
+}
+
+auto PackedMesh::index_data() const -> ByteView {
+  return file.data() == nullptr ? ByteView{indices.data(), indices.size()}
+                                : mapped(file, index_section);
+}
+
+auto pack(const MeshData &mesh, const vertex_format_enum format)
+    -> PackedMesh {
+  PackedMesh result;
+  result.texture_path = mesh.texture_path;
+  result.indices = pack_indices(mesh, result.layout);
+  if (!mesh.vertices.empty()) {
+    compute_bounds(mesh.vertices, result.layout);
+  }
+
+  if (format == vertex_format_enum::VERTEX_FULL || mesh.vertices.empty()) {
+    result.vertices = to_bytes(mesh.vertices);
+  } else if (same_color(mesh.vertices)) {
+    result.layout.set_attributes = &gl::set_attributes<gl::CompactVertex>;
+    result.layout.vertex_size = sizeof(gl::CompactVertex);
+    result.layout.material_color = mesh.vertices.front().color;
+    result.vertices = to_bytes(
+        pack_compact<gl::CompactVertex>(mesh.vertices, result.layout));
+  } else {
+    result.layout.set_attributes = &gl::set_attributes<gl::CompactColorVertex>;
+    result.layout.vertex_size = sizeof(gl::CompactColorVertex);
+    result.vertices = to_bytes(
+        pack_compact<gl::CompactColorVertex>(mesh.vertices, result.layout));
+  }
+
+  auto before = mesh.vertices.size() * sizeof(gl::Vertex) +
+                mesh.elements.size() * sizeof(gl::Element);
+  for (const auto &lod : mesh.lods) {
+    before += lod.elements.size() * sizeof(gl::Element);
+  }
+  const auto after = result.vertices.size() + result.indices.size();
+  std::cout << "Packed mesh: " << before << " bytes of vertices and indices "
+            << "stored in " << after << " bytes.\n";
+  return result;
+}
+
+} // namespace mesh
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "utils/io.hpp"
+#include "utils/mesh/mesh_data.hpp"
+#include "utils/vertex_format.hpp"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace mesh {
+
+enum struct vertex_format_enum { VERTEX_FULL, VERTEX_COMPACT };
+
+// Read-only bytes, wherever they are stored
+struct ByteView {
+  const std::byte *data = nullptr;
+  size_t size = 0;
+};
+
+// Vertex and index data in the exact format it is uploaded with
+struct PackedMesh {
+  // The vectors below, or the sections of `file` if it is mapped
+  [[nodiscard]] auto vertex_data() const -> ByteView;
+  [[nodiscard]] auto index_data() const -> ByteView;
+
+  std::vector<std::byte> vertices;
+  std::vector<std::byte> indices;
+  gl::MeshLayout layout;
+  std::string texture_path;
+
+  // A baked mesh keeps its cache file mapped and is uploaded from there, the
+  // vectors stay empty
+  struct Section {
+    size_t offset = 0;
+    size_t size = 0;
+  };
+  FileView file;
+  Section vertex_section;
+  Section index_section;
+};
+
+// Converts `mesh` to `format`. The compact format quantizes positions to 16
+// bits inside the mesh bounds and stores uvs as half floats. It drops the
+// per-vertex color if every vertex has the same one. Indices are 16 bits
+// wide whenever the vertex count allows it, regardless of the format.
+auto pack(const MeshData &mesh, vertex_format_enum format) -> PackedMesh;
+
+} // namespace mesh
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "utils/mesh/mesh_data.hpp"
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace mesh {
+
+constexpr uint32_t no_parent = std::numeric_limits<uint32_t>::max();
+
+// A node of the hierarchy in a model file
+struct SceneNode {
+  std::string name;
+  // Relative to the parent
+  glm::mat4 transform = glm::mat4(1.0F);
+  // Index in `SceneData::nodes`, parents come before their children
+  uint32_t parent = no_parent;
+  // Indices in `SceneData::meshes` drawn at this node
+  std::vector<uint32_t> meshes;
+};
+
+// A model file with its hierarchy, every mesh stored once no matter how many
+// nodes draw it
+struct SceneData {
+  std::vector<MeshData> meshes;
+  std::vector<std::string> mesh_names;
+  std::vector<SceneNode> nodes;
+};
+
+} // namespace mesh
@@ -0,0 +1,117 @@
+#include "utils/parsers/obj_benchmark.hpp"
+
+#include "utils/io.hpp"
+#include "utils/parsers/obj_lexer.hpp"
+#include "utils/parsers/obj_parser.hpp"
+#include "utils/thread_pool.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <tuple>
+
+namespace parser::obj {
+
+namespace {
+
+constexpr size_t bytes_in_megabyte = 1024 * 1024;
+constexpr int benchmark_runs = 3;
+
+template <typename Function>
+void run(const std::string_view name, const std::string_view data,
+         Function &&parse) {
+  // Report the best run to filter out page cache and scheduler noise
+  auto best = std::chrono::steady_clock::duration::max();
+  size_t face_count = 0;
+  for (int i = 0; i != benchmark_runs; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    auto result = parse(data);
+    auto duration = std::chrono::steady_clock::now() - start;
+    best = std::min(best, duration);
+    face_count = std::get<2>(result).size();
+  }
+  const auto seconds = std::chrono::duration<double>(best).count();
+  const auto megabytes = static_cast<double>(data.size()) /
+                         static_cast<double>(bytes_in_megabyte);
+  std::cout << name << ": " << megabytes / seconds << " MB/s, "
+            << seconds * 1000.0 << " ms, " << face_count << " faces\n";
+}
+
+void run_all(const std::string_view data) {
+  run("Lexer", data,
+      [](const std::string_view view) { return parse_lexer(view); });
+  const auto threads = std::to_string(ThreadPool::instance().size() + 1);
+  run("Lexer (" + threads + " threads)", data,
+      [](const std::string_view view) { return parse_lexer_parallel(view); });
+  run("X3 grammar", data,
+      [](const std::string_view view) { return parse(view); });
+}
+
+// Generates a triangulated grid that looks like a typical Blender export
+auto generate_obj(size_t size) -> std::string {
+  std::string result;
+  result.reserve(size + bytes_in_megabyte);
+
+  constexpr size_t grid_width = 1000;
+  constexpr double grid_step = 0.731;
+  size_t row = 0;
+  std::array<char, 128> line{};
+
+  while (result.size() < size) {
+    // One row of vertices and uvs, then the faces connecting it to the last
+    for (size_t column = 0; column != grid_width; ++column) {
+      const double x = static_cast<double>(column) * grid_step - 365.5;
+      const double z = static_cast<double>(row) * grid_step - 1024.25;
+      const double y = static_cast<double>((column * 7 + row * 13) % 97) / 3.0;
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg, hicpp-vararg)
+      auto length = std::snprintf(line.data(), line.size(),
+                                  "v %.6f %.6f %.6f\n", x, y, z);
+      result.append(line.data(), static_cast<size_t>(length));
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg, hicpp-vararg)
+      length = std::snprintf(
+          line.data(), line.size(), "vt %.6f %.6f\n",
+          static_cast<double>(column) / static_cast<double>(grid_width),
+          static_cast<double>(row % grid_width) /
+              static_cast<double>(grid_width));
+      result.append(line.data(), static_cast<size_t>(length));
+    }
+    if (row != 0) {
+      const size_t previous = (row - 1) * grid_width + 1;
+      const size_t current = row * grid_width + 1;
+      for (size_t column = 0; column + 1 != grid_width; ++column) {
+        const size_t a = previous + column;
+        const size_t b = current + column;
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg, hicpp-vararg)
+        auto length = std::snprintf(line.data(), line.size(),
+                                    "f %zu/%zu/1 %zu/%zu/1 %zu/%zu/1\n", a, a,
+                                    b, b, a + 1, a + 1);
+        result.append(line.data(), static_cast<size_t>(length));
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg, hicpp-vararg)
+        length = std::snprintf(line.data(), line.size(),
+                               "f %zu/%zu/1 %zu/%zu/1 %zu/%zu/1\n", a + 1,
+                               a + 1, b, b, b + 1, b + 1);
+        result.append(line.data(), static_cast<size_t>(length));
+      }
+    }
+    ++row;
+  }
+  return result;
+}
+
+} // namespace
+
+void benchmark(const std::string_view path) {
+  auto file = map_file(path);
+  std::cout << "Benchmarking " << path << " (" << file.size() << " bytes)\n";
+  run_all(file.view());
+}
+
+void benchmark_synthetic(const size_t megabytes) {
+  auto data = generate_obj(megabytes * bytes_in_megabyte);
+  std::cout << "Benchmarking synthetic OBJ (" << data.size() << " bytes)\n";
+  run_all(data);
+}
+
+} // namespace parser::obj
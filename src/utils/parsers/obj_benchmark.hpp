@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+namespace parser::obj {
+
+// Parses an OBJ file with both front ends and prints their throughput
+void benchmark(std::string_view path);
+
+// Same as `benchmark`, but on a generated OBJ of roughly `megabytes` size
+void benchmark_synthetic(size_t megabytes);
+
+} // namespace parser::obj
@@ -0,0 +1,600 @@
+#include "utils/parsers/obj_lexer.hpp"
+
+#include "utils/io.hpp"
+#include "utils/parsers/mtl_parser.hpp"
+#include "utils/thread_pool.hpp"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OBJ_LEXER_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#define OBJ_LEXER_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace parser::obj {
+
+namespace {
+
+// Every power of ten up to 10^22 is exactly representable as a double
+constexpr std::array<double, 23> powers_of_ten = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// Largest integer a double holds without rounding
+constexpr uint64_t max_exact_mantissa = uint64_t(1) << 53U;
+
+constexpr int max_fast_exponent = 22;
+
+// `mask` must not be zero
+auto count_trailing_zeros(uint64_t mask) -> unsigned int {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+  unsigned long index = 0;
+  _BitScanForward64(&index, mask);
+  return static_cast<unsigned int>(index);
+#elif defined(_MSC_VER)
+  unsigned int index = 0;
+  while ((mask & 1U) == 0) {
+    mask >>= 1U;
+    ++index;
+  }
+  return index;
+#else
+  return static_cast<unsigned int>(__builtin_ctzll(mask));
+#endif
+}
+
+auto is_digit(char c) -> bool { return c >= '0' && c <= '9'; }
+auto is_blank(char c) -> bool { return c == ' ' || c == '\t' || c == '\r'; }
+
+void skip_blanks(const char *&first, const char *last) {
+  while (first != last && is_blank(*first)) {
+    ++first;
+  }
+}
+
+auto starts_with(const char *first, const char *last, std::string_view prefix)
+    -> bool {
+  return static_cast<size_t>(last - first) >= prefix.size() &&
+         std::memcmp(first, prefix.data(), prefix.size()) == 0;
+}
+
+// Whether the record keyword `keyword` starts at `first` and is followed by
+// a blank
+auto is_record(const char *first, const char *last, std::string_view keyword)
+    -> bool {
+  return starts_with(first, last, keyword) &&
+         last - first > static_cast<std::ptrdiff_t>(keyword.size()) &&
+         is_blank(first[keyword.size()]);
+}
+
+// The rest of the line starting at `first`, without surrounding blanks
+auto read_argument(const char *first, const char *last) -> std::string {
+  skip_blanks(first, last);
+  const char *end = lexer::find_newline(first, last);
+  while (end != first && is_blank(*(end - 1))) {
+    --end;
+  }
+  return {first, end};
+}
+
+auto parse_index(const char *&first, const char *last, long long &value)
+    -> bool {
+  const char *p = first;
+  bool negative = false;
+  if (p != last && *p == '-') {
+    negative = true;
+    ++p;
+  }
+  if (p == last || !is_digit(*p)) {
+    return false;
+  }
+  long long result = 0;
+  constexpr int base = 10;
+  while (p != last && is_digit(*p)) {
+    result = result * base + (*p - '0');
+    ++p;
+  }
+  value = negative ? -result : result;
+  first = p;
+  return true;
+}
+
+// Minimum amount of bytes worth handing to a separate thread
+constexpr size_t min_chunk_size = size_t(1) << 20U;
+
+enum corner_field : unsigned int { FIELD_VERTEX, FIELD_UV, FIELD_NORMAL };
+
+auto field(Vertex &corner, unsigned int index) -> unsigned int & {
+  switch (index) {
+  case FIELD_VERTEX:
+    return corner.vertex_id;
+  case FIELD_UV:
+    return corner.uv_id;
+  default:
+    return corner.normal_id;
+  }
+}
+
+// A face corner as written in the file. Relative (negative) indices are
+// already added to the element count seen so far in this chunk, which may
+// leave them negative until the counts of preceding chunks are known.
+struct Corner {
+  std::array<long long, 3> ids{};
+  std::array<bool, 3> relative{};
+};
+
+// A relative index waiting for the element counts of preceding chunks
+struct Fixup {
+  size_t face;
+  unsigned int corner;
+  unsigned int field;
+  long long local_id;
+};
+
+struct Lexer {
+  explicit Lexer(std::string_view data)
+      : first_(data.data()), last_(data.data() + data.size()) {}
+
+  void run() {
+    // A quick counting pass is much cheaper than growing the vectors
+    const auto counts = lexer::count_records({first_, size_t(last_ - first_)});
+    points.reserve(counts.points);
+    uvs.reserve(counts.uvs);
+    faces.reserve(counts.faces);
+
+    const char *p = first_;
+    while (p != last_) {
+      skip_blanks(p, last_);
+      if (p == last_) {
+        break;
+      }
+      switch (*p) {
+      case 'v':
+        if (is_record(p, last_, "v")) {
+          read_point(p + 1);
+        } else if (is_record(p, last_, "vt")) {
+          read_uv(p + 2);
+        } else if (is_record(p, last_, "vn")) {
+          ++normals;
+        }
+        break;
+      case 'f':
+        if (is_record(p, last_, "f")) {
+          read_face(p + 1);
+        }
+        break;
+      case 'm':
+        if (is_record(p, last_, "mtllib")) {
+          read_mtl_path(p + std::string_view("mtllib").size());
+        }
+        break;
+      default:
+        break;
+      }
+      // Everything we don't understand is skipped up to the end of line
+      p = lexer::find_newline(p, last_);
+      if (p != last_) {
+        ++p;
+      }
+    }
+  }
+
+  std::vector<Point> points;
+  std::vector<TextureCoords> uvs;
+  std::vector<Face> faces;
+  size_t normals = 0;
+  std::vector<Fixup> fixups;
+  std::string mtl_path;
+
+private:
+  void read_point(const char *p) {
+    std::array<double, 3> xyz{};
+    for (auto &coord : xyz) {
+      skip_blanks(p, last_);
+      if (!lexer::parse_double(p, last_, coord)) {
+        return;
+      }
+    }
+    points.push_back({xyz[0], xyz[1], xyz[2]});
+  }
+
+  void read_uv(const char *p) {
+    std::array<double, 2> uv{};
+    skip_blanks(p, last_);
+    if (!lexer::parse_double(p, last_, uv[0])) {
+      return;
+    }
+    // The v coordinate is optional and defaults to 0
+    skip_blanks(p, last_);
+    lexer::parse_double(p, last_, uv[1]);
+    uvs.push_back({uv[0], uv[1]});
+  }
+
+  auto read_corner(const char *&p, Corner &corner) const -> bool {
+    corner = Corner();
+    if (!parse_index(p, last_, corner.ids[FIELD_VERTEX])) {
+      return false;
+    }
+    if (p != last_ && *p == '/') {
+      ++p;
+      if (p != last_ && *p != '/') {
+        parse_index(p, last_, corner.ids[FIELD_UV]);
+      }
+      if (p != last_ && *p == '/') {
+        ++p;
+        parse_index(p, last_, corner.ids[FIELD_NORMAL]);
+      }
+    }
+    const std::array<size_t, 3> counts = {points.size(), uvs.size(), normals};
+    for (unsigned int i = 0; i != 3; ++i) {
+      if (corner.ids.at(i) < 0) {
+        corner.relative.at(i) = true;
+        corner.ids.at(i) += static_cast<long long>(counts.at(i));
+      }
+    }
+    return true;
+  }
+
+  void push_face(const std::array<const Corner *, 3> &corners) {
+    Face face{};
+    for (unsigned int i = 0; i != 3; ++i) {
+      const auto &corner = *corners.at(i);
+      for (unsigned int j = 0; j != 3; ++j) {
+        const auto id = corner.ids.at(j);
+        if (corner.relative.at(j)) {
+          fixups.push_back({faces.size(), i, j, id});
+          field(face.vertices.at(i), j) = missing_index;
+        } else {
+          // OBJ indices are 1-based, 0 means the index was omitted
+          field(face.vertices.at(i), j) =
+              id > 0 ? static_cast<unsigned int>(id - 1) : missing_index;
+        }
+      }
+    }
+    faces.push_back(face);
+  }
+
+  void read_face(const char *p) {
+    Corner first_corner;
+    Corner previous_corner;
+    Corner corner;
+    size_t corner_count = 0;
+    while (true) {
+      skip_blanks(p, last_);
+      if (p == last_ || *p == '\n' || !read_corner(p, corner)) {
+        break;
+      }
+      if (corner_count == 0) {
+        first_corner = corner;
+      } else if (corner_count >= 2) {
+        push_face({&first_corner, &previous_corner, &corner});
+      }
+      previous_corner = corner;
+      ++corner_count;
+    }
+  }
+
+  void read_mtl_path(const char *p) { mtl_path = read_argument(p, last_); }
+
+  const char *first_;
+  const char *last_;
+};
+
+// Resolves the relative indices of `lexer` given the element counts of all
+// chunks before it. `faces` is where the lexer's faces ended up.
+void apply_fixups(const Lexer &lexer, const std::array<size_t, 3> &bases,
+                  Face *faces) {
+  for (const auto &fixup : lexer.fixups) {
+    const auto id =
+        static_cast<long long>(bases.at(fixup.field)) + fixup.local_id;
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    auto &corner = faces[fixup.face].vertices.at(fixup.corner);
+    field(corner, fixup.field) =
+        id >= 0 ? static_cast<unsigned int>(id) : missing_index;
+  }
+}
+
+// Splits `data` into at most `count` pieces that end on line boundaries
+auto split_lines(const std::string_view data, size_t count)
+    -> std::vector<std::string_view> {
+  std::vector<std::string_view> chunks;
+  const char *first = data.data();
+  const char *last = data.data() + data.size();
+  for (size_t i = 1; i <= count && first != last; ++i) {
+    const char *end = last;
+    if (i != count) {
+      const auto target = data.size() * i / count;
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      end = std::max(first, data.data() + target);
+      end = lexer::find_newline(end, last);
+      if (end != last) {
+        ++end;
+      }
+    }
+    chunks.emplace_back(first, static_cast<size_t>(end - first));
+    first = end;
+  }
+  return chunks;
+}
+
+// Concatenates the output of all chunks in file order
+auto merge(std::vector<Lexer> &lexers, ThreadPool &pool)
+    -> std::tuple<std::vector<Point>, std::vector<TextureCoords>,
+                  std::vector<Face>, std::string> {
+  if (lexers.size() == 1) {
+    auto &lexer = lexers.front();
+    apply_fixups(lexer, {0, 0, 0}, lexer.faces.data());
+    return {std::move(lexer.points), std::move(lexer.uvs),
+            std::move(lexer.faces), std::move(lexer.mtl_path)};
+  }
+
+  // Exclusive prefix sums give every chunk its place in the output
+  struct Offsets {
+    size_t points = 0;
+    size_t uvs = 0;
+    size_t normals = 0;
+    size_t faces = 0;
+  };
+  std::vector<Offsets> offsets(lexers.size() + 1);
+  std::string mtl_path;
+  for (size_t i = 0; i != lexers.size(); ++i) {
+    const auto &lexer = lexers[i];
+    offsets[i + 1] = {offsets[i].points + lexer.points.size(),
+                      offsets[i].uvs + lexer.uvs.size(),
+                      offsets[i].normals + lexer.normals,
+                      offsets[i].faces + lexer.faces.size()};
+    // Like the serial parser, the last mtllib statement wins
+    if (!lexer.mtl_path.empty()) {
+      mtl_path = lexer.mtl_path;
+    }
+  }
+
+  const auto &total = offsets.back();
+  std::vector<Point> points(total.points);
+  std::vector<TextureCoords> uvs(total.uvs);
+  std::vector<Face> faces(total.faces);
+
+  pool.parallel_for(lexers.size(), [&](size_t i) {
+    const auto &lexer = lexers[i];
+    const auto &offset = offsets[i];
+    std::copy(lexer.points.begin(), lexer.points.end(),
+              std::next(points.begin(), static_cast<long>(offset.points)));
+    std::copy(lexer.uvs.begin(), lexer.uvs.end(),
+              std::next(uvs.begin(), static_cast<long>(offset.uvs)));
+    std::copy(lexer.faces.begin(), lexer.faces.end(),
+              std::next(faces.begin(), static_cast<long>(offset.faces)));
+    apply_fixups(lexer, {offset.points, offset.uvs, offset.normals},
+                 std::next(faces.data(), static_cast<long>(offset.faces)));
+  });
+
+  return {std::move(points), std::move(uvs), std::move(faces),
+          std::move(mtl_path)};
+}
+
+} // namespace
+
+auto parse_lexer(const std::string_view data, const size_t max_chunks)
+    -> ParseResult {
+  auto &pool = ThreadPool::instance();
+  const auto chunk_count =
+      std::clamp<size_t>(data.size() / min_chunk_size, 1, max_chunks);
+
+  std::vector<Lexer> lexers;
+  for (const auto &chunk : split_lines(data, chunk_count)) {
+    lexers.emplace_back(chunk);
+  }
+  pool.parallel_for(lexers.size(), [&lexers](size_t i) { lexers[i].run(); });
+
+  auto [points, uvs, faces, mtl_path] = merge(lexers, pool);
+
+  Color color = {1.0, 1.0, 1.0};
+  std::string texture_path;
+  if (!mtl_path.empty()) {
+    auto mtl_file = map_file(mtl_path);
+    std::tie(color, texture_path) = parser::mtl::parse(mtl_file.view());
+  }
+
+  return std::make_tuple(std::move(points), std::move(uvs), std::move(faces),
+                         color, std::move(texture_path));
+}
+
+auto parse_lexer_parallel(const std::string_view data) -> ParseResult {
+  // The calling thread works on a chunk too
+  return parse_lexer(data, ThreadPool::instance().size() + 1);
+}
+
+namespace lexer {
+
+auto find_mtl_path(const std::string_view data) -> std::string {
+  constexpr std::string_view keyword = "mtllib";
+  const char *first = data.data();
+  const char *last = first + data.size();
+  std::string mtl_path;
+  for (auto position = data.find(keyword); position != std::string_view::npos;
+       position = data.find(keyword, position + keyword.size())) {
+    // NOLINTBEGIN(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    const char *record = first + position;
+    const char *line = record;
+    while (line != first && is_blank(*(line - 1))) {
+      --line;
+    }
+    if ((line == first || *(line - 1) == '\n') &&
+        is_record(record, last, keyword)) {
+      mtl_path = read_argument(record + keyword.size(), last);
+    }
+    // NOLINTEND(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  }
+  return mtl_path;
+}
+
+auto count_records(const std::string_view data) -> RecordCounts {
+  RecordCounts counts;
+  const char *p = data.data();
+  const char *last = data.data() + data.size();
+  while (p != last) {
+    skip_blanks(p, last);
+    if (is_record(p, last, "v")) {
+      ++counts.points;
+    } else if (is_record(p, last, "vt")) {
+      ++counts.uvs;
+    } else if (is_record(p, last, "vn")) {
+      ++counts.normals;
+    } else if (is_record(p, last, "f")) {
+      ++counts.faces;
+    }
+    p = find_newline(p, last);
+    if (p != last) {
+      ++p;
+    }
+  }
+  return counts;
+}
+
+auto find_newline(const char *first, const char *last) -> const char * {
+#if defined(OBJ_LEXER_SSE2)
+  constexpr std::ptrdiff_t lanes = 16;
+  const __m128i newline = _mm_set1_epi8('\n');
+  while (last - first >= lanes) {
+    const __m128i chunk =
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+    const auto mask = static_cast<unsigned int>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)));
+    if (mask != 0) {
+      return first + count_trailing_zeros(mask);
+    }
+    first += lanes;
+  }
+#elif defined(OBJ_LEXER_NEON)
+  constexpr std::ptrdiff_t lanes = 16;
+  const uint8x16_t newline = vdupq_n_u8('\n');
+  while (last - first >= lanes) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    const uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t *>(first));
+    const uint8x16_t matches = vceqq_u8(chunk, newline);
+    // Narrow every byte to a nibble to get a 64-bit movemask equivalent
+    const uint64_t mask = vget_lane_u64(
+        vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0);
+    if (mask != 0) {
+      constexpr unsigned int bits_per_lane = 4;
+      return first + count_trailing_zeros(mask) / bits_per_lane;
+    }
+    first += lanes;
+  }
+#endif
+  while (first != last && *first != '\n') {
+    ++first;
+  }
+  return first;
+}
+
+auto parse_double(const char *&first, const char *last, double &value)
+    -> bool {
+  const char *p = first;
+  bool negative = false;
+  if (p != last && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    ++p;
+  }
+  const char *unsigned_first = p;
+
+  constexpr uint64_t base = 10;
+  constexpr uint64_t max_accumulated = (UINT64_MAX - 9) / base;
+  uint64_t mantissa = 0;
+  int exponent = 0;
+  bool has_digits = false;
+  bool truncated = false;
+
+  auto accumulate = [&](char digit, int exponent_change) {
+    if (mantissa <= max_accumulated) {
+      mantissa = mantissa * base + static_cast<uint64_t>(digit - '0');
+      exponent += exponent_change;
+    } else {
+      truncated = true;
+      exponent += 1 + exponent_change;
+    }
+  };
+
+  while (p != last && is_digit(*p)) {
+    accumulate(*p, 0);
+    has_digits = true;
+    ++p;
+  }
+  if (p != last && *p == '.') {
+    ++p;
+    while (p != last && is_digit(*p)) {
+      accumulate(*p, -1);
+      has_digits = true;
+      ++p;
+    }
+  }
+  if (!has_digits) {
+    return false;
+  }
+  if (p != last && (*p == 'e' || *p == 'E')) {
+    const char *exponent_start = p;
+    ++p;
+    bool negative_exponent = false;
+    if (p != last && (*p == '-' || *p == '+')) {
+      negative_exponent = *p == '-';
+      ++p;
+    }
+    if (p == last || !is_digit(*p)) {
+      // Not an exponent after all, e.g. "1.0e" followed by garbage
+      p = exponent_start;
+    } else {
+      constexpr int max_exponent_digits = 100000;
+      int exponent_value = 0;
+      while (p != last && is_digit(*p)) {
+        if (exponent_value < max_exponent_digits) {
+          exponent_value = exponent_value * static_cast<int>(base) + (*p - '0');
+        }
+        ++p;
+      }
+      exponent += negative_exponent ? -exponent_value : exponent_value;
+    }
+  }
+
+  double result = 0.0;
+  if (!truncated && mantissa <= max_exact_mantissa &&
+      exponent >= -max_fast_exponent && exponent <= max_fast_exponent) {
+    // Both operands are exact, so a single rounding gives the correct result
+    result = static_cast<double>(mantissa);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-constant-array-index)
+    const double scale = powers_of_ten[std::abs(exponent)];
+    result = exponent < 0 ? result / scale : result * scale;
+    result = negative ? -result : result;
+  } else {
+    // Slow path, correctly rounded for any length and independent of the
+    // locale. The sign was consumed above, from_chars doesn't take a '+'.
+    const auto [end, error] = std::from_chars(unsigned_first, p, result);
+    if (error == std::errc::result_out_of_range) {
+      // Like the fast path and X3, saturate instead of failing
+      result = exponent > 0 ? std::numeric_limits<double>::infinity() : 0.0;
+    } else if (error != std::errc() || end != p) {
+      return false;
+    }
+    result = negative ? -result : result;
+  }
+
+  value = result;
+  first = p;
+  return true;
+}
+
+} // namespace lexer
+
+} // namespace parser::obj
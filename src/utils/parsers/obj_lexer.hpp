@@ -0,0 +1,53 @@
+#pragma once
+
+#include "utils/primitives.hpp"
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+namespace parser::obj {
+
+using ParseResult = std::tuple<std::vector<Point>, std::vector<TextureCoords>,
+                               std::vector<Face>, Color, std::string>;
+
+// Hand-written alternative to the X3 grammar in `parse`. Handles the same
+// records plus faces without uv/normal indices, negative (relative) indices
+// and polygons, which are triangulated as fans.
+//
+// Large files are split at line boundaries into up to `max_chunks` pieces
+// that are parsed on the shared thread pool. The result doesn't depend on the
+// number of chunks.
+auto parse_lexer(std::string_view data, size_t max_chunks = 1) -> ParseResult;
+
+// `parse_lexer` using every thread of the shared pool
+auto parse_lexer_parallel(std::string_view data) -> ParseResult;
+
+namespace lexer {
+
+struct RecordCounts {
+  size_t points = 0;
+  size_t uvs = 0;
+  size_t normals = 0;
+  // Polygons are counted once, even though they produce several triangles
+  size_t faces = 0;
+};
+
+// The material file of the last `mtllib` record in `data`, or an empty
+// string. Much cheaper than parsing the whole file.
+auto find_mtl_path(std::string_view data) -> std::string;
+
+// Counts the records in `data` without parsing them
+auto count_records(std::string_view data) -> RecordCounts;
+
+// Returns a pointer to the first '\n' in [first, last), or `last`.
+auto find_newline(const char *first, const char *last) -> const char *;
+
+// Parses a decimal floating point number starting at `first`. On success
+// `first` is advanced past the number.
+auto parse_double(const char *&first, const char *last, double &value)
+    -> bool;
+
+} // namespace lexer
+
+} // namespace parser::obj
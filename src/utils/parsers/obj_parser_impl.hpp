@@ -33,8 +33,8 @@ template <typename Container> auto parse(const Container &data) {
 
   auto lambda_mtl = [&color, &texture_path](auto &ctx) {
     std::string mtl_path = x3::_attr(ctx);
-    auto mtl_file = load_file(mtl_path);
-    std::tie(color, texture_path) = parser::mtl::parse(mtl_file);
+    auto mtl_file = map_file(mtl_path);
+    std::tie(color, texture_path) = parser::mtl::parse(mtl_file.view());
   };
 
   auto lambda_vertex = [&](auto &ctx) {
@@ -78,6 +78,7 @@ template <typename Container> auto parse(const Container &data) {
   if (first != last) {
   }
 
-  return std::make_tuple(points, uvs, faces, color, texture_path);
+  return std::make_tuple(std::move(points), std::move(uvs), std::move(faces),
+                         color, std::move(texture_path));
 }
 } // namespace parser::obj
\ No newline at end of file
@@ -1,98 +1,171 @@
 #include "utils/parsers/parsers.hpp"
 
+#include "utils/mesh/index_builder.hpp"
+#include "utils/parsers/obj_lexer.hpp"
 #include "utils/parsers/obj_parser.hpp"
+#include "utils/timer.hpp"
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
-#include <tuple>
+#include <limits>
 
 namespace parser {
-auto parse_model(const std::vector<char> &data)
-    -> std::tuple<std::vector<gl::Element>, std::vector<gl::Vertex>,
-                  gl::Texture> {
+auto parse_model(const std::string_view data, const obj_parser_enum obj_parser)
+    -> mesh::MeshData {
   Timer timer("Parsing both OBJ and MTL files took ");
 
-  auto [points, uvs, faces, color, texture_path] = parser::obj::parse(data);
+  auto [points, uvs, faces, color, texture_path] =
+      obj_parser == obj_parser_enum::OBJ_PARSER_X3
+          ? parser::obj::parse(data)
+          : parser::obj::parse_lexer_parallel(data);
 
-  auto elements = std::vector<gl::Element>();
-  auto vertices = std::vector<gl::Vertex>();
-  auto texture = gl::Texture(texture_path);
+  auto result = mesh::build_indexed(faces, points, uvs, color);
+  result.texture_path = std::move(texture_path);
+  return result;
+}
 
-  for (const auto &face : faces) {
-    auto v = std::array<gl::Vertex, 3>();
-    for (size_t i = 0; i != 3; ++i) {
-      unsigned int vertex_id = face.vertices.at(i).vertex_id;
-      unsigned int uv_id = face.vertices.at(i).uv_id;
+namespace {
+
+auto read_scene(Assimp::Importer &importer, const std::string_view data,
+                const std::string_view file_type) -> const aiScene & {
+  // Points and lines can't be drawn as triangles, drop them while sorting
+  importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE,
+                              aiPrimitiveType_POINT | aiPrimitiveType_LINE);
+  constexpr unsigned int steps =
+      static_cast<unsigned int>(aiProcess_Triangulate) |
+      static_cast<unsigned int>(aiProcess_SortByPType) |
+      static_cast<unsigned int>(aiProcess_JoinIdenticalVertices) |
+      static_cast<unsigned int>(aiProcess_ImproveCacheLocality) |
+      static_cast<unsigned int>(aiProcess_OptimizeMeshes);
+  const aiScene *scene = importer.ReadFileFromMemory(
+      data.data(), data.size(), steps, std::string(file_type).c_str());
 
-      auto vertex = points[vertex_id];
-      auto uv = uvs[uv_id];
+  if (scene == nullptr) {
+    const std::string error = importer.GetErrorString();
+    throw std::runtime_error(error);
+  }
+  return *scene;
+}
 
-      v.at(i).coord = {vertex.x, vertex.y, vertex.z};
-      v.at(i).color = {color.r, color.g, color.b};
-      v.at(i).uv = {uv.u, uv.v};
+// Appends the triangles and vertices of `mesh`, in its own coordinates
+void append_mesh(const aiScene &scene, const aiMesh &mesh,
+                 std::vector<gl::Element> &elements,
+                 std::vector<gl::Vertex> &vertices) {
+  // Indices in every mesh start at zero, shift them past earlier meshes
+  const auto base_vertex = static_cast<unsigned int>(vertices.size());
+
+  for (size_t j = 0; j < mesh.mNumFaces; ++j) {
+    const aiFace &face = mesh.mFaces[j];
+    if (face.mNumIndices != 3) {
+      continue;
     }
-    vertices.insert(vertices.end(), v.begin(), v.end());
     auto e = gl::Element();
-    for (size_t i = 0; i != 3; ++i) {
-      e.vertices.at(i) = static_cast<unsigned int>(vertices.size() - i - 1);
+    for (size_t k = 0; k < 3; ++k) {
+      e.vertices.at(k) = base_vertex + face.mIndices[k];
     }
     elements.push_back(e);
   }
-  return std::make_tuple(std::move(elements), std::move(vertices),
-                         std::move(texture));
+
+  const auto *material = scene.mMaterials[mesh.mMaterialIndex];
+  aiColor3D color(0.F, 0.F, 0.F);
+  if (material->Get(AI_MATKEY_COLOR_DIFFUSE, color) != AI_SUCCESS) {
+    throw std::runtime_error("Error accesssing diffuse color of a material!");
+  }
+
+  const bool has_uvs = mesh.HasTextureCoords(0);
+  for (size_t j = 0; j < mesh.mNumVertices; ++j) {
+    const auto point = mesh.mVertices[j];
+    const auto tex =
+        has_uvs ? mesh.mTextureCoords[0][j] : aiVector3D(0.F, 0.F, 0.F);
+    vertices.push_back({{point.x, point.y, point.z},
+                        {color.r, color.g, color.b},
+                        {tex.x, tex.y}});
+  }
 }
 
-auto parse_model_assimp(const std::vector<char> &data,
+// Assimp matrices are row major, glm ones column major
+auto to_glm(const aiMatrix4x4 &m) -> glm::mat4 {
+  glm::mat4 result;
+  result[0] = glm::vec4(m.a1, m.b1, m.c1, m.d1);
+  result[1] = glm::vec4(m.a2, m.b2, m.c2, m.d2);
+  result[2] = glm::vec4(m.a3, m.b3, m.c3, m.d3);
+  result[3] = glm::vec4(m.a4, m.b4, m.c4, m.d4);
+  return result;
+}
+
+} // namespace
+
+auto parse_model_assimp(const std::string_view data,
                         const std::string_view file_type,
                         const std::string_view texture_path)
-    -> std::tuple<std::vector<gl::Element>, std::vector<gl::Vertex>,
-                  gl::Texture> {
+    -> mesh::MeshData {
   Timer timer("Parsing assimp file took ");
 
+  Assimp::Importer importer;
+  const auto &scene = read_scene(importer, data, file_type);
+  const auto meshes = std::vector<const aiMesh *>(
+      scene.mMeshes, scene.mMeshes + scene.mNumMeshes);
+
+  size_t element_count = 0;
+  size_t vertex_count = 0;
+  for (const auto *mesh : meshes) {
+    element_count += mesh->mNumFaces;
+    vertex_count += mesh->mNumVertices;
+  }
+  if (vertex_count > std::numeric_limits<unsigned int>::max()) {
+    throw std::runtime_error("Too many vertices for 32-bit indices!");
+  }
+
   auto elements = std::vector<gl::Element>();
   auto vertices = std::vector<gl::Vertex>();
+  elements.reserve(element_count);
+  vertices.reserve(vertex_count);
 
-  Assimp::Importer importer;
-  const aiScene *scene = importer.ReadFileFromMemory(
-      data.data(), data.size(), aiProcess_Triangulate, file_type.data());
-
-  if (scene == nullptr) {
-    const std::string error = importer.GetErrorString();
-    throw std::runtime_error(error);
+  for (const auto *mesh : meshes) {
+    append_mesh(scene, *mesh, elements, vertices);
   }
+  return {std::move(elements), std::move(vertices), std::string(texture_path),
+          {}};
+}
 
-  auto texture = gl::Texture(texture_path);
-
-  for (size_t i = 0; i < scene->mNumMeshes; ++i) {
-    const aiMesh *mesh = scene->mMeshes[i];
+auto parse_scene_assimp(const std::string_view data,
+                        const std::string_view file_type,
+                        const std::string_view texture_path)
+    -> mesh::SceneData {
+  Timer timer("Parsing assimp scene took ");
 
-    for (size_t j = 0; j < mesh->mNumFaces; ++j) {
-      const aiFace face = mesh->mFaces[j];
-      auto e = gl::Element();
-      for (size_t k = 0; k < face.mNumIndices; ++k) {
-        e.vertices.at(k) = face.mIndices[k];
-      }
-      elements.push_back(e);
-    }
+  Assimp::Importer importer;
+  const auto &scene = read_scene(importer, data, file_type);
+
+  mesh::SceneData result;
+  result.meshes.resize(scene.mNumMeshes);
+  result.mesh_names.resize(scene.mNumMeshes);
+  for (size_t i = 0; i != scene.mNumMeshes; ++i) {
+    const auto &mesh = *scene.mMeshes[i];
+    auto &mesh_data = result.meshes[i];
+    mesh_data.elements.reserve(mesh.mNumFaces);
+    mesh_data.vertices.reserve(mesh.mNumVertices);
+    append_mesh(scene, mesh, mesh_data.elements, mesh_data.vertices);
+    mesh_data.texture_path = std::string(texture_path);
+    result.mesh_names[i] = mesh.mName.C_Str();
+  }
 
-    for (size_t j = 0; j < mesh->mNumVertices; ++j) {
-      const auto point = mesh->mVertices[j];
-      const auto tex = mesh->mTextureCoords[0][j];
-      const auto *material = scene->mMaterials[mesh->mMaterialIndex];
-
-      aiColor3D color(0.F, 0.F, 0.F);
-      if (material->Get(AI_MATKEY_COLOR_DIFFUSE, color) != AI_SUCCESS) {
-        throw std::runtime_error(
-            "Error accesssing diffuse color of a material!");
-      }
-      gl::Vertex v = {{point.x, point.y, point.z},
-                      {color.r, color.g, color.b},
-                      {tex.x, tex.y}};
-
-      vertices.push_back(v);
+  // Depth first, so every parent is stored before its children
+  std::vector<std::pair<const aiNode *, uint32_t>> stack = {
+      {scene.mRootNode, mesh::no_parent}};
+  while (!stack.empty()) {
+    const auto [node, parent] = stack.back();
+    stack.pop_back();
+    const auto index = static_cast<uint32_t>(result.nodes.size());
+    auto &scene_node = result.nodes.emplace_back();
+    scene_node.name = node->mName.C_Str();
+    scene_node.transform = to_glm(node->mTransformation);
+    scene_node.parent = parent;
+    scene_node.meshes.assign(node->mMeshes, node->mMeshes + node->mNumMeshes);
+    for (size_t i = node->mNumChildren; i != 0; --i) {
+      stack.emplace_back(node->mChildren[i - 1], index);
     }
   }
-  return std::make_tuple(std::move(elements), std::move(vertices),
-                         std::move(texture));
+  return result;
 }
 } // namespace parser
\ No newline at end of file
@@ -1,16 +1,21 @@
 #pragma once
 
-#include "utils/GL.hpp"
-#include "utils/primitives.hpp"
-#include <vector>
+#include "utils/mesh/mesh_data.hpp"
+#include "utils/mesh/scene_data.hpp"
+#include <string_view>
 
 namespace parser {
-auto parse_model(const std::vector<char> &data)
-    -> std::tuple<std::vector<gl::Element>, std::vector<gl::Vertex>,
-                  gl::Texture>;
-auto parse_model_assimp(const std::vector<char> &data,
-                        std::string_view file_type,
-                        std::string_view texture_path)
-    -> std::tuple<std::vector<gl::Element>, std::vector<gl::Vertex>,
-                  gl::Texture>;
+
+// Which OBJ front end `parse_model` uses
+enum struct obj_parser_enum { OBJ_PARSER_LEXER, OBJ_PARSER_X3 };
+
+auto parse_model(std::string_view data,
+                 obj_parser_enum obj_parser = obj_parser_enum::OBJ_PARSER_LEXER)
+    -> mesh::MeshData;
+auto parse_model_assimp(std::string_view data, std::string_view file_type,
+                        std::string_view texture_path) -> mesh::MeshData;
+// Keeps the node hierarchy and every mesh on its own, instead of merging the
+// meshes into one
+auto parse_scene_assimp(std::string_view data, std::string_view file_type,
+                        std::string_view texture_path) -> mesh::SceneData;
 } // namespace parser
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <array>
+#include <limits>
 #include <glm/glm.hpp>
 
 struct Point {
@@ -31,6 +32,9 @@ struct Vertex {
 
 namespace parser::obj {
 
+// Marks a face corner that has no uv or normal reference
+constexpr unsigned int missing_index = std::numeric_limits<unsigned int>::max();
+
 struct Vertex {
   unsigned int vertex_id;
   unsigned int uv_id;
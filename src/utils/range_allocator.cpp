@@ -0,0 +1,63 @@
+#include "utils/range_allocator.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+RangeAllocator::RangeAllocator(size_t capacity)
+    : capacity_(capacity), free_size_(capacity) {
+  if (capacity != 0) {
+    free_blocks_.emplace(0, capacity);
+  }
+}
+
+auto RangeAllocator::allocate(size_t size) -> std::optional<size_t> {
+  if (size == 0) {
+    return 0;
+  }
+  for (auto it = free_blocks_.begin(); it != free_blocks_.end(); ++it) {
+    auto [offset, block_size] = *it;
+    if (block_size < size) {
+      continue;
+    }
+    free_blocks_.erase(it);
+    if (block_size != size) {
+      free_blocks_.emplace(offset + size, block_size - size);
+    }
+    free_size_ -= size;
+    return offset;
+  }
+  return std::nullopt;
+}
+
+void RangeAllocator::free(size_t offset, size_t size) {
+  if (size == 0) {
+    return;
+  }
+  free_size_ += size;
+
+  auto next = free_blocks_.lower_bound(offset);
+  if (next != free_blocks_.begin()) {
+    auto previous = std::prev(next);
+    if (previous->first + previous->second == offset) {
+      offset = previous->first;
+      size += previous->second;
+      free_blocks_.erase(previous);
+    }
+  }
+  if (next != free_blocks_.end() && offset + size == next->first) {
+    size += next->second;
+    free_blocks_.erase(next);
+  }
+  free_blocks_.emplace(offset, size);
+}
+
+auto RangeAllocator::capacity() const -> size_t { return capacity_; }
+auto RangeAllocator::free_size() const -> size_t { return free_size_; }
+
+auto RangeAllocator::largest_free_block() const -> size_t {
+  size_t largest = 0;
+  for (const auto &[offset, size] : free_blocks_) {
+    largest = std::max(largest, size);
+  }
+  return largest;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <optional>
+
+// First-fit allocator over [0, capacity). Hands out offsets only, the memory
+// itself lives elsewhere (e.g. in a GPU buffer).
+struct RangeAllocator {
+  RangeAllocator() = default;
+  explicit RangeAllocator(size_t capacity);
+
+  // Returns the offset of `size` free units, or nothing if no block fits
+  auto allocate(size_t size) -> std::optional<size_t>;
+  // Returns a range handed out by `allocate`, merging it with its neighbours
+  void free(size_t offset, size_t size);
+
+  [[nodiscard]] auto capacity() const -> size_t;
+  [[nodiscard]] auto free_size() const -> size_t;
+  [[nodiscard]] auto largest_free_block() const -> size_t;
+
+private:
+  // Free blocks by offset, never adjacent to each other
+  std::map<size_t, size_t> free_blocks_;
+  size_t capacity_ = 0;
+  size_t free_size_ = 0;
+};
@@ -0,0 +1,124 @@
+#include "utils/scene_graph.hpp"
+
+auto SceneGraph::add_node(const Node parent, const glm::mat4 &local)
+    -> Node {
+  Node node = 0;
+  if (free_nodes_.empty()) {
+    node = static_cast<Node>(nodes_.size());
+    nodes_.emplace_back();
+  } else {
+    node = free_nodes_.back();
+    free_nodes_.pop_back();
+  }
+  auto &data = nodes_[node];
+  data = NodeData();
+  data.local = local;
+  data.parent = parent;
+  data.in_use = true;
+  if (parent != no_node) {
+    auto &parent_data = nodes_.at(parent);
+    data.next_sibling = parent_data.first_child;
+    parent_data.first_child = node;
+  }
+  mark_dirty(node);
+  return node;
+}
+
+void SceneGraph::remove_subtree(const Node node) {
+  const Node parent = nodes_.at(node).parent;
+  if (parent != no_node) {
+    // Siblings are singly linked, find the link pointing at `node`
+    Node *link = &nodes_[parent].first_child;
+    while (*link != node) {
+      link = &nodes_[*link].next_sibling;
+    }
+    *link = nodes_[node].next_sibling;
+  }
+
+  stack_.assign(1, node);
+  while (!stack_.empty()) {
+    const Node current = stack_.back();
+    stack_.pop_back();
+    auto &data = nodes_[current];
+    for (Node child = data.first_child; child != no_node;
+         child = nodes_[child].next_sibling) {
+      stack_.push_back(child);
+    }
+    // Left in `dirty_`, `update` skips it as it is no longer dirty
+    data.dirty = false;
+    data.in_use = false;
+    free_nodes_.push_back(current);
+  }
+}
+
+void SceneGraph::set_local(const Node node, const glm::mat4 &local) {
+  nodes_.at(node).local = local;
+  mark_dirty(node);
+}
+
+auto SceneGraph::get_local(const Node node) const -> const glm::mat4 & {
+  return nodes_.at(node).local;
+}
+
+auto SceneGraph::get_world(const Node node) const -> const glm::mat4 & {
+  return nodes_.at(node).world;
+}
+
+auto SceneGraph::get_parent(const Node node) const -> Node {
+  return nodes_.at(node).parent;
+}
+
+void SceneGraph::update() {
+  if (dirty_.empty()) {
+    return;
+  }
+  ++generation_;
+  for (const Node node : dirty_) {
+    // Done already, or will be with the subtree of a dirty ancestor
+    if (!nodes_[node].dirty || has_dirty_ancestor(node)) {
+      continue;
+    }
+    stack_.assign(1, node);
+    while (!stack_.empty()) {
+      const Node current = stack_.back();
+      stack_.pop_back();
+      auto &data = nodes_[current];
+      data.world = data.parent == no_node
+                       ? data.local
+                       : nodes_[data.parent].world * data.local;
+      data.generation = generation_;
+      data.dirty = false;
+      for (Node child = data.first_child; child != no_node;
+           child = nodes_[child].next_sibling) {
+        stack_.push_back(child);
+      }
+    }
+  }
+  dirty_.clear();
+}
+
+auto SceneGraph::get_generation() const -> uint64_t { return generation_; }
+
+auto SceneGraph::get_generation(const Node node) const -> uint64_t {
+  return nodes_.at(node).generation;
+}
+
+auto SceneGraph::node_count() const -> size_t { return nodes_.size(); }
+
+void SceneGraph::mark_dirty(const Node node) {
+  auto &data = nodes_[node];
+  if (!data.dirty) {
+    data.dirty = true;
+    dirty_.push_back(node);
+  }
+}
+
+auto SceneGraph::has_dirty_ancestor(const Node node) const -> bool {
+  for (Node parent = nodes_[node].parent; parent != no_node;
+       parent = nodes_[parent].parent) {
+    if (nodes_[parent].dirty) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+#include <vector>
+
+// Transforms relative to a parent. World matrices are only recomputed for
+// the subtrees below nodes that changed, so moving the root of a large
+// assembly costs one pass over that assembly and nothing else. Nodes are
+// referred to by handle and freed handles are handed out again.
+struct SceneGraph {
+  using Node = uint32_t;
+  static constexpr Node no_node = std::numeric_limits<Node>::max();
+
+  // A child of `parent`, or a root if it is `no_node`
+  auto add_node(Node parent, const glm::mat4 &local) -> Node;
+  // Frees the node and everything below it
+  void remove_subtree(Node node);
+
+  void set_local(Node node, const glm::mat4 &local);
+  [[nodiscard]] auto get_local(Node node) const -> const glm::mat4 &;
+  // parent world * local, as of the last `update`
+  [[nodiscard]] auto get_world(Node node) const -> const glm::mat4 &;
+  [[nodiscard]] auto get_parent(Node node) const -> Node;
+
+  // Recomputes the world matrices below every node changed since the last
+  // call
+  void update();
+  // Counts the updates that changed any world matrix
+  [[nodiscard]] auto get_generation() const -> uint64_t;
+  // The generation in which the world matrix of `node` last changed
+  [[nodiscard]] auto get_generation(Node node) const -> uint64_t;
+  // Upper bound of all nodes in use
+  [[nodiscard]] auto node_count() const -> size_t;
+
+private:
+  struct NodeData {
+    glm::mat4 local = glm::mat4(1.0F);
+    glm::mat4 world = glm::mat4(1.0F);
+    Node parent = no_node;
+    Node first_child = no_node;
+    Node next_sibling = no_node;
+    uint64_t generation = 0;
+    bool dirty = false;
+    bool in_use = false;
+  };
+
+  void mark_dirty(Node node);
+  // Whether a node above `node` waits for `update`, which then recomputes
+  // `node` too
+  [[nodiscard]] auto has_dirty_ancestor(Node node) const -> bool;
+
+  std::vector<NodeData> nodes_;
+  std::vector<Node> free_nodes_;
+  // Nodes changed since the last `update`, some possibly twice or freed
+  std::vector<Node> dirty_;
+  // Kept to reuse its memory
+  std::vector<Node> stack_;
+  uint64_t generation_ = 0;
+};
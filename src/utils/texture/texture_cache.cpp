@@ -0,0 +1,250 @@
+#include "utils/texture/texture_cache.hpp"
+
+#include "utils/hash.hpp"
+#include "utils/io.hpp"
+#include "utils/timer.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace texture {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+constexpr std::array<uint8_t, 12> identifier = {
+    0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'};
+constexpr uint32_t endianness = 0x04030201;
+
+// Key-value entries with the cache key, KTX readers ignore unknown ones
+constexpr std::string_view source_entry = "simple_graphics.source";
+constexpr std::string_view key_entry = "simple_graphics.key";
+
+// KTX 1.1 header, followed by the key-value data and then every mip level
+// as its size and its blocks
+struct Header {
+  std::array<uint8_t, 12> identifier;
+  uint32_t endianness;
+  uint32_t gl_type;
+  uint32_t gl_type_size;
+  uint32_t gl_format;
+  uint32_t gl_internal_format;
+  uint32_t gl_base_internal_format;
+  uint32_t pixel_width;
+  uint32_t pixel_height;
+  uint32_t pixel_depth;
+  uint32_t array_elements;
+  uint32_t faces;
+  uint32_t mip_levels;
+  uint32_t key_value_bytes;
+};
+
+// Value of the `key_entry` entry
+struct KeyValue {
+  uint64_t source_size;
+  int64_t source_mtime;
+  uint64_t content_hash;
+  uint32_t pipeline;
+  uint32_t padding;
+};
+
+auto align4(uint64_t offset) -> uint64_t { return (offset + 3) / 4 * 4; }
+
+auto read32(std::string_view contents, uint64_t offset) -> uint32_t {
+  uint32_t value = 0;
+  std::memcpy(&value, contents.data() + offset, sizeof(value));
+  return value;
+}
+
+auto is_supported(uint32_t format) -> bool {
+  return format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ||
+         format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+}
+
+} // namespace
+
+auto make_cache_key(const std::string_view path,
+                    const std::string_view contents) -> CacheKey {
+  return mesh::make_cache_key(path, contents, encoder_version);
+}
+
+auto cache_path(const std::string_view cache_directory, const CacheKey &key)
+    -> std::string {
+  const auto name = to_hex(hash_bytes(key.source_path)) + ".ktx";
+  return (fs::path(cache_directory) / name).string();
+}
+
+auto load_cached(const std::string_view cache_directory, const CacheKey &key)
+    -> std::optional<CompressedImage> {
+  // Qualified, as lookup through `key` also finds mesh::cache_path
+  const auto path = texture::cache_path(cache_directory, key);
+  std::error_code error;
+  if (!fs::is_regular_file(path, error)) {
+    return std::nullopt;
+  }
+
+  Timer timer("Loading cached texture " + path + " took ");
+  auto file = map_file(path);
+  const auto contents = file.view();
+  Header header{};
+  if (contents.size() < sizeof(header)) {
+    return std::nullopt;
+  }
+  std::memcpy(&header, contents.data(), sizeof(header));
+  const bool valid =
+      header.identifier == identifier && header.endianness == endianness &&
+      header.gl_type == 0 && is_supported(header.gl_internal_format) &&
+      header.pixel_width != 0 && header.pixel_height != 0 &&
+      header.pixel_depth == 0 && header.array_elements == 0 &&
+      header.faces == 1 &&
+      header.mip_levels ==
+          mip_level_count(static_cast<GLsizei>(header.pixel_width),
+                          static_cast<GLsizei>(header.pixel_height)) &&
+      header.key_value_bytes <= contents.size() - sizeof(header);
+  if (!valid) {
+    return std::nullopt;
+  }
+
+  // The file has to come from the same source and encoder
+  bool source_matches = false;
+  bool key_matches = false;
+  const uint64_t key_value_end = sizeof(header) + header.key_value_bytes;
+  for (uint64_t offset = sizeof(header); offset + 4 <= key_value_end;) {
+    const uint64_t size = read32(contents, offset);
+    if (size > key_value_end - offset - 4) {
+      return std::nullopt;
+    }
+    const auto entry = contents.substr(offset + 4, size);
+    const auto separator = entry.find('\0');
+    if (separator != std::string_view::npos) {
+      const auto name = entry.substr(0, separator);
+      const auto value = entry.substr(separator + 1);
+      if (name == source_entry) {
+        source_matches = value == key.source_path;
+      } else if (name == key_entry && value.size() == sizeof(KeyValue)) {
+        KeyValue stored{};
+        std::memcpy(&stored, value.data(), sizeof(stored));
+        key_matches = stored.source_size == key.source_size &&
+                      stored.source_mtime == key.source_mtime &&
+                      stored.content_hash == key.content_hash &&
+                      stored.pipeline == key.pipeline;
+      }
+    }
+    offset = align4(offset + 4 + size);
+  }
+  if (!source_matches || !key_matches) {
+    return std::nullopt;
+  }
+
+  CompressedImage image;
+  image.format = header.gl_internal_format;
+  image.width = static_cast<GLsizei>(header.pixel_width);
+  image.height = static_cast<GLsizei>(header.pixel_height);
+  image.levels.resize(header.mip_levels);
+  uint64_t offset = key_value_end;
+  for (size_t level = 0; level != image.levels.size(); ++level) {
+    const auto expected =
+        level_bytes(image.format, std::max(image.width >> level, 1),
+                    std::max(image.height >> level, 1));
+    if (offset + 4 > contents.size() || read32(contents, offset) != expected ||
+        expected > contents.size() - offset - 4) {
+      return std::nullopt;
+    }
+    image.levels[level].resize(expected);
+    std::memcpy(image.levels[level].data(), contents.data() + offset + 4,
+                expected);
+    offset = align4(offset + 4 + expected);
+  }
+  return image;
+}
+
+void store_cached(const std::string_view cache_directory, const CacheKey &key,
+                  const CompressedImage &image) {
+  Timer timer("Caching texture " + key.source_path + " took ");
+  const auto path = texture::cache_path(cache_directory, key);
+  const auto temporary_path = unique_temporary_path(path);
+
+  std::error_code error;
+  fs::create_directories(fs::path(cache_directory), error);
+  if (error) {
+    std::cerr << "Can't create texture cache directory " << cache_directory
+              << ": " << error.message() << '\n';
+    return;
+  }
+
+  KeyValue key_value{};
+  key_value.source_size = key.source_size;
+  key_value.source_mtime = key.source_mtime;
+  key_value.content_hash = key.content_hash;
+  key_value.pipeline = key.pipeline;
+
+  auto entry_size = [](std::string_view name, size_t value_size) {
+    return static_cast<uint32_t>(name.size() + 1 + value_size);
+  };
+  const uint32_t source_size = entry_size(source_entry, key.source_path.size());
+  const uint32_t key_size = entry_size(key_entry, sizeof(key_value));
+
+  Header header{};
+  header.identifier = identifier;
+  header.endianness = endianness;
+  header.gl_type_size = 1;
+  header.gl_internal_format = image.format;
+  header.gl_base_internal_format =
+      image.format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? GL_RGB : GL_RGBA;
+  header.pixel_width = static_cast<uint32_t>(image.width);
+  header.pixel_height = static_cast<uint32_t>(image.height);
+  header.faces = 1;
+  header.mip_levels = static_cast<uint32_t>(image.levels.size());
+  header.key_value_bytes =
+      static_cast<uint32_t>(align4(4 + source_size) + align4(4 + key_size));
+
+  {
+    std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+    auto write = [&file](const void *bytes, size_t size) {
+      file.write(static_cast<const char *>(bytes),
+                 static_cast<std::streamsize>(size));
+    };
+    // Zero padding up to the next multiple of four bytes
+    auto pad = [&file]() {
+      while (static_cast<uint64_t>(file.tellp()) % 4 != 0) {
+        file.put('\0');
+      }
+    };
+    write(&header, sizeof(header));
+    write(&source_size, sizeof(source_size));
+    write(source_entry.data(), source_entry.size());
+    file.put('\0');
+    write(key.source_path.data(), key.source_path.size());
+    pad();
+    write(&key_size, sizeof(key_size));
+    write(key_entry.data(), key_entry.size());
+    file.put('\0');
+    write(&key_value, sizeof(key_value));
+    pad();
+    for (const auto &level : image.levels) {
+      const auto size = static_cast<uint32_t>(level.size());
+      write(&size, sizeof(size));
+      write(level.data(), level.size());
+      pad();
+    }
+    if (!file) {
+      std::cerr << "Can't write cached texture " << temporary_path << '\n';
+      fs::remove(temporary_path, error);
+      return;
+    }
+  }
+
+  // Readers never see a partially written file
+  fs::rename(temporary_path, path, error);
+  if (error) {
+    std::cerr << "Can't write cached texture " << path << ": "
+              << error.message() << '\n';
+    fs::remove(temporary_path, error);
+  }
+}
+
+} // namespace texture
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "utils/mesh/mesh_cache.hpp"
+#include "utils/texture/texture_compressor.hpp"
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace texture {
+
+// Same fingerprint of the source file as baked meshes, with the encoder
+// version as the pipeline
+using CacheKey = mesh::CacheKey;
+
+auto make_cache_key(std::string_view path, std::string_view contents)
+    -> CacheKey;
+
+// Where the compressed texture for `key` lives inside `cache_directory`
+auto cache_path(std::string_view cache_directory, const CacheKey &key)
+    -> std::string;
+
+// Returns the compressed texture if there is an up-to-date KTX file for
+// `key`
+auto load_cached(std::string_view cache_directory, const CacheKey &key)
+    -> std::optional<CompressedImage>;
+
+// Writes `image` as a KTX file with its whole mip chain. Failures are
+// logged, a missing cache entry isn't an error.
+void store_cached(std::string_view cache_directory, const CacheKey &key,
+                  const CompressedImage &image);
+
+} // namespace texture
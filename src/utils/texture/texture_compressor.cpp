@@ -0,0 +1,343 @@
+#include "utils/texture/texture_compressor.hpp"
+
+#include "utils/timer.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace texture {
+
+namespace {
+
+using Pixel = std::array<uint8_t, 4>;
+using Color = std::array<float, 3>;
+using Block = std::array<Pixel, 16>;
+
+constexpr size_t block_size = 4;
+constexpr size_t bc1_block_bytes = 8;
+constexpr size_t bc3_block_bytes = 16;
+
+// One uncompressed level, RGBA8 row by row
+struct Level {
+  size_t width = 0;
+  size_t height = 0;
+  std::vector<Pixel> pixels;
+};
+
+auto read_surface(const SDL_Surface &surface) -> Level {
+  Level level;
+  level.width = static_cast<size_t>(surface.w);
+  level.height = static_cast<size_t>(surface.h);
+  level.pixels.resize(level.width * level.height);
+  const auto *rows = static_cast<const uint8_t *>(surface.pixels);
+  for (size_t y = 0; y != level.height; ++y) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    const auto *row = rows + y * static_cast<size_t>(surface.pitch);
+    for (size_t x = 0; x != level.width; ++x) {
+      auto &pixel = level.pixels[y * level.width + x];
+      for (size_t channel = 0; channel != 4; ++channel) {
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+        pixel.at(channel) = row[x * 4 + channel];
+      }
+    }
+  }
+  return level;
+}
+
+// Box filter, like glGenerateMipmap. Odd edges reuse the last texel.
+auto downsample(const Level &level) -> Level {
+  Level result;
+  result.width = std::max<size_t>(level.width / 2, 1);
+  result.height = std::max<size_t>(level.height / 2, 1);
+  result.pixels.resize(result.width * result.height);
+  for (size_t y = 0; y != result.height; ++y) {
+    const size_t y0 = std::min(y * 2, level.height - 1);
+    const size_t y1 = std::min(y * 2 + 1, level.height - 1);
+    for (size_t x = 0; x != result.width; ++x) {
+      const size_t x0 = std::min(x * 2, level.width - 1);
+      const size_t x1 = std::min(x * 2 + 1, level.width - 1);
+      for (size_t channel = 0; channel != 4; ++channel) {
+        const unsigned sum = level.pixels[y0 * level.width + x0].at(channel) +
+                             level.pixels[y0 * level.width + x1].at(channel) +
+                             level.pixels[y1 * level.width + x0].at(channel) +
+                             level.pixels[y1 * level.width + x1].at(channel);
+        result.pixels[y * result.width + x].at(channel) =
+            static_cast<uint8_t>((sum + 2) / 4);
+      }
+    }
+  }
+  return result;
+}
+
+// The 4x4 block at block coordinates `bx`, `by`. Blocks over the edge of
+// small levels repeat the last row and column.
+auto read_block(const Level &level, size_t bx, size_t by) -> Block {
+  Block block{};
+  for (size_t y = 0; y != block_size; ++y) {
+    const size_t source_y = std::min(by * block_size + y, level.height - 1);
+    for (size_t x = 0; x != block_size; ++x) {
+      const size_t source_x = std::min(bx * block_size + x, level.width - 1);
+      block.at(y * block_size + x) =
+          level.pixels[source_y * level.width + source_x];
+    }
+  }
+  return block;
+}
+
+auto to_color(const Pixel &pixel) -> Color {
+  return {static_cast<float>(pixel[0]), static_cast<float>(pixel[1]),
+          static_cast<float>(pixel[2])};
+}
+
+auto distance2(const Color &lhs, const Color &rhs) -> float {
+  float result = 0.0F;
+  for (size_t i = 0; i != 3; ++i) {
+    result += (lhs.at(i) - rhs.at(i)) * (lhs.at(i) - rhs.at(i));
+  }
+  return result;
+}
+
+auto to_565(const Color &color) -> uint16_t {
+  auto quantize = [](float value, float max) {
+    return static_cast<unsigned>(
+        std::clamp(std::lround(value * max / 255.0F), 0L,
+                   static_cast<long>(max)));
+  };
+  return static_cast<uint16_t>((quantize(color[0], 31.0F) << 11U) |
+                               (quantize(color[1], 63.0F) << 5U) |
+                               quantize(color[2], 31.0F));
+}
+
+// Expands like the hardware does, replicating the high bits
+auto from_565(uint16_t value) -> Color {
+  const unsigned r = (value >> 11U) & 0x1FU;
+  const unsigned g = (value >> 5U) & 0x3FU;
+  const unsigned b = value & 0x1FU;
+  return {static_cast<float>((r << 3U) | (r >> 2U)),
+          static_cast<float>((g << 2U) | (g >> 4U)),
+          static_cast<float>((b << 3U) | (b >> 2U))};
+}
+
+void write16(std::byte *out, uint16_t value) {
+  out[0] = static_cast<std::byte>(value & 0xFFU);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  out[1] = static_cast<std::byte>(value >> 8U);
+}
+
+// Endpoints at the extremes of the block along its principal axis, pulled
+// in a little as the interpolated colors rarely reach them
+void encode_color_block(const Block &block, std::byte *out) {
+  constexpr int power_iterations = 4;
+  constexpr float inset = 1.0F / 16.0F;
+
+  Color mean{};
+  for (const auto &pixel : block) {
+    const auto color = to_color(pixel);
+    for (size_t i = 0; i != 3; ++i) {
+      mean.at(i) += color.at(i) / static_cast<float>(block.size());
+    }
+  }
+  std::array<float, 6> covariance{};
+  for (const auto &pixel : block) {
+    const auto color = to_color(pixel);
+    const Color d = {color[0] - mean[0], color[1] - mean[1],
+                     color[2] - mean[2]};
+    covariance[0] += d[0] * d[0];
+    covariance[1] += d[0] * d[1];
+    covariance[2] += d[0] * d[2];
+    covariance[3] += d[1] * d[1];
+    covariance[4] += d[1] * d[2];
+    covariance[5] += d[2] * d[2];
+  }
+  Color axis = {1.0F, 1.0F, 1.0F};
+  for (int iteration = 0; iteration != power_iterations; ++iteration) {
+    const Color next = {
+        covariance[0] * axis[0] + covariance[1] * axis[1] +
+            covariance[2] * axis[2],
+        covariance[1] * axis[0] + covariance[3] * axis[1] +
+            covariance[4] * axis[2],
+        covariance[2] * axis[0] + covariance[4] * axis[1] +
+            covariance[5] * axis[2]};
+    const float length = std::sqrt(distance2(next, {}));
+    if (length == 0.0F) {
+      break;
+    }
+    axis = {next[0] / length, next[1] / length, next[2] / length};
+  }
+
+  float low = 0.0F;
+  float high = 0.0F;
+  for (const auto &pixel : block) {
+    const auto color = to_color(pixel);
+    const float t = (color[0] - mean[0]) * axis[0] +
+                    (color[1] - mean[1]) * axis[1] +
+                    (color[2] - mean[2]) * axis[2];
+    low = std::min(low, t);
+    high = std::max(high, t);
+  }
+  const float pull = (high - low) * inset;
+  low += pull;
+  high -= pull;
+  auto endpoint = [&](float t) {
+    return to_565(Color{mean[0] + axis[0] * t, mean[1] + axis[1] * t,
+                        mean[2] + axis[2] * t});
+  };
+  uint16_t color0 = endpoint(high);
+  uint16_t color1 = endpoint(low);
+  // color0 > color1 selects the four color mode, in BC1 as well as BC3
+  if (color0 < color1) {
+    std::swap(color0, color1);
+  }
+
+  uint32_t indices = 0;
+  if (color0 != color1) {
+    const auto c0 = from_565(color0);
+    const auto c1 = from_565(color1);
+    std::array<Color, 4> palette{};
+    palette[0] = c0;
+    palette[1] = c1;
+    for (size_t i = 0; i != 3; ++i) {
+      palette[2].at(i) = (2.0F * c0.at(i) + c1.at(i)) / 3.0F;
+      palette[3].at(i) = (c0.at(i) + 2.0F * c1.at(i)) / 3.0F;
+    }
+    for (size_t p = 0; p != block.size(); ++p) {
+      const auto color = to_color(block.at(p));
+      uint32_t best = 0;
+      for (uint32_t candidate = 1; candidate != palette.size(); ++candidate) {
+        if (distance2(color, palette.at(candidate)) <
+            distance2(color, palette.at(best))) {
+          best = candidate;
+        }
+      }
+      indices |= best << (2 * p);
+    }
+  }
+
+  write16(out, color0);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  write16(out + 2, color1);
+  for (size_t i = 0; i != 4; ++i) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    out[4 + i] = static_cast<std::byte>((indices >> (8 * i)) & 0xFFU);
+  }
+}
+
+// Eight interpolated alphas between the extremes of the block
+void encode_alpha_block(const Block &block, std::byte *out) {
+  uint8_t alpha0 = 0;
+  uint8_t alpha1 = std::numeric_limits<uint8_t>::max();
+  for (const auto &pixel : block) {
+    alpha0 = std::max(alpha0, pixel[3]);
+    alpha1 = std::min(alpha1, pixel[3]);
+  }
+
+  uint64_t indices = 0;
+  if (alpha0 != alpha1) {
+    // Codes 0 and 1 are the endpoints, 2 to 7 step from alpha0 to alpha1
+    std::array<int, 8> palette{};
+    palette[0] = alpha0;
+    palette[1] = alpha1;
+    for (int step = 1; step != 7; ++step) {
+      palette.at(static_cast<size_t>(step) + 1) =
+          ((7 - step) * alpha0 + step * alpha1) / 7;
+    }
+    for (size_t p = 0; p != block.size(); ++p) {
+      const int alpha = block.at(p)[3];
+      uint64_t best = 0;
+      for (uint64_t candidate = 1; candidate != palette.size(); ++candidate) {
+        if (std::abs(alpha - palette.at(candidate)) <
+            std::abs(alpha - palette.at(best))) {
+          best = candidate;
+        }
+      }
+      indices |= best << (3 * p);
+    }
+  }
+
+  out[0] = static_cast<std::byte>(alpha0);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  out[1] = static_cast<std::byte>(alpha1);
+  for (size_t i = 0; i != 6; ++i) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    out[2 + i] = static_cast<std::byte>((indices >> (8 * i)) & 0xFFU);
+  }
+}
+
+auto encode_level(const Level &level, GLenum format)
+    -> std::vector<std::byte> {
+  const size_t bytes = block_bytes(format);
+  const size_t blocks_x = (level.width + block_size - 1) / block_size;
+  const size_t blocks_y = (level.height + block_size - 1) / block_size;
+  std::vector<std::byte> result(blocks_x * blocks_y * bytes);
+  auto *out = result.data();
+  for (size_t by = 0; by != blocks_y; ++by) {
+    for (size_t bx = 0; bx != blocks_x; ++bx) {
+      const auto block = read_block(level, bx, by);
+      if (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) {
+        encode_alpha_block(block, out);
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+        encode_color_block(block, out + bc1_block_bytes);
+      } else {
+        encode_color_block(block, out);
+      }
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      out += bytes;
+    }
+  }
+  return result;
+}
+
+} // namespace
+
+auto block_bytes(GLenum format) -> size_t {
+  switch (format) {
+  case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    return bc1_block_bytes;
+  case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+    return bc3_block_bytes;
+  default:
+    throw std::runtime_error("Unsupported compressed texture format!");
+  }
+}
+
+auto mip_level_count(GLsizei width, GLsizei height) -> size_t {
+  size_t count = 1;
+  for (auto size = std::max(width, height); size > 1; size /= 2) {
+    ++count;
+  }
+  return count;
+}
+
+auto level_bytes(GLenum format, GLsizei width, GLsizei height) -> size_t {
+  const auto blocks = [](GLsizei size) {
+    return (static_cast<size_t>(size) + block_size - 1) / block_size;
+  };
+  return blocks(width) * blocks(height) * block_bytes(format);
+}
+
+auto compress(const SDL_Surface &surface) -> CompressedImage {
+  Timer timer("Compressing texture took ");
+  auto level = read_surface(surface);
+  const bool opaque =
+      std::all_of(level.pixels.begin(), level.pixels.end(),
+                  [](const Pixel &pixel) { return pixel[3] == 255; });
+
+  CompressedImage image;
+  image.format = opaque ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+                        : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+  image.width = surface.w;
+  image.height = surface.h;
+  const auto count = mip_level_count(image.width, image.height);
+  image.levels.reserve(count);
+  for (size_t index = 0; index != count; ++index) {
+    if (index != 0) {
+      level = downsample(level);
+    }
+    image.levels.emplace_back(encode_level(level, image.format));
+  }
+  return image;
+}
+
+} // namespace texture
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "utils/SDL.hpp"
+#include <GL/glew.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace texture {
+
+// Bump whenever the encoder output changes, so cached textures are rebuilt
+constexpr uint32_t encoder_version = 1;
+
+// A block compressed texture with its whole mip chain, ready for
+// glCompressedTexSubImage3D
+struct CompressedImage {
+  // GL_COMPRESSED_RGB_S3TC_DXT1_EXT or GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+  GLenum format = 0;
+  GLsizei width = 0;
+  GLsizei height = 0;
+  // Down to 1x1, the base level first. Blocks are stored row by row.
+  std::vector<std::vector<std::byte>> levels;
+};
+
+// Bytes per 4x4 block of `format`
+auto block_bytes(GLenum format) -> size_t;
+// Levels of a full mip chain for a `width` x `height` texture
+auto mip_level_count(GLsizei width, GLsizei height) -> size_t;
+// Bytes of one level of a texture of `format`
+auto level_bytes(GLenum format, GLsizei width, GLsizei height) -> size_t;
+
+// Builds the mip chain of an RGBA32 surface and compresses every level, to
+// BC1 if the surface is opaque and to BC3 otherwise
+auto compress(const SDL_Surface &surface) -> CompressedImage;
+
+} // namespace texture
@@ -0,0 +1,481 @@
+#include "utils/texture_atlas.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace gl {
+
+namespace {
+
+// Arrays double up to this many layers, then another one is started. It's
+// the minimum GL_MAX_ARRAY_TEXTURE_LAYERS of OpenGL 4.1.
+constexpr GLsizei max_array_layers = 256;
+
+// Coarser mip levels of atlas layers would blend neighbouring tiles
+constexpr GLsizei atlas_max_level = 6;
+
+auto is_compressed(GLenum format) -> bool { return format != GL_RGBA8; }
+
+auto level_size(GLsizei size, GLsizei level) -> GLsizei {
+  return std::max(size >> level, 1);
+}
+
+// Levels of a full mip chain
+auto mip_levels(GLsizei width, GLsizei height) -> GLsizei {
+  GLsizei levels = 1;
+  while (level_size(std::max(width, height), levels - 1) > 1) {
+    ++levels;
+  }
+  return levels;
+}
+
+} // namespace
+
+TextureAtlas::~TextureAtlas() {
+  for (const auto &array : arrays_) {
+    glDeleteTextures(1, &array.texture);
+  }
+  glDeleteFramebuffers(1, &framebuffer_);
+  glDeleteFramebuffers(1, &draw_framebuffer_);
+}
+
+auto TextureAtlas::allocate(sdl2::unique_ptr<SDL_Surface> surface)
+    -> Handle {
+  if (!surface) {
+    throw std::runtime_error("Can't add a missing texture to the atlas!");
+  }
+  const bool small = surface->w <= atlas_max_tile_texture &&
+                     surface->h <= atlas_max_tile_texture;
+
+  TextureArray shape;
+  shape.width = small ? atlas_layer_size : surface->w;
+  shape.height = small ? atlas_layer_size : surface->h;
+  shape.tile_size = small ? atlas_tile_size : 0;
+  shape.levels =
+      small ? atlas_max_level + 1 : mip_levels(shape.width, shape.height);
+
+  Allocation allocation;
+  allocation.array = find_array(shape);
+  allocation.width = surface->w;
+  allocation.height = surface->h;
+  allocation.pending = std::move(surface);
+  return add_allocation(std::move(allocation));
+}
+
+auto TextureAtlas::allocate(texture::CompressedImage image) -> Handle {
+  if (image.levels.empty()) {
+    throw std::runtime_error("Can't add a missing texture to the atlas!");
+  }
+  TextureArray shape;
+  shape.format = image.format;
+  shape.width = image.width;
+  shape.height = image.height;
+  shape.levels = static_cast<GLsizei>(image.levels.size());
+
+  Allocation allocation;
+  allocation.array = find_array(shape);
+  allocation.width = image.width;
+  allocation.height = image.height;
+  allocation.compressed = std::move(image);
+  return add_allocation(std::move(allocation));
+}
+
+auto TextureAtlas::add_allocation(Allocation &&allocation) -> Handle {
+  auto &array = arrays_[allocation.array];
+  allocation.slot = array.free_slots.back();
+  array.free_slots.pop_back();
+  ++array.used;
+  allocation.in_use = true;
+
+  Handle handle = 0;
+  if (free_handles_.empty()) {
+    handle = static_cast<Handle>(allocations_.size());
+    allocations_.emplace_back(std::move(allocation));
+  } else {
+    handle = free_handles_.back();
+    free_handles_.pop_back();
+    allocations_[handle] = std::move(allocation);
+  }
+  return handle;
+}
+
+void TextureAtlas::free(const Handle handle) {
+  auto &allocation = allocations_.at(handle);
+  auto &array = arrays_[allocation.array];
+  array.free_slots.push_back(allocation.slot);
+  if (--array.used == 0) {
+    // Its entry in `arrays_` is reused by the next new array
+    glDeleteTextures(1, &array.texture);
+    array = TextureArray();
+  }
+  allocation = Allocation();
+  free_handles_.push_back(handle);
+}
+
+auto TextureAtlas::upload(const Handle handle, const size_t max_bytes)
+    -> size_t {
+  auto &allocation = allocations_.at(handle);
+  if (!allocation.compressed.levels.empty()) {
+    return upload_compressed(allocation, max_bytes);
+  }
+  auto &pending = allocation.pending;
+  if (!pending) {
+    return 0;
+  }
+  const auto width = static_cast<size_t>(allocation.width);
+  const auto height = static_cast<size_t>(allocation.height);
+  const size_t row_bytes = width * 4;
+  const size_t first_row = allocation.uploaded_rows;
+  const size_t row_count =
+      std::clamp<size_t>(max_bytes / row_bytes, 1, height - first_row);
+  const auto row = [&pending](size_t index) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    return static_cast<const char *>(pending->pixels) +
+           index * static_cast<size_t>(pending->pitch);
+  };
+
+  const auto &array = arrays_[allocation.array];
+  const auto origin = slot_origin(array, allocation.slot);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+  const auto padding = static_cast<size_t>(gutter(array));
+  if (padding == 0) {
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, pending->pitch / 4);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, origin.x,
+                    origin.y + static_cast<GLint>(first_row), origin.layer,
+                    static_cast<GLsizei>(width),
+                    static_cast<GLsizei>(row_count), 1, GL_RGBA,
+                    GL_UNSIGNED_BYTE, row(first_row));
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  } else {
+    // The gutter repeats the outermost texels: beside every row, above the
+    // first one and below the last one
+    const size_t above = first_row == 0 ? padding : 0;
+    const size_t below = first_row + row_count == height ? padding : 0;
+    const size_t padded_width = width + 2 * padding;
+    const size_t padded_rows = above + row_count + below;
+    std::vector<uint32_t> staging(padded_width * padded_rows);
+    for (size_t y = 0; y != padded_rows; ++y) {
+      const auto source =
+          std::clamp(first_row + y, above, above + height - 1) - above;
+      const auto begin = staging.begin() +
+                         static_cast<std::ptrdiff_t>(y * padded_width);
+      const auto texels = begin + static_cast<std::ptrdiff_t>(padding);
+      std::memcpy(&*texels, row(source), row_bytes);
+      std::fill(begin, texels, *texels);
+      std::fill(texels + static_cast<std::ptrdiff_t>(width),
+                begin + static_cast<std::ptrdiff_t>(padded_width),
+                *(texels + static_cast<std::ptrdiff_t>(width - 1)));
+    }
+    glTexSubImage3D(
+        GL_TEXTURE_2D_ARRAY, 0, origin.x - static_cast<GLint>(padding),
+        origin.y + static_cast<GLint>(first_row) - static_cast<GLint>(above),
+        origin.layer, static_cast<GLsizei>(padded_width),
+        static_cast<GLsizei>(padded_rows), 1, GL_RGBA, GL_UNSIGNED_BYTE,
+        staging.data());
+  }
+  allocation.uploaded_rows += row_count;
+
+  if (allocation.uploaded_rows == height) {
+    generate_mipmaps(array, allocation.slot);
+    pending.reset();
+  }
+  return row_count * row_bytes;
+}
+
+auto TextureAtlas::upload_compressed(Allocation &allocation,
+                                     const size_t max_bytes) -> size_t {
+  auto &image = allocation.compressed;
+  const auto &array = arrays_[allocation.array];
+  const auto origin = slot_origin(array, allocation.slot);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+
+  size_t written = 0;
+  while (allocation.uploaded_level != image.levels.size()) {
+    const auto level = static_cast<GLsizei>(allocation.uploaded_level);
+    const GLsizei width = level_size(image.width, level);
+    const GLsizei height = level_size(image.height, level);
+    const auto block_rows = static_cast<size_t>(height + 3) / 4;
+    const size_t row_bytes = texture::level_bytes(image.format, width, 1);
+    // At least one row per call, but never past the budget after that. The
+    // first row alone may already exceed it.
+    if (written != 0 &&
+        (written >= max_bytes || max_bytes - written < row_bytes)) {
+      break;
+    }
+    const size_t row_count =
+        std::clamp<size_t>((max_bytes - written) / row_bytes, 1,
+                           block_rows - allocation.uploaded_rows);
+    // Sub-images have to cover whole blocks or end at the level's edge
+    const auto y = static_cast<GLint>(allocation.uploaded_rows * 4);
+    const auto rows_height =
+        std::min(static_cast<GLsizei>(row_count * 4), height - y);
+    const auto &blocks = image.levels[allocation.uploaded_level];
+    glCompressedTexSubImage3D(
+        GL_TEXTURE_2D_ARRAY, level, 0, y, origin.layer, width, rows_height,
+        1, image.format, static_cast<GLsizei>(row_count * row_bytes),
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+        blocks.data() + allocation.uploaded_rows * row_bytes);
+    written += row_count * row_bytes;
+    allocation.uploaded_rows += row_count;
+    if (allocation.uploaded_rows == block_rows) {
+      ++allocation.uploaded_level;
+      allocation.uploaded_rows = 0;
+    }
+  }
+
+  if (allocation.uploaded_level == image.levels.size()) {
+    image = texture::CompressedImage();
+  }
+  return written;
+}
+
+auto TextureAtlas::pending_bytes(const Handle handle) const -> size_t {
+  const auto &allocation = allocations_.at(handle);
+  const auto &image = allocation.compressed;
+  if (!image.levels.empty()) {
+    size_t bytes = 0;
+    for (size_t level = allocation.uploaded_level;
+         level != image.levels.size(); ++level) {
+      bytes += image.levels[level].size();
+    }
+    // A level with a height of one block row has the size of one row
+    const auto row_bytes = texture::level_bytes(
+        image.format,
+        level_size(image.width,
+                   static_cast<GLsizei>(allocation.uploaded_level)),
+        1);
+    return bytes - allocation.uploaded_rows * row_bytes;
+  }
+  if (!allocation.pending) {
+    return 0;
+  }
+  return (static_cast<size_t>(allocation.height) - allocation.uploaded_rows) *
+         static_cast<size_t>(allocation.width) * 4;
+}
+
+auto TextureAtlas::get_region(const Handle handle) const -> AtlasRegion {
+  const auto &allocation = allocations_.at(handle);
+  const auto &array = arrays_[allocation.array];
+  const auto origin = slot_origin(array, allocation.slot);
+  const auto layer_size = glm::vec2(array.width, array.height);
+  return {allocation.array, origin.layer,
+          glm::vec2(origin.x, origin.y) / layer_size,
+          glm::vec2(allocation.width, allocation.height) / layer_size};
+}
+
+void TextureAtlas::bind(const size_t array) const {
+  glBindTexture(GL_TEXTURE_2D_ARRAY, arrays_.at(array).texture);
+}
+
+auto TextureAtlas::find_array(const TextureArray &shape) -> size_t {
+  for (size_t index = 0; index != arrays_.size(); ++index) {
+    auto &array = arrays_[index];
+    const bool compatible = array.texture != 0 &&
+                            array.format == shape.format &&
+                            array.tile_size == shape.tile_size &&
+                            array.width == shape.width &&
+                            array.height == shape.height;
+    if (!compatible) {
+      continue;
+    }
+    if (!array.free_slots.empty()) {
+      return index;
+    }
+    if (array.layers * 2 <= max_array_layers) {
+      grow(array);
+      return index;
+    }
+  }
+
+  auto array = shape;
+  array.layers = 1;
+  glGenTextures(1, &array.texture);
+  allocate_storage(array, array.texture, array.layers);
+  // Lowest slots are handed out first
+  for (auto slot = slots_per_layer(array); slot != 0; --slot) {
+    array.free_slots.push_back(slot - 1);
+  }
+
+  const auto vacant = std::find_if(
+      arrays_.begin(), arrays_.end(),
+      [](const TextureArray &candidate) { return candidate.texture == 0; });
+  if (vacant != arrays_.end()) {
+    *vacant = std::move(array);
+    return static_cast<size_t>(vacant - arrays_.begin());
+  }
+  arrays_.emplace_back(std::move(array));
+  return arrays_.size() - 1;
+}
+
+void TextureAtlas::grow(TextureArray &array) {
+  const GLsizei layers = array.layers * 2;
+  GLuint texture = 0;
+  glGenTextures(1, &texture);
+  allocate_storage(array, texture, layers);
+  copy_layers(array, texture);
+  glDeleteTextures(1, &array.texture);
+  array.texture = texture;
+
+  const auto old_slots = slots_per_layer(array) * array.layers;
+  array.layers = layers;
+  for (auto slot = slots_per_layer(array) * array.layers; slot != old_slots;
+       --slot) {
+    array.free_slots.push_back(slot - 1);
+  }
+}
+
+void TextureAtlas::copy_layers(const TextureArray &array, GLuint texture) {
+  if (is_compressed(array.format)) {
+    // Compressed formats can't be rendered to. Every level goes through a
+    // pixel buffer instead, which keeps the copy on the GPU.
+    GLuint buffer = 0;
+    glGenBuffers(1, &buffer);
+    for (GLsizei level = 0; level != array.levels; ++level) {
+      const auto size = static_cast<GLsizei>(
+          texture::level_bytes(array.format, level_size(array.width, level),
+                               level_size(array.height, level)) *
+          static_cast<size_t>(array.layers));
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+      glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_COPY);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+      glGetCompressedTexImage(GL_TEXTURE_2D_ARRAY, level, nullptr);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+      glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+                                level_size(array.width, level),
+                                level_size(array.height, level), array.layers,
+                                array.format, size, nullptr);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    glDeleteBuffers(1, &buffer);
+    return;
+  }
+
+  // GL 4.1 has no glCopyImageSubData, so every level of every layer is read
+  // back through a framebuffer
+  if (framebuffer_ == 0) {
+    glGenFramebuffers(1, &framebuffer_);
+  }
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer_);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+  for (GLsizei level = 0; level != array.levels; ++level) {
+    for (GLsizei layer = 0; layer != array.layers; ++layer) {
+      glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                array.texture, level, layer);
+      glCopyTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, 0, 0,
+                          level_size(array.width, level),
+                          level_size(array.height, level));
+    }
+  }
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+void TextureAtlas::generate_mipmaps(const TextureArray &array,
+                                    const uint32_t slot) {
+  // Tiles start on multiples of the tile size, so down to the coarsest level
+  // none of their texels is shared with a neighbour. Whole layers of other
+  // textures stay untouched, unlike with glGenerateMipmap.
+  const auto origin = slot_origin(array, slot);
+  const GLint x = array.tile_size == 0 ? 0 : origin.x - gutter(array);
+  const GLint y = array.tile_size == 0 ? 0 : origin.y - gutter(array);
+  const GLsizei width = array.tile_size == 0 ? array.width : array.tile_size;
+  const GLsizei height =
+      array.tile_size == 0 ? array.height : array.tile_size;
+
+  if (framebuffer_ == 0) {
+    glGenFramebuffers(1, &framebuffer_);
+  }
+  if (draw_framebuffer_ == 0) {
+    glGenFramebuffers(1, &draw_framebuffer_);
+  }
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer_);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw_framebuffer_);
+  for (GLsizei level = 1; level < array.levels; ++level) {
+    glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              array.texture, level - 1, origin.layer);
+    glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              array.texture, level, origin.layer);
+    // Halving with linear filtering averages every 2x2 block
+    const GLint source_x = x >> static_cast<unsigned>(level - 1);
+    const GLint source_y = y >> static_cast<unsigned>(level - 1);
+    const GLint target_x = x >> static_cast<unsigned>(level);
+    const GLint target_y = y >> static_cast<unsigned>(level);
+    glBlitFramebuffer(source_x, source_y,
+                      source_x + level_size(width, level - 1),
+                      source_y + level_size(height, level - 1), target_x,
+                      target_y, target_x + level_size(width, level),
+                      target_y + level_size(height, level),
+                      GL_COLOR_BUFFER_BIT, GL_LINEAR);
+  }
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+void TextureAtlas::allocate_storage(const TextureArray &array,
+                                    GLuint texture, GLsizei layers) {
+  glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+  if (is_compressed(array.format)) {
+    // Every level is uploaded, nothing is generated on the GPU
+    for (GLsizei level = 0; level != array.levels; ++level) {
+      const auto width = level_size(array.width, level);
+      const auto height = level_size(array.height, level);
+      const auto size = static_cast<GLsizei>(
+          texture::level_bytes(array.format, width, height) *
+          static_cast<size_t>(layers));
+      glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, array.format, width,
+                             height, layers, 0, size, nullptr);
+    }
+  } else {
+    // Reserve storage for every level, the pixels of the base level are
+    // uploaded separately and the others built from it
+    for (GLsizei level = 0; level != array.levels; ++level) {
+      glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8,
+                   level_size(array.width, level),
+                   level_size(array.height, level), layers, 0, GL_RGBA,
+                   GL_UNSIGNED_BYTE, nullptr);
+    }
+  }
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL,
+                  array.levels - 1);
+  // Tiles are wrapped by the shader, inside the texture's region. Textures
+  // with layers of their own wrap like any other texture.
+  const GLint wrap = array.tile_size == 0 ? GL_REPEAT : GL_CLAMP_TO_EDGE;
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, wrap);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, wrap);
+  // Nice trilinear filtering with mipmaps
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+}
+
+auto TextureAtlas::slots_per_layer(const TextureArray &array) -> uint32_t {
+  if (array.tile_size == 0) {
+    return 1;
+  }
+  return static_cast<uint32_t>((array.width / array.tile_size) *
+                               (array.height / array.tile_size));
+}
+
+auto TextureAtlas::slot_origin(const TextureArray &array, uint32_t slot)
+    -> SlotOrigin {
+  const auto per_layer = slots_per_layer(array);
+  const auto tile = slot % per_layer;
+  const auto tiles_per_row =
+      array.tile_size == 0
+          ? 1U
+          : static_cast<uint32_t>(array.width / array.tile_size);
+  return {static_cast<GLint>(tile % tiles_per_row) * array.tile_size +
+              gutter(array),
+          static_cast<GLint>(tile / tiles_per_row) * array.tile_size +
+              gutter(array),
+          static_cast<GLint>(slot / per_layer)};
+}
+
+auto TextureAtlas::gutter(const TextureArray &array) -> GLsizei {
+  return array.tile_size == 0 ? 0 : atlas_tile_gutter;
+}
+
+} // namespace gl
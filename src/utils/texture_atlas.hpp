@@ -0,0 +1,130 @@
+#pragma once
+
+#include "utils/SDL.hpp"
+#include "utils/texture/texture_compressor.hpp"
+#include <GL/glew.h>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+#include <vector>
+
+namespace gl {
+
+constexpr GLsizei atlas_tile_size = 256;
+constexpr GLsizei atlas_layer_size = 2048;
+// Every tile repeats the edge texels of its texture this far around it, so
+// filtering near the edge doesn't blend in the neighbouring tiles
+constexpr GLsizei atlas_tile_gutter = 8;
+// Textures up to this size share the layers of atlas arrays, one tile each
+constexpr GLsizei atlas_max_tile_texture =
+    atlas_tile_size - 2 * atlas_tile_gutter;
+
+// Where a texture ended up. The shader maps the wrapped uv into
+// [uv_offset, uv_offset + uv_scale] of `layer`, which is the whole layer for
+// textures that don't share it.
+struct AtlasRegion {
+  size_t array;
+  GLint layer;
+  glm::vec2 uv_offset;
+  glm::vec2 uv_scale;
+};
+
+// Packs textures into GL_TEXTURE_2D_ARRAYs, so models with different
+// textures can share a bind and a draw. Textures of the same size and format
+// get whole layers of one array, small RGBA8 ones get tiles of atlas layers.
+// Arrays grow by doubling their layers when full.
+struct TextureAtlas {
+  using Handle = uint32_t;
+  static constexpr Handle no_handle = std::numeric_limits<Handle>::max();
+
+  TextureAtlas() = default;
+  ~TextureAtlas();
+
+  TextureAtlas(const TextureAtlas &) = delete;
+  TextureAtlas(TextureAtlas &&other) noexcept = delete;
+  auto operator=(const TextureAtlas &) -> TextureAtlas & = delete;
+  auto operator=(TextureAtlas &&other) noexcept -> TextureAtlas & = delete;
+
+  // Reserves room for the surface, its pixels are written by `upload`
+  auto allocate(sdl2::unique_ptr<SDL_Surface> surface) -> Handle;
+  // Compressed textures always get whole layers, with their own mip chain
+  auto allocate(texture::CompressedImage image) -> Handle;
+  void free(Handle handle);
+
+  // Writes whole rows of the texture, at least one and at most `max_bytes`
+  // worth, and rebuilds the mipmaps of its tile or layer after the last one.
+  // Compressed textures are written a row of blocks at a time, level by
+  // level. Returns the number of bytes written.
+  auto upload(Handle handle, size_t max_bytes) -> size_t;
+  [[nodiscard]] auto pending_bytes(Handle handle) const -> size_t;
+
+  [[nodiscard]] auto get_region(Handle handle) const -> AtlasRegion;
+  void bind(size_t array) const;
+
+private:
+  struct TextureArray {
+    GLuint texture = 0;
+    // GL_RGBA8 or a compressed format
+    GLenum format = GL_RGBA8;
+    // Layer size
+    GLsizei width = 0;
+    GLsizei height = 0;
+    GLsizei layers = 0;
+    // Zero if every texture takes a whole layer
+    GLsizei tile_size = 0;
+    // Uploaded for compressed arrays, built on the GPU for the others
+    GLsizei levels = 1;
+    // Layers for whole-layer arrays, tiles otherwise
+    std::vector<uint32_t> free_slots;
+    size_t used = 0;
+  };
+
+  struct Allocation {
+    size_t array = 0;
+    uint32_t slot = 0;
+    GLsizei width = 0;
+    GLsizei height = 0;
+    sdl2::unique_ptr<SDL_Surface> pending;
+    // Pending while it has levels
+    texture::CompressedImage compressed;
+    size_t uploaded_level = 0;
+    // Rows of blocks for compressed textures
+    size_t uploaded_rows = 0;
+    bool in_use = false;
+  };
+
+  struct SlotOrigin {
+    GLint x;
+    GLint y;
+    GLint layer;
+  };
+
+  // Returns an array like `shape` with a free slot
+  auto find_array(const TextureArray &shape) -> size_t;
+  auto add_allocation(Allocation &&allocation) -> Handle;
+  auto upload_compressed(Allocation &allocation, size_t max_bytes) -> size_t;
+  void grow(TextureArray &array);
+  // Rebuilds the mip levels of the tile at `slot` from its base level, or
+  // those of the whole layer if the array isn't tiled
+  void generate_mipmaps(const TextureArray &array, uint32_t slot);
+  // Copies the layers of `array` into the first layers of `texture`
+  void copy_layers(const TextureArray &array, GLuint texture);
+  // Creates the storage of `texture` for `layers` layers shaped like `array`
+  static void allocate_storage(const TextureArray &array, GLuint texture,
+                               GLsizei layers);
+  [[nodiscard]] static auto slots_per_layer(const TextureArray &array)
+      -> uint32_t;
+  // Where the texture in `slot` starts, inside the gutter of its tile
+  [[nodiscard]] static auto slot_origin(const TextureArray &array,
+                                        uint32_t slot) -> SlotOrigin;
+  [[nodiscard]] static auto gutter(const TextureArray &array) -> GLsizei;
+
+  std::vector<TextureArray> arrays_;
+  std::vector<Allocation> allocations_;
+  std::vector<Handle> free_handles_;
+  GLuint framebuffer_ = 0;
+  GLuint draw_framebuffer_ = 0;
+};
+
+} // namespace gl
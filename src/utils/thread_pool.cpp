@@ -0,0 +1,124 @@
+#include "utils/thread_pool.hpp"
+
+#include <limits>
+
+namespace {
+
+constexpr size_t no_worker = std::numeric_limits<size_t>::max();
+
+// Which pool the current thread works for, and its index there
+thread_local const ThreadPool *current_pool = nullptr;
+thread_local size_t current_worker = no_worker;
+
+} // namespace
+
+ThreadPool::ThreadPool(size_t thread_count) {
+  workers_.reserve(thread_count);
+  for (size_t i = 0; i != thread_count; ++i) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+  threads_.reserve(thread_count);
+  for (size_t i = 0; i != thread_count; ++i) {
+    threads_.emplace_back([this, i]() { work(i); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock(mutex_);
+    stopping_ = true;
+  }
+  condition_.notify_all();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+}
+
+auto ThreadPool::instance() -> ThreadPool & {
+  static ThreadPool pool(std::max(std::thread::hardware_concurrency(), 1U));
+  return pool;
+}
+
+auto ThreadPool::size() const -> size_t { return threads_.size(); }
+
+auto ThreadPool::take_timeline() -> PoolTimeline {
+  PoolTimeline timeline;
+  timeline.begin = timeline_begin_;
+  timeline.end = std::chrono::steady_clock::now();
+  timeline_begin_ = timeline.end;
+  timeline.workers.resize(workers_.size());
+  for (size_t i = 0; i != workers_.size(); ++i) {
+    auto &worker = *workers_[i];
+    std::lock_guard lock(worker.mutex);
+    std::swap(timeline.workers[i], worker.spans);
+  }
+  return timeline;
+}
+
+void ThreadPool::enqueue(std::function<void()> task) {
+  // Workers keep what they spawn, the rest is dealt out in turn
+  const size_t index = current_pool == this
+                           ? current_worker
+                           : next_worker_++ % workers_.size();
+  {
+    std::lock_guard lock(mutex_);
+    auto &worker = *workers_[index];
+    std::lock_guard worker_lock(worker.mutex);
+    worker.tasks.push_back(std::move(task));
+    ++queued_;
+  }
+  condition_.notify_one();
+}
+
+auto ThreadPool::take(const size_t index, std::function<void()> &task)
+    -> bool {
+  {
+    auto &own = *workers_[index];
+    std::lock_guard lock(own.mutex);
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      --queued_;
+      return true;
+    }
+  }
+  for (size_t i = 1; i != workers_.size(); ++i) {
+    auto &victim = *workers_[(index + i) % workers_.size()];
+    std::lock_guard lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      --queued_;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::work(const size_t index) {
+  current_pool = this;
+  current_worker = index;
+  auto &worker = *workers_[index];
+  while (true) {
+    std::function<void()> task;
+    if (!take(index, task)) {
+      std::unique_lock lock(mutex_);
+      condition_.wait(lock, [this]() { return stopping_ || queued_ != 0; });
+      if (stopping_ && queued_ == 0) {
+        return;
+      }
+      // Another worker may still get there first, look again
+      continue;
+    }
+
+    const auto begin = std::chrono::steady_clock::now();
+    task();
+    const auto end = std::chrono::steady_clock::now();
+    std::lock_guard lock(worker.mutex);
+    if (worker.spans.size() == max_spans) {
+      worker.spans.back().end = end;
+    } else {
+      worker.spans.push_back({begin, end});
+    }
+  }
+}
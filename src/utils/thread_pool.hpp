@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Stretch of time a worker spent running tasks
+struct BusySpan {
+  std::chrono::steady_clock::time_point begin;
+  std::chrono::steady_clock::time_point end;
+};
+
+// What every worker did between two calls to `ThreadPool::take_timeline`
+struct PoolTimeline {
+  std::chrono::steady_clock::time_point begin;
+  std::chrono::steady_clock::time_point end;
+  // Per worker, in the order the tasks finished
+  std::vector<std::vector<BusySpan>> workers;
+};
+
+// Every worker has a deque of its own. Tasks submitted by a worker go to the
+// back of its deque and are run from there, newest first, while idle workers
+// steal the oldest ones from the front of the others. Tasks from other
+// threads are spread over the workers in turn.
+struct ThreadPool {
+  explicit ThreadPool(size_t thread_count);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool(ThreadPool &&other) noexcept = delete;
+  auto operator=(const ThreadPool &) -> ThreadPool & = delete;
+  auto operator=(ThreadPool &&other) noexcept -> ThreadPool & = delete;
+
+  // Pool shared by the whole application, one thread per hardware thread
+  static auto instance() -> ThreadPool &;
+
+  template <typename Function>
+  auto submit(Function &&function)
+      -> std::future<std::invoke_result_t<std::decay_t<Function>>>;
+
+  // Calls `function(i)` for every i in [0, count) and waits for all of them.
+  // The calling thread takes part, so this is safe to call from a worker.
+  template <typename Function>
+  void parallel_for(size_t count, Function &&function);
+
+  // Calls `function(begin, end)` for consecutive ranges of at most
+  // `batch_size` covering [0, count). A single batch runs on the calling
+  // thread without involving the workers.
+  template <typename Function>
+  void parallel_for_batches(size_t count, size_t batch_size,
+                            Function &&function);
+
+  // Busy spans of every worker since the last call
+  auto take_timeline() -> PoolTimeline;
+
+  [[nodiscard]] auto size() const -> size_t;
+
+private:
+  // More spans per timeline are merged into the last one
+  static constexpr size_t max_spans = 1024;
+
+  struct Worker {
+    std::deque<std::function<void()>> tasks;
+    std::vector<BusySpan> spans;
+    std::mutex mutex;
+  };
+
+  void enqueue(std::function<void()> task);
+  // Pops the newest task of worker `index` or steals the oldest of another
+  auto take(size_t index, std::function<void()> &task) -> bool;
+  void work(size_t index);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  // Worker the next task from outside the pool goes to
+  std::atomic<size_t> next_worker_ = 0;
+  // Tasks in all deques. Raised while holding `mutex_`, so sleeping workers
+  // never miss one, lowered by whoever takes a task.
+  std::atomic<size_t> queued_ = 0;
+  std::chrono::steady_clock::time_point timeline_begin_ =
+      std::chrono::steady_clock::now();
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  bool stopping_ = false;
+};
+
+#include "utils/thread_pool_impl.hpp"
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "utils/thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+template <typename Function>
+auto ThreadPool::submit(Function &&function)
+    -> std::future<std::invoke_result_t<std::decay_t<Function>>> {
+  using Result = std::invoke_result_t<std::decay_t<Function>>;
+  // std::function needs a copyable target, packaged_task isn't
+  auto task = std::make_shared<std::packaged_task<Result()>>(
+      std::forward<Function>(function));
+  auto future = task->get_future();
+  enqueue([task]() { (*task)(); });
+  return future;
+}
+
+template <typename Function>
+void ThreadPool::parallel_for(const size_t count, Function &&function) {
+  if (count == 0) {
+    return;
+  }
+
+  struct State {
+    std::atomic<size_t> next = 0;
+    size_t done = 0;
+    std::exception_ptr error;
+    std::mutex mutex;
+    std::condition_variable condition;
+  };
+  auto state = std::make_shared<State>();
+
+  // Helpers that start after every index was claimed return immediately, so
+  // they never touch `function` after we've returned
+  auto body = [state, count, &function]() {
+    for (size_t i = state->next++; i < count; i = state->next++) {
+      std::exception_ptr error;
+      try {
+        function(i);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      std::lock_guard lock(state->mutex);
+      if (error && !state->error) {
+        state->error = error;
+      }
+      if (++state->done == count) {
+        state->condition.notify_all();
+      }
+    }
+  };
+
+  const size_t helpers = std::min(threads_.size(), count - 1);
+  for (size_t i = 0; i != helpers; ++i) {
+    enqueue(body);
+  }
+  body();
+
+  std::unique_lock lock(state->mutex);
+  state->condition.wait(lock,
+                        [&state, count]() { return state->done == count; });
+  if (state->error) {
+    std::rethrow_exception(state->error);
+  }
+}
+
+template <typename Function>
+void ThreadPool::parallel_for_batches(const size_t count,
+                                      const size_t batch_size,
+                                      Function &&function) {
+  if (count <= batch_size) {
+    if (count != 0) {
+      function(size_t{0}, count);
+    }
+    return;
+  }
+  const size_t batches = (count + batch_size - 1) / batch_size;
+  parallel_for(batches, [&function, count, batch_size](size_t batch) {
+    const size_t begin = batch * batch_size;
+    function(begin, std::min(begin + batch_size, count));
+  });
+}
@@ -0,0 +1,268 @@
+#include "utils/transform_store.hpp"
+
+#include "utils/thread_pool.hpp"
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMPLE_GRAPHICS_HAS_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Quaternion of rotating about x, then y, then z
+auto euler_to_quaternion(const glm::vec3 &angles) -> glm::vec4 {
+  const float cx = std::cos(angles.x * 0.5F);
+  const float sx = std::sin(angles.x * 0.5F);
+  const float cy = std::cos(angles.y * 0.5F);
+  const float sy = std::sin(angles.y * 0.5F);
+  const float cz = std::cos(angles.z * 0.5F);
+  const float sz = std::sin(angles.z * 0.5F);
+  return {sx * cy * cz - cx * sy * sz, cx * sy * cz + sx * cy * sz,
+          cx * cy * sz - sx * sy * cz, cx * cy * cz + sx * sy * sz};
+}
+
+} // namespace
+
+auto TransformStore::allocate() -> Handle {
+  Handle handle = 0;
+  if (free_handles_.empty()) {
+    handle = static_cast<Handle>(matrices_.size());
+    for (auto *component :
+         {&offset_x_, &offset_y_, &offset_z_, &scale_x_, &scale_y_, &scale_z_,
+          &rotation_x_, &rotation_y_, &rotation_z_, &rotation_w_}) {
+      component->emplace_back();
+    }
+    dirty_.emplace_back();
+    changed_.emplace_back();
+    spinning_.emplace_back();
+    matrices_.emplace_back();
+  } else {
+    handle = free_handles_.back();
+    free_handles_.pop_back();
+  }
+  set_offset(handle, glm::vec3(0.0F));
+  set_scale(handle, glm::vec3(1.0F));
+  set_quaternion(handle, glm::vec4(0.0F, 0.0F, 0.0F, 1.0F));
+  spinning_[handle] = 0;
+  changed_[handle] = 1;
+  matrices_[handle] = glm::mat4(1.0F);
+  return handle;
+}
+
+void TransformStore::free(const Handle handle) {
+  // Nothing reads the slot until it is allocated again
+  dirty_.at(handle) = 0;
+  spinning_[handle] = 0;
+  free_handles_.push_back(handle);
+}
+
+void TransformStore::set_offset(const Handle handle,
+                                const glm::vec3 &offset) {
+  offset_x_.at(handle) = offset.x;
+  offset_y_[handle] = offset.y;
+  offset_z_[handle] = offset.z;
+  dirty_[handle] = 1;
+}
+
+auto TransformStore::get_offset(const Handle handle) const -> glm::vec3 {
+  return {offset_x_.at(handle), offset_y_[handle], offset_z_[handle]};
+}
+
+void TransformStore::set_scale(const Handle handle, const glm::vec3 &scale) {
+  scale_x_.at(handle) = scale.x;
+  scale_y_[handle] = scale.y;
+  scale_z_[handle] = scale.z;
+  dirty_[handle] = 1;
+}
+
+auto TransformStore::get_scale(const Handle handle) const -> glm::vec3 {
+  return {scale_x_.at(handle), scale_y_[handle], scale_z_[handle]};
+}
+
+void TransformStore::set_rotation(const Handle handle,
+                                  const glm::vec3 &angles) {
+  set_quaternion(handle, euler_to_quaternion(angles));
+}
+
+void TransformStore::set_spinning(const Handle handle, const bool spinning) {
+  spinning_.at(handle) = static_cast<uint8_t>(spinning);
+  if (spinning) {
+    set_quaternion(handle, spin_);
+  }
+}
+
+void TransformStore::set_spin(const glm::vec3 &angles) {
+  spin_ = euler_to_quaternion(angles);
+  spin_changed_ = true;
+}
+
+void TransformStore::set_quaternion(const size_t slot,
+                                    const glm::vec4 &rotation) {
+  rotation_x_.at(slot) = rotation.x;
+  rotation_y_[slot] = rotation.y;
+  rotation_z_[slot] = rotation.z;
+  rotation_w_[slot] = rotation.w;
+  dirty_[slot] = 1;
+}
+
+void TransformStore::update() {
+  const size_t count = matrices_.size();
+  if (spin_changed_) {
+    for (size_t slot = 0; slot != count; ++slot) {
+      if (spinning_[slot] != 0) {
+        set_quaternion(slot, spin_);
+      }
+    }
+    spin_changed_ = false;
+  }
+
+  // Batches are a multiple of four slots, so only the last one has a tail
+  constexpr size_t batch_size = 4096;
+  ThreadPool::instance().parallel_for_batches(
+      count, batch_size,
+      [this](size_t begin, size_t end) { update_range(begin, end); });
+}
+
+void TransformStore::update_range(const size_t begin, const size_t end) {
+  // Plain pointers, the byte stores into `dirty_` and `changed_` may alias
+  // anything and would force reloads every iteration
+  const float *offset_x = offset_x_.data();
+  const float *offset_y = offset_y_.data();
+  const float *offset_z = offset_z_.data();
+  const float *scale_x = scale_x_.data();
+  const float *scale_y = scale_y_.data();
+  const float *scale_z = scale_z_.data();
+  const float *rotation_x = rotation_x_.data();
+  const float *rotation_y = rotation_y_.data();
+  const float *rotation_z = rotation_z_.data();
+  const float *rotation_w = rotation_w_.data();
+  uint8_t *dirty = dirty_.data();
+  uint8_t *changed = changed_.data();
+  glm::mat4 *matrices = matrices_.data();
+  size_t i = begin;
+
+  // NOLINTBEGIN(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+#ifdef SIMPLE_GRAPHICS_HAS_SSE2
+  // Four slots per iteration, one in every lane. Batches without a dirty
+  // slot are skipped after a single load.
+  for (; i + 4 <= end; i += 4) {
+    uint32_t dirty_batch = 0;
+    std::memcpy(&dirty_batch, dirty + i, sizeof(dirty_batch));
+    if (dirty_batch == 0) {
+      continue;
+    }
+    const __m128 x = _mm_loadu_ps(rotation_x + i);
+    const __m128 y = _mm_loadu_ps(rotation_y + i);
+    const __m128 z = _mm_loadu_ps(rotation_z + i);
+    const __m128 w = _mm_loadu_ps(rotation_w + i);
+    const __m128 x2 = _mm_add_ps(x, x);
+    const __m128 y2 = _mm_add_ps(y, y);
+    const __m128 z2 = _mm_add_ps(z, z);
+    const __m128 xx = _mm_mul_ps(x, x2);
+    const __m128 yy = _mm_mul_ps(y, y2);
+    const __m128 zz = _mm_mul_ps(z, z2);
+    const __m128 xy = _mm_mul_ps(x, y2);
+    const __m128 xz = _mm_mul_ps(x, z2);
+    const __m128 yz = _mm_mul_ps(y, z2);
+    const __m128 wx = _mm_mul_ps(w, x2);
+    const __m128 wy = _mm_mul_ps(w, y2);
+    const __m128 wz = _mm_mul_ps(w, z2);
+    const __m128 one = _mm_set1_ps(1.0F);
+    const __m128 sx = _mm_loadu_ps(scale_x + i);
+    const __m128 sy = _mm_loadu_ps(scale_y + i);
+    const __m128 sz = _mm_loadu_ps(scale_z + i);
+
+    // Matrix element [column][row] of every lane, scaled by the row's axis
+    __m128 m00 = _mm_mul_ps(sx, _mm_sub_ps(one, _mm_add_ps(yy, zz)));
+    __m128 m01 = _mm_mul_ps(sy, _mm_add_ps(xy, wz));
+    __m128 m02 = _mm_mul_ps(sz, _mm_sub_ps(xz, wy));
+    __m128 m03 = _mm_setzero_ps();
+    __m128 m10 = _mm_mul_ps(sx, _mm_sub_ps(xy, wz));
+    __m128 m11 = _mm_mul_ps(sy, _mm_sub_ps(one, _mm_add_ps(xx, zz)));
+    __m128 m12 = _mm_mul_ps(sz, _mm_add_ps(yz, wx));
+    __m128 m13 = _mm_setzero_ps();
+    __m128 m20 = _mm_mul_ps(sx, _mm_add_ps(xz, wy));
+    __m128 m21 = _mm_mul_ps(sy, _mm_sub_ps(yz, wx));
+    __m128 m22 = _mm_mul_ps(sz, _mm_sub_ps(one, _mm_add_ps(xx, yy)));
+    __m128 m23 = _mm_setzero_ps();
+    __m128 m30 = _mm_loadu_ps(offset_x + i);
+    __m128 m31 = _mm_loadu_ps(offset_y + i);
+    __m128 m32 = _mm_loadu_ps(offset_z + i);
+    __m128 m33 = one;
+    // Lanes become slots: afterwards `mcN` is column c of slot i + N
+    _MM_TRANSPOSE4_PS(m00, m01, m02, m03);
+    _MM_TRANSPOSE4_PS(m10, m11, m12, m13);
+    _MM_TRANSPOSE4_PS(m20, m21, m22, m23);
+    _MM_TRANSPOSE4_PS(m30, m31, m32, m33);
+    auto store = [&](size_t slot, __m128 column0, __m128 column1,
+                     __m128 column2, __m128 column3) {
+      if (dirty[slot] == 0) {
+        return;
+      }
+      float *matrix = &matrices[slot][0][0];
+      _mm_storeu_ps(matrix, column0);
+      _mm_storeu_ps(matrix + 4, column1);
+      _mm_storeu_ps(matrix + 8, column2);
+      _mm_storeu_ps(matrix + 12, column3);
+      dirty[slot] = 0;
+      changed[slot] = 1;
+    };
+    store(i, m00, m10, m20, m30);
+    store(i + 1, m01, m11, m21, m31);
+    store(i + 2, m02, m12, m22, m32);
+    store(i + 3, m03, m13, m23, m33);
+  }
+#endif
+
+  // The slots left over, or all of them without SSE2
+  for (; i != end; ++i) {
+    if (dirty[i] != 0) {
+      compose(i);
+      dirty[i] = 0;
+      changed[i] = 1;
+    }
+  }
+  // NOLINTEND(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+}
+
+void TransformStore::compose(const size_t slot) {
+  const float x = rotation_x_[slot];
+  const float y = rotation_y_[slot];
+  const float z = rotation_z_[slot];
+  const float w = rotation_w_[slot];
+  const float xx = x * (x + x);
+  const float yy = y * (y + y);
+  const float zz = z * (z + z);
+  const float xy = x * (y + y);
+  const float xz = x * (z + z);
+  const float yz = y * (z + z);
+  const float wx = w * (x + x);
+  const float wy = w * (y + y);
+  const float wz = w * (z + z);
+  const glm::vec4 scale(scale_x_[slot], scale_y_[slot], scale_z_[slot], 0.0F);
+
+  auto &matrix = matrices_[slot];
+  matrix[0] = scale * glm::vec4(1.0F - (yy + zz), xy + wz, xz - wy, 0.0F);
+  matrix[1] = scale * glm::vec4(xy - wz, 1.0F - (xx + zz), yz + wx, 0.0F);
+  matrix[2] = scale * glm::vec4(xz + wy, yz - wx, 1.0F - (xx + yy), 0.0F);
+  matrix[3] =
+      glm::vec4(offset_x_[slot], offset_y_[slot], offset_z_[slot], 1.0F);
+}
+
+auto TransformStore::get_matrix(const Handle handle) const
+    -> const glm::mat4 & {
+  return matrices_.at(handle);
+}
+
+auto TransformStore::take_changed(const Handle handle) -> bool {
+  const bool changed = changed_.at(handle) != 0;
+  changed_[handle] = 0;
+  return changed;
+}
+
+auto TransformStore::handle_count() const -> size_t {
+  return matrices_.size();
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+#include <vector>
+
+// Offsets, scales and rotations of many objects, each component in an array
+// of its own, so world matrices are computed four at a time. Objects refer to
+// their slot by handle and freed slots are handed out again.
+//
+// Setters only mark a slot, its matrix is recomputed by the next `update`.
+struct TransformStore {
+  using Handle = uint32_t;
+  static constexpr Handle no_handle = std::numeric_limits<Handle>::max();
+
+  // A slot at the origin, without scale or rotation
+  auto allocate() -> Handle;
+  void free(Handle handle);
+
+  void set_offset(Handle handle, const glm::vec3 &offset);
+  [[nodiscard]] auto get_offset(Handle handle) const -> glm::vec3;
+  void set_scale(Handle handle, const glm::vec3 &scale);
+  [[nodiscard]] auto get_scale(Handle handle) const -> glm::vec3;
+  // Euler angles in radians, applied in x, y, z order
+  void set_rotation(Handle handle, const glm::vec3 &angles);
+  // Spinning slots follow the rotation of `set_spin` instead of their own
+  void set_spinning(Handle handle, bool spinning);
+  void set_spin(const glm::vec3 &angles);
+
+  // Recomputes the matrices of the slots changed since the last call, in
+  // batches spread over the thread pool
+  void update();
+  // translate * scale * rotate, as of the last `update`
+  [[nodiscard]] auto get_matrix(Handle handle) const -> const glm::mat4 &;
+  // Whether an `update` changed the matrix since the last call
+  auto take_changed(Handle handle) -> bool;
+  // Upper bound of all handles in use
+  [[nodiscard]] auto handle_count() const -> size_t;
+
+private:
+  void update_range(size_t begin, size_t end);
+  // Computes the matrix of one slot, the batches do the same four at a time
+  void compose(size_t slot);
+  void set_quaternion(size_t slot, const glm::vec4 &rotation);
+
+  std::vector<float> offset_x_;
+  std::vector<float> offset_y_;
+  std::vector<float> offset_z_;
+  std::vector<float> scale_x_;
+  std::vector<float> scale_y_;
+  std::vector<float> scale_z_;
+  // Unit quaternions, turned into matrices without any trigonometry
+  std::vector<float> rotation_x_;
+  std::vector<float> rotation_y_;
+  std::vector<float> rotation_z_;
+  std::vector<float> rotation_w_;
+  // One byte per slot, so four of them are tested at once
+  std::vector<uint8_t> dirty_;
+  std::vector<uint8_t> changed_;
+  std::vector<uint8_t> spinning_;
+  std::vector<glm::mat4> matrices_;
+  std::vector<Handle> free_handles_;
+  glm::vec4 spin_ = glm::vec4(0.0F, 0.0F, 0.0F, 1.0F);
+  bool spin_changed_ = false;
+};
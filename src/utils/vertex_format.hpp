@@ -0,0 +1,130 @@
+#pragma once
+
+#include "utils/primitives.hpp"
+#include <GL/glew.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+namespace gl {
+
+// Attribute locations declared in shader.vert
+constexpr GLuint position_location = 0;
+constexpr GLuint color_location = 3;
+constexpr GLuint uv_location = 6;
+constexpr std::array<GLuint, 3> attribute_locations = {
+    position_location, color_location, uv_location};
+// Integer attribute naming the per-draw data of a vertex, set up by
+// `GeometryArena` rather than by the vertex layouts
+constexpr GLuint draw_slot_location = 7;
+// First of the three rows of `InstanceTransform`, set up by `InstanceBuffer`
+constexpr GLuint instance_transform_location = 8;
+
+// How one attribute is stored inside a vertex
+struct Attribute {
+  GLuint location;
+  GLint size;
+  GLenum type;
+  GLboolean normalized;
+  size_t offset;
+};
+
+// Lists the attributes of a vertex type. Every vertex type specializes it
+// with a `static constexpr std::array<Attribute, N> attributes`.
+template <typename Vertex> struct VertexLayout;
+
+template <> struct VertexLayout<Vertex> {
+  static constexpr std::array<Attribute, 3> attributes = {{
+      {position_location, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, coord)},
+      {color_location, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, color)},
+      {uv_location, 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, uv)},
+  }};
+};
+
+// 12 bytes instead of 32. Positions are normalized to the mesh bounds and
+// mapped back by `MeshLayout::position_scale` and `position_offset`, the
+// color comes from `MeshLayout::material_color`.
+struct CompactVertex {
+  std::array<uint16_t, 3> coord;
+  uint16_t padding;
+  // Half floats
+  std::array<uint16_t, 2> uv;
+};
+
+template <> struct VertexLayout<CompactVertex> {
+  static constexpr std::array<Attribute, 2> attributes = {{
+      {position_location, 3, GL_UNSIGNED_SHORT, GL_TRUE,
+       offsetof(CompactVertex, coord)},
+      {uv_location, 2, GL_HALF_FLOAT, GL_FALSE, offsetof(CompactVertex, uv)},
+  }};
+};
+
+// `CompactVertex` for meshes with more than one material color
+struct CompactColorVertex {
+  std::array<uint16_t, 3> coord;
+  uint16_t padding;
+  std::array<uint16_t, 2> uv;
+  // RGBA, normalized
+  std::array<uint8_t, 4> color;
+};
+
+template <> struct VertexLayout<CompactColorVertex> {
+  static constexpr std::array<Attribute, 3> attributes = {{
+      {position_location, 3, GL_UNSIGNED_SHORT, GL_TRUE,
+       offsetof(CompactColorVertex, coord)},
+      {color_location, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+       offsetof(CompactColorVertex, color)},
+      {uv_location, 2, GL_HALF_FLOAT, GL_FALSE,
+       offsetof(CompactColorVertex, uv)},
+  }};
+};
+
+// Per-instance attribute: the rows of an affine transform that places an
+// instance relative to its model
+struct InstanceTransform {
+  std::array<glm::vec4, 3> rows;
+};
+
+// Points the shader attributes at a buffer of `Vertex` bound to
+// GL_ARRAY_BUFFER. Attributes the type doesn't store read a constant 1.
+template <typename Vertex> void set_attributes();
+
+// Most levels of detail of a mesh, including the full one
+constexpr size_t max_lod_levels = 5;
+
+// A range of the index buffer that draws the mesh at some level of detail
+struct LodLevel {
+  size_t first_index = 0;
+  size_t index_count = 0;
+  // How far the surface is from the full mesh, in model units
+  float error = 0.0F;
+};
+
+// Everything needed to draw vertex and index data stored in some format
+struct MeshLayout {
+  void (*set_attributes)() = &gl::set_attributes<Vertex>;
+  // Stride of the vertex type `set_attributes` was instantiated for
+  size_t vertex_size = sizeof(Vertex);
+  GLenum index_type = GL_UNSIGNED_INT;
+  // Indices of every level of detail together
+  size_t index_count = 0;
+  // Finest first, the first one is the full mesh
+  std::array<LodLevel, max_lod_levels> lods{};
+  size_t lod_count = 1;
+  // Maps stored positions back to model space
+  glm::vec3 position_scale = glm::vec3(1.0F);
+  glm::vec3 position_offset = glm::vec3(0.0F);
+  // Multiplied with the vertex color, if there is one
+  glm::vec3 material_color = glm::vec3(1.0F);
+  // Model space bounding box, still known after the vertices are freed
+  glm::vec3 bounds_min = glm::vec3(0.0F);
+  glm::vec3 bounds_max = glm::vec3(0.0F);
+  // Model space bounding sphere, for culling
+  glm::vec3 sphere_center = glm::vec3(0.0F);
+  float sphere_radius = 0.0F;
+};
+
+} // namespace gl
+
+#include "utils/vertex_format_impl.hpp"
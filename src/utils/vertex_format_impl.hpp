@@ -0,0 +1,31 @@
+#pragma once
+
+#include "utils/vertex_format.hpp"
+
+#include <algorithm>
+
+namespace gl {
+
+template <typename Vertex> void set_attributes() {
+  const auto &attributes = VertexLayout<Vertex>::attributes;
+  for (const auto location : attribute_locations) {
+    const auto attribute =
+        std::find_if(attributes.begin(), attributes.end(),
+                     [location](const Attribute &candidate) {
+                       return candidate.location == location;
+                     });
+    if (attribute == attributes.end()) {
+      glDisableVertexAttribArray(location);
+      glVertexAttrib4f(location, 1.0F, 1.0F, 1.0F, 1.0F);
+      continue;
+    }
+    glEnableVertexAttribArray(location);
+    glVertexAttribPointer(
+        location, attribute->size, attribute->type, attribute->normalized,
+        sizeof(Vertex),
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        reinterpret_cast<void *>(attribute->offset));
+  }
+}
+
+} // namespace gl
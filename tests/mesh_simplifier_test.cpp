@@ -0,0 +1,48 @@
+#include "utils/io.hpp"
+#include "utils/mesh/index_builder.hpp"
+#include "utils/mesh/mesh_simplifier.hpp"
+#include "utils/parsers/obj_lexer.hpp"
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+
+namespace {
+
+// Loads `path` the way the OBJ loader does and builds its levels of detail
+auto build_lods(const std::string_view path) -> mesh::MeshData {
+  const auto file = map_file(path);
+  const auto [points, uvs, faces, color, texture_path] =
+      parser::obj::parse_lexer(file.view());
+  auto mesh = mesh::build_indexed(faces, points, uvs, color);
+  mesh::build_lods(mesh);
+  return mesh;
+}
+
+auto check(bool condition, const std::string_view message) -> bool {
+  if (!condition) {
+    std::cerr << "FAILED: " << message << '\n';
+  }
+  return condition;
+}
+
+} // namespace
+
+// Run from the repository root, where the resources are
+auto main() -> int {
+  // Repeats the shared corners of its objects, which used to pin every
+  // vertex in place as if it was on a seam
+  const auto city = build_lods("./resources/lowpoly_city_triangulated.obj");
+  bool passed = check(!city.lods.empty(), "the city has a level of detail");
+  for (const auto &lod : city.lods) {
+    passed &= check(lod.elements.size() < city.elements.size(),
+                    "every level has fewer triangles than the full mesh");
+    bool in_range = true;
+    for (const auto &element : lod.elements) {
+      for (const auto vertex : element.vertices) {
+        in_range &= vertex < city.vertices.size();
+      }
+    }
+    passed &= check(in_range, "levels index the vertices of the full mesh");
+  }
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}